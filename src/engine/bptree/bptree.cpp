@@ -1,18 +1,120 @@
 #include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
 
 #include "bptree.hpp"
 #include "../pager/pager.hpp"
 #include "../page/page.hpp"
 
-using std::nullopt;
 using std::swap;
+using std::move;
 using std::max;
 using std::min;
+using std::to_integer;
+using std::stable_sort;
+using std::sort;
+using std::runtime_error;
 
-Bptree::Bptree(Pager& pager, pageptr_t rootId): rootId(rootId), pager(pager) {}
+#define MIN_APPEND_RUN (8) // appends in a row before full rightmost leaf is left full instead of split in halves
+
+Bptree::Bptree(Pager& pager, pageptr_t rootId): rootId(rootId), pager(pager) {
+  MetaPage meta = pager.getMetaPage();
+  layout = meta.getLayout();
+  pageSize = meta.getPageSize();
+}
+
+// shortest key s with left < s <= right (in unsafe_buf::compare order, where proper prefix is greater)
+static vector<byte> shortestSeparator(const vector<byte>& left, const vector<byte>& right) {
+  size_t common = 0;
+  while (common < left.size() && common < right.size() && left[common] == right[common]) {
+    common++;
+  }
+
+  vector<byte> separator = right;
+  if (common < left.size() && common < right.size()) { // left[common] < right[common]
+    if (left.size() > common + 1) { // proper prefix of left is greater than left
+      separator.assign(left.begin(), left.begin() + common + 1);
+    }
+    else if (to_integer<uint8_t>(right[common]) - to_integer<uint8_t>(left[common]) >= 2) {
+      separator.assign(right.begin(), right.begin() + common);
+      separator.push_back(static_cast<byte>(to_integer<uint8_t>(left[common]) + 1));
+    }
+  }
+  return separator;
+}
+
+// index m splitting sorted items into pages [0, m) and [m, n), so that the bigger page is as small as possible
+// item i takes slotSize + keys[i].size() + tails[i] bytes, prefix shared by keys of page is stored once
+static size_t balancedSplit(const vector<vector<byte>>& keys, const vector<size_t>& tails, size_t headerSize, size_t slotSize, size_t pageSize) {
+  size_t count = keys.size();
+  assert(count >= 2);
+  vector<size_t> sums(count + 1, 0); // size of items before i without prefix compression
+  for (size_t i = 0; i < count; i++) {
+    sums[i + 1] = sums[i] + slotSize + keys[i].size() + tails[i];
+  }
+
+  auto partSize = [&](size_t first, size_t end) {
+    const vector<byte>& firstKey = keys[first];
+    const vector<byte>& lastKey = keys[end - 1];
+    size_t prefix = 0;
+    while (prefix < firstKey.size() && prefix < lastKey.size() && firstKey[prefix] == lastKey[prefix]) {
+      prefix++;
+    }
+    return headerSize + sums[end] - sums[first] - prefix * (end - first) + prefix;
+  };
+
+  size_t best = 1;
+  size_t bestSize = SIZE_MAX;
+  for (size_t mid = 1; mid < count; mid++) {
+    size_t size = max(partSize(0, mid), partSize(mid, count));
+    if (size < bestSize) {
+      best = mid;
+      bestSize = size;
+    }
+  }
+  if (bestSize > pageSize) {
+    throw runtime_error("item is too big to be stored in a page");
+  }
+  return best;
+}
+
+// spreads items over as few pages as they take, about equally full, put(page, i) places item i or returns false
+// sizes are taken without prefix compression, so they only hint where pages end
+template <typename Create, typename Put>
+static vector<Page> packPages(const vector<size_t>& sizes, size_t capacity, Create create, Put put) {
+  size_t total = 0;
+  for (size_t size: sizes) {
+    total += size;
+  }
+  size_t pageCount = max((total + capacity - 1) / capacity, (size_t) 1);
+  size_t target = (total + pageCount - 1) / pageCount;
+
+  vector<Page> pages;
+  pages.push_back(create());
+  size_t placed = 0; // bytes of items before the current one
+  size_t onPage = 0;
+  for (size_t i = 0; i < sizes.size(); i++) {
+    bool full = onPage > 0 && placed >= target * pages.size();
+    if (full || !put(pages.back(), i)) {
+      if (onPage == 0) {
+        throw runtime_error("item is too big to be stored in a page");
+      }
+      pages.push_back(create());
+      onPage = 0;
+      if (!put(pages.back(), i)) {
+        throw runtime_error("item is too big to be stored in a page");
+      }
+    }
+    placed += sizes[i];
+    onPage++;
+  }
+  return pages;
+}
 
 Bptree Bptree::createTree(Pager& pager) {
-  Page leafPage = Page::createLeaf();
+  MetaPage meta = pager.getMetaPage();
+  Page leafPage = Page::createLeaf(meta.getLayout(), meta.getPageSize());
   pageptr_t rootId = pager.addPage(leafPage);
   return Bptree(pager, rootId);
 }
@@ -23,73 +125,261 @@ void Bptree::insert(const vector<byte> &key, const vector<byte> &value) {
   vector<byte> oldRootKey;
   vector<byte> splitKey;
   pageptr_t splitId = 0;
+  bool added = false;
+  uint64_t newCount = 0;
+  uint64_t splitCount = 0;
+  bool isLast = false;
 
-  this->insertRecursive(this->rootId, key, value, newId, isSplit, splitKey, oldRootKey, splitId);
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    if (this->maxKey.has_value()) {
+      unsafe_buf<byte> keyBuf = unsafe_buf<byte>::createFromVector(key);
+      unsafe_buf<byte> maxBuf = unsafe_buf<byte>::createFromVector(this->maxKey.value());
+      if (unsafe_buf<byte>::compare(keyBuf, maxBuf) > 0 && this->appendRightmost<Layout>(key, value)) {
+        this->appendRun++;
+        return;
+      }
+    }
 
-  if (isSplit) {
-    Page newRootPage = Page::createInternal();
-    InternalPage newRoot(newRootPage);
+    this->rightmostPath.clear();
+    this->insertRecursive<Layout>(this->rootId, key, value, newId, isSplit, splitKey, oldRootKey, splitId, added, newCount, splitCount, isLast);
+    if (isLast) { // the next one may be an append
+      this->maxKey = key;
+      this->appendRun++;
+    }
+    else {
+      this->appendRun = 0;
+    }
+
+    if (isSplit) {
+      Page newRootPage = Page::createInternal(layout, pageSize);
+      InternalPage<Layout> newRoot(newRootPage);
+
+      newRoot.putInternal(splitKey, splitId, splitCount);
+      newRoot.putInternal(oldRootKey, newId, newCount);
+
+      // old root is already released by insertRecursive()
+      this->rootId = this->pager.addPage(newRoot.page);
+    }
+    else {
+      this->rootId = newId;
+    }
+  });
+}
 
-    newRoot.putInternal(splitKey, splitId);
-    newRoot.putInternal(oldRootKey, newId);
+void Bptree::insertBatch(vector<pair<vector<byte>, vector<byte>>> items) {
+  auto less = [](const pair<vector<byte>, vector<byte>>& a, const pair<vector<byte>, vector<byte>>& b) {
+    unsafe_buf<byte> aKey = unsafe_buf<byte>::createFromVector(a.first);
+    unsafe_buf<byte> bKey = unsafe_buf<byte>::createFromVector(b.first);
+    return unsafe_buf<byte>::compare(aKey, bKey) < 0;
+  };
+  stable_sort(items.begin(), items.end(), less);
 
-    this->pager.delPage(this->rootId);
-    this->rootId = this->pager.addPage(newRoot.page);
+  size_t count = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (i + 1 < items.size() && !less(items[i], items[i + 1])) { // repeated key, the next one wins
+      continue;
+    }
+    if (count != i) {
+      items[count] = move(items[i]);
+    }
+    count++;
   }
-  else {
-    this->rootId = newId;
+  items.resize(count);
+  if (items.empty()) {
+    return;
+  }
+
+  rightmostPath.clear();
+  if (maxKey.has_value()) {
+    unsafe_buf<byte> lastBuf = unsafe_buf<byte>::createFromVector(items.back().first);
+    unsafe_buf<byte> maxBuf = unsafe_buf<byte>::createFromVector(maxKey.value());
+    if (unsafe_buf<byte>::compare(lastBuf, maxBuf) > 0) {
+      maxKey = items.back().first;
+    }
   }
+
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    vector<Child> pages = this->insertBatchRecursive<Layout>(this->rootId, items, 0, items.size());
+    while (pages.size() > 1) { // root was split, new levels go on top
+      pages = this->writeInternal<Layout>(pages, 0);
+    }
+    this->rootId = pages[0].id;
+  });
 }
 
 void Bptree::remove(const vector<byte> &key) {
   pageptr_t newId = 0;
+  bool removed = false;
+  rightmostPath.clear();
+  if (maxKey == key) {
+    maxKey = nullopt;
+  }
+
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    deleteRecursive<Layout>(rootId, key, newId, removed);
+    if (newId == 0) {
+      return;
+    }
+
+    Page page = this->pager.getPage(newId);
+    if (page.getPageType() == PageType::Internal) {
+      InternalPage<Layout> root(page);
+      pagesize_t rootCount = root.countInternal();
+      pageptr_t newRootId = 0;
+      if (rootCount == 1) {
+        newRootId = root.getPageptr(0);
+        assert(newRootId != 0);
+        this->pager.delPage(newId);
+        newId = newRootId;
+      }
+    }
+    this->rootId = newId;
+  });
+}
 
-  deleteRecursive(rootId, key, newId);
-  if (newId == 0) {
+void Bptree::removeRange(const vector<byte>& lo, const vector<byte>& hi) {
+  unsafe_buf<byte> loBuf = unsafe_buf<byte>::createFromVector(lo);
+  unsafe_buf<byte> hiBuf = unsafe_buf<byte>::createFromVector(hi);
+  if (unsafe_buf<byte>::compare(loBuf, hiBuf) >= 0) {
     return;
   }
+  rightmostPath.clear();
+  if (maxKey.has_value()) {
+    unsafe_buf<byte> maxBuf = unsafe_buf<byte>::createFromVector(maxKey.value());
+    if (unsafe_buf<byte>::compare(loBuf, maxBuf) <= 0 && unsafe_buf<byte>::compare(maxBuf, hiBuf) < 0) {
+      maxKey = nullopt;
+    }
+  }
+
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    pageptr_t newId = 0;
+    uint64_t removed = 0;
+    removeRangeRecursive<Layout>(this->rootId, loBuf, hiBuf, nullopt, newId, removed);
+    if (newId == 0) { // everything is removed
+      newId = this->pager.addPage(Page::createLeaf(layout, pageSize));
+    }
 
-  Page page = this->pager.getPage(newId);
-  if (page.getPageType() == PageType::Internal) {
-    InternalPage root(page);
-    pagesize_t rootCount = root.countInternal();
-    pageptr_t newRootId = 0;
-    if (rootCount == 1) {
-      newRootId = root.getPageptr(0);
-      assert(newRootId != 0);
+    // several levels may be left with one child
+    while (true) {
+      Page page = this->pager.getPage(newId);
+      if (page.getPageType() != PageType::Internal || InternalPage<Layout>(page).countInternal() > 1) {
+        break;
+      }
+      pageptr_t childId = InternalPage<Layout>(page).getPageptr(0);
       this->pager.delPage(newId);
-      newId = newRootId;
+      newId = childId;
     }
-  }
-  this->rootId = newId;
+    this->rootId = newId;
+  });
 }
 
 optional<vector<byte>> Bptree::search(const vector<byte>& key) const {
-  return this->searchRecursive(this->rootId, key);
+  return withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    return this->searchRecursive<Layout>(this->rootId, key);
+  });
+}
+
+vector<optional<vector<byte>>> Bptree::multiGet(const vector<vector<byte>>& keys) const {
+  vector<size_t> order(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    unsafe_buf<byte> aKey = unsafe_buf<byte>::createFromVector(keys[a]);
+    unsafe_buf<byte> bKey = unsafe_buf<byte>::createFromVector(keys[b]);
+    return unsafe_buf<byte>::compare(aKey, bKey) < 0;
+  });
+
+  vector<optional<vector<byte>>> results(keys.size());
+  if (keys.empty()) {
+    return results;
+  }
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    this->multiGetRecursive<Layout>(this->rootId, keys, order, 0, order.size(), results);
+  });
+  return results;
 }
 
+template <typename Layout>
+void Bptree::multiGetRecursive(pageptr_t pageId, const vector<vector<byte>>& keys, const vector<size_t>& order,
+    size_t first, size_t end, vector<optional<vector<byte>>>& results) const {
+  Page page = pager.getPage(pageId);
+
+  switch (page.getPageType()) {
+    case PageType::Leaf: {
+      LeafPage<Layout> leaf(page);
+      for (size_t i = first; i < end; i++) {
+        int32_t index = leaf.searchLeaf(keys[order[i]]);
+        if (index == -1) {
+          continue;
+        }
+        results[order[i]] = leaf.isOverflow(index) ? readOverflow(leaf.getOverflowPtr(index)) : leaf.getValue(index).toVector();
+      }
+      return;
+    }
+    case PageType::Internal: {
+      InternalPage<Layout> internal(page);
+      pagesize_t count = internal.countInternal();
+      for (size_t i = first; i < end;) {
+        int32_t childIndex = internal.searchInternal(keys[order[i]]);
+        if (childIndex == -1) { // less than every key of subtree
+          i++;
+          continue;
+        }
+
+        // keys of one child go down together
+        size_t groupEnd = end;
+        if ((pagesize_t) childIndex + 1 < count) {
+          vector<byte> nextKey = internal.getKeyInternal(childIndex + 1);
+          unsafe_buf<byte> nextBuf = unsafe_buf<byte>::createFromVector(nextKey);
+          groupEnd = i + 1;
+          while (groupEnd < end) {
+            unsafe_buf<byte> keyBuf = unsafe_buf<byte>::createFromVector(keys[order[groupEnd]]);
+            if (unsafe_buf<byte>::compare(keyBuf, nextBuf) >= 0) {
+              break;
+            }
+            groupEnd++;
+          }
+        }
+
+        multiGetRecursive<Layout>(internal.getPageptr(childIndex), keys, order, i, groupEnd, results);
+        i = groupEnd;
+      }
+      return;
+    }
+    default: {
+      assert(false && "multiGetRecursive() got page of wrong type");
+      return;
+    }
+  }
+}
+
+template <typename Layout>
 optional<vector<byte>> Bptree::searchRecursive(pageptr_t pageId, const std::vector<byte>& key) const {
   Page page = pager.getPage(pageId);
   
   switch (page.getPageType()) {
     case PageType::Leaf: {
-      LeafPage leaf(page);
+      LeafPage<Layout> leaf(page);
       int32_t index = leaf.searchLeaf(key);
       if (index != -1) {
+        if (leaf.isOverflow(index)) {
+          return readOverflow(leaf.getOverflowPtr(index));
+        }
         vector<byte> value = leaf.getValue(index).toVector();
         return value;
       }
       return nullopt;
     }
     case PageType::Internal: {
-      InternalPage internal(page);
+      InternalPage<Layout> internal(page);
       int32_t childIndex = internal.searchInternal(key);
       if (childIndex == -1) {
         return nullopt;
       }
       pageptr_t childId = internal.getPageptr(childIndex);
 
-      return searchRecursive(childId, key);
+      return searchRecursive<Layout>(childId, key);
     }
     default: {
       assert(false && "deleteRecursive() got page of wrong type");
@@ -98,88 +388,145 @@ optional<vector<byte>> Bptree::searchRecursive(pageptr_t pageId, const std::vect
   }
 }
 
+template <typename Layout>
 void Bptree::insertRecursive(pageptr_t pageId, const vector<byte>& key, const vector<byte> &value, 
-    pageptr_t& newId, bool& isSplit, vector<byte>& splitKey, vector<byte>& oldRootKey, pageptr_t& splitId) {
+    pageptr_t& newId, bool& isSplit, vector<byte>& splitKey, vector<byte>& oldRootKey, pageptr_t& splitId,
+    bool& added, uint64_t& newCount, uint64_t& splitCount, bool& isLast) {
   auto page = this->pager.getPage(pageId);
   
   switch (page.getPageType()) {
     case PageType::Leaf: {
-      LeafPage leaf(page);
-      leaf.putLeaf(key, value);
-      oldRootKey = leaf.getKeyLeaf(0).toVector();
+      LeafPage<Layout> leaf(page);
+      int32_t oldIndex = leaf.searchLeaf(key);
+      if (oldIndex != -1 && leaf.isOverflow(oldIndex)) { // replaced value
+        freeOverflow(leaf.getOverflowPtr(oldIndex));
+      }
+      added = oldIndex == -1;
+      isLast = added && leaf.lowerBoundLeaf(unsafe_buf<byte>::createFromVector(key)) == leaf.countLeaf();
+      pageptr_t overflowPtr = 0;
+      if (value.size() > OVERFLOW_THRESHOLD(Layout::pageSize)) {
+        overflowPtr = writeOverflow(unsafe_buf<byte>::createFromVector(value));
+      }
+      bool fits = overflowPtr != 0 ? leaf.putLeafOverflow(key, overflowPtr) : leaf.putLeaf(key, value);
 
       isSplit = false;
-      if (leaf.page.isOversized()) {
-        auto newPage = Page::createLeaf();
-        LeafPage newLeaf(newPage);
-        pagesize_t oldCount = leaf.countLeaf();
-        assert(oldCount >= 2);
+      if (!fits) { // page is split first, new item goes to the half it belongs to
+        if (oldIndex != -1) {
+          leaf.delLeaf(oldIndex);
+        }
+        Page oldPage = leaf.page;
+        LeafPage<Layout> old(oldPage);
+        pagesize_t oldCount = old.countLeaf();
+        pagesize_t insertIn = old.lowerBoundLeaf(unsafe_buf<byte>::createFromVector(key));
 
-        pagesize_t midIndex = oldCount >> 1;
-        for (pagesize_t i = midIndex; i < oldCount; i++) {
-          unsafe_buf<byte> k = leaf.getKeyLeaf(i);
-          unsafe_buf<byte> v = leaf.getValue(i);
-          newLeaf.putLeaf(k, v);
+        vector<vector<byte>> keys;
+        vector<size_t> tails;
+        for (pagesize_t i = 0; i <= oldCount; i++) {
+          if (i == insertIn) {
+            keys.push_back(key);
+            tails.push_back(overflowPtr != 0 ? sizeof(OverflowPtr) : value.size());
+          }
+          if (i < oldCount) {
+            keys.push_back(old.getKeyLeaf(i));
+            tails.push_back(old.isOverflow(i) ? sizeof(OverflowPtr) : old.getValue(i).size());
+          }
         }
+        size_t midIndex = balancedSplit(keys, tails, sizeof(typename Layout::LeafHeader), sizeof(typename Layout::LeafSlot), Layout::pageSize);
 
-        leaf.delRangeLeaf(midIndex, oldCount);
+        leaf.page = Page::createLeaf(layout, pageSize);
+        auto newPage = Page::createLeaf(layout, pageSize);
+        LeafPage<Layout> newLeaf(newPage);
+        for (size_t i = 0; i < keys.size(); i++) {
+          LeafPage<Layout>& to = i < midIndex ? leaf : newLeaf;
+          if (i == insertIn) {
+            fits = overflowPtr != 0 ? to.putLeafOverflow(key, overflowPtr) : to.putLeaf(key, value);
+          }
+          else {
+            fits = to.copyLeaf(old, i < insertIn ? i : i - 1);
+          }
+          assert(fits);
+        }
 
-        assert(newLeaf.countLeaf() >= 0);
-        splitKey = newLeaf.getKeyLeaf(0).toVector();
+        splitKey = shortestSeparator(leaf.getKeyLeaf(leaf.countLeaf() - 1), newLeaf.getKeyLeaf(0));
         isSplit = true;
         splitId = this->pager.addPage(newLeaf.page);
+        newCount = leaf.countLeaf();
+        splitCount = newLeaf.countLeaf();
       }
-      this->pager.delPage(pageId);
-      newId = this->pager.addPage(leaf.page);
+      oldRootKey = leaf.getKeyLeaf(0);
+      newId = this->pager.updatePage(pageId, leaf.page);
 
       break;
     };
     case PageType::Internal: {
-      InternalPage internal(page);
+      InternalPage<Layout> internal(page);
       int32_t insertToIdx = internal.searchInternal(key);
+      bool isFirstKey = insertToIdx < 0; // key is less than every key of subtree, it becomes the first one
+      if (isFirstKey) {
+        insertToIdx = 0;
+      }
       pageptr_t insertId = internal.getPageptr(insertToIdx);
 
       pageptr_t childNewId = 0;
       bool isChildSplit = false;
       vector<byte> childSplitKey;
       pageptr_t childSplitId = 0;
+      uint64_t childNewCount = 0;
+      uint64_t childSplitCount = 0;
 
-      insertRecursive(insertId, key, value, childNewId, isChildSplit, childSplitKey, oldRootKey, childSplitId);
+      insertRecursive<Layout>(insertId, key, value, childNewId, isChildSplit, childSplitKey, oldRootKey, childSplitId,
+        added, childNewCount, childSplitCount, isLast);
+      isLast = isLast && (pagesize_t) insertToIdx + 1 == internal.countInternal();
 
       assert(insertToIdx >= 0);
-      internal.setGEptr(insertToIdx, childNewId);
-      if (isChildSplit) {
-        internal.putInternal(childSplitKey, childSplitId);
+      // child was changed in place (and count of its subtree is the same), so page stays as it is
+      if (childNewId == insertId && !isChildSplit && !isFirstKey && !(Layout::counted && added)) {
+        oldRootKey = internal.getKeyInternal(0);
+        newId = pageId;
+        break;
       }
-      oldRootKey = internal.getKeyInternal(0).toVector();
+      internal.setGEptr(insertToIdx, childNewId);
+      internal.setCount(insertToIdx, isChildSplit ? childNewCount : internal.getCount(insertToIdx) + added);
+      bool keyFits = !isFirstKey || internal.setKeyInternal(0, key, childNewId);
+      bool fits = keyFits && (!isChildSplit || internal.putInternal(childSplitKey, childSplitId, childSplitCount));
 
       isSplit = false;
-      if (internal.page.isOversized()) {
-        auto newPage = Page::createInternal();
-        InternalPage newInternal(newPage);
-        pagesize_t oldCount = internal.countInternal();
-        assert(oldCount >= 2);
-        
-        pagesize_t midIndex = oldCount >> 1;
-
-        unsafe_buf<byte> k = internal.getKeyInternal(midIndex);
-        pageptr_t p = internal.getPageptr(midIndex);
-        newInternal.putInternal(k, p);
+      if (!fits) { // page is split first, keys that didn't fit go to the half they belong to
+        vector<vector<byte>> keys;
+        vector<pageptr_t> ptrs;
+        vector<uint64_t> counts;
+        for (pagesize_t i = 0; i < internal.countInternal(); i++) {
+          keys.push_back(internal.getKeyInternal(i));
+          ptrs.push_back(internal.getPageptr(i));
+          counts.push_back(internal.getCount(i));
+        }
+        if (!keyFits) {
+          keys[0] = key;
+        }
+        if (isChildSplit) { // right half of the child follows it
+          keys.insert(keys.begin() + insertToIdx + 1, childSplitKey);
+          ptrs.insert(ptrs.begin() + insertToIdx + 1, childSplitId);
+          counts.insert(counts.begin() + insertToIdx + 1, childSplitCount);
+        }
+        size_t midIndex = balancedSplit(keys, vector<size_t>(keys.size(), 0), sizeof(typename Layout::InternalHeader), sizeof(typename Layout::InternalSlot), Layout::pageSize);
 
-        isSplit = true;
-        splitKey = k.toVector();
-        for (pagesize_t i = midIndex + 1; i < oldCount; i++) {
-          unsafe_buf<byte> k = internal.getKeyInternal(i);
-          pageptr_t p = internal.getPageptr(i);
-          newInternal.putInternal(k, p);
+        internal.page = Page::createInternal(layout, pageSize);
+        auto newPage = Page::createInternal(layout, pageSize);
+        InternalPage<Layout> newInternal(newPage);
+        for (size_t i = 0; i < keys.size(); i++) {
+          InternalPage<Layout>& to = i < midIndex ? internal : newInternal;
+          fits = to.putInternal(keys[i], ptrs[i], counts[i]);
+          assert(fits);
         }
 
-        internal.delRangeInternal(midIndex, oldCount);
-        
+        isSplit = true;
+        splitKey = keys[midIndex];
         splitId = this->pager.addPage(newInternal.page);
+        newCount = internal.totalCount();
+        splitCount = newInternal.totalCount();
       }
-      this->pager.delPage(pageId);
-      newId = this->pager.addPage(internal.page);
+      oldRootKey = internal.getKeyInternal(0);
+      newId = this->pager.updatePage(pageId, internal.page);
 
       break;
     }
@@ -190,162 +537,998 @@ void Bptree::insertRecursive(pageptr_t pageId, const vector<byte>& key, const ve
   }
 }
 
-void Bptree::deleteRecursive(pageptr_t pageId, const std::vector<byte>& key, pageptr_t& newId) {
+// key is greater than maxKey: it goes to the end of the rightmost leaf, pages above see only their last child change
+// full page is left as it is and the new key starts a new page, so pages of ascending inserts stay full,
+// unless inserts are not ascending for long enough: then it's up to insertRecursive() to split the leaf in halves
+template <typename Layout>
+bool Bptree::appendRightmost(const vector<byte>& key, const vector<byte>& value) {
+  if (this->rightmostPath.empty() || this->rightmostPath[0] != this->rootId) {
+    this->rightmostPath.clear();
+    pageptr_t pageId = this->rootId;
+    while (true) {
+      this->rightmostPath.push_back(pageId);
+      Page page = this->pager.getPage(pageId);
+      if (page.getPageType() == PageType::Leaf) {
+        break;
+      }
+      InternalPage<Layout> internal(page);
+      pageId = internal.getPageptr(internal.countInternal() - 1);
+    }
+  }
+
+  pageptr_t leafId = this->rightmostPath.back();
+  Page leafPage = this->pager.getPage(leafId);
+  LeafPage<Layout> leaf(leafPage);
+  if (leaf.countLeaf() == 0) { // maxKey is not in this leaf
+    this->rightmostPath.clear();
+    return false;
+  }
+
+  pageptr_t overflowPtr = 0;
+  if (value.size() > OVERFLOW_THRESHOLD(Layout::pageSize)) {
+    overflowPtr = writeOverflow(unsafe_buf<byte>::createFromVector(value));
+  }
+  auto put = [&](LeafPage<Layout>& to) {
+    return overflowPtr != 0 ? to.putLeafOverflow(key, overflowPtr) : to.putLeaf(key, value);
+  };
+
+  // level above gets either new id of its last child, or new child split off (it holds only the new key)
+  bool isSplit = !put(leaf);
+  if (isSplit && this->appendRun < MIN_APPEND_RUN) {
+    if (overflowPtr != 0) {
+      freeOverflow(overflowPtr);
+    }
+    return false;
+  }
+  pageptr_t childId = 0;
+  vector<byte> splitKey;
+  if (isSplit) {
+    Page newPage = Page::createLeaf(layout, pageSize);
+    LeafPage<Layout> newLeaf(newPage);
+    if (!put(newLeaf)) {
+      if (overflowPtr != 0) {
+        freeOverflow(overflowPtr);
+      }
+      throw runtime_error("item is too big to be stored in a page");
+    }
+    splitKey = shortestSeparator(this->maxKey.value(), key);
+    childId = this->pager.addPage(newPage);
+  }
+  else {
+    childId = this->pager.updatePage(leafId, leaf.page);
+  }
+  bool childMoved = childId != leafId;
+  this->rightmostPath.back() = childId;
+
+  // page changed in place stops the walk up, unless counts of pages above grow
+  for (size_t level = this->rightmostPath.size() - 1; level > 0 && (isSplit || childMoved || Layout::counted); level--) {
+    pageptr_t pageId = this->rightmostPath[level - 1];
+    Page page = this->pager.getPage(pageId);
+    InternalPage<Layout> internal(page);
+    pagesize_t last = internal.countInternal() - 1;
+    if (!isSplit) {
+      internal.setGEptr(last, childId);
+      internal.setCount(last, internal.getCount(last) + 1);
+    }
+    else if (!internal.putInternal(splitKey, childId, 1)) {
+      Page newPage = Page::createInternal(layout, pageSize);
+      bool fits = InternalPage<Layout>(newPage).putInternal(splitKey, childId, 1);
+      assert(fits);
+      childId = this->pager.addPage(newPage);
+      this->rightmostPath[level - 1] = childId;
+      continue;
+    }
+    isSplit = false;
+    childId = this->pager.updatePage(pageId, internal.page);
+    childMoved = childId != pageId;
+    this->rightmostPath[level - 1] = childId;
+  }
+
+  if (isSplit) { // old root is left as it is too, new root goes on top
+    Page oldRoot = this->pager.getPage(this->rootId);
+    vector<byte> oldRootKey;
+    uint64_t oldRootCount = 0;
+    if (oldRoot.getPageType() == PageType::Leaf) {
+      LeafPage<Layout> oldLeaf(oldRoot);
+      oldRootKey = oldLeaf.getKeyLeaf(0);
+      oldRootCount = oldLeaf.countLeaf();
+    }
+    else {
+      InternalPage<Layout> oldInternal(oldRoot);
+      oldRootKey = oldInternal.getKeyInternal(0);
+      oldRootCount = oldInternal.totalCount();
+    }
+
+    Page newRootPage = Page::createInternal(layout, pageSize);
+    InternalPage<Layout> newRoot(newRootPage);
+    newRoot.putInternal(oldRootKey, this->rootId, oldRootCount);
+    newRoot.putInternal(splitKey, childId, 1);
+    this->rightmostPath.insert(this->rightmostPath.begin(), this->pager.addPage(newRoot.page));
+  }
+  this->rootId = this->rightmostPath[0];
+  this->maxKey = key;
+  return true;
+}
+
+template <typename Layout>
+vector<Bptree::Child> Bptree::insertBatchRecursive(pageptr_t pageId,
+    const vector<pair<vector<byte>, vector<byte>>>& items, size_t first, size_t end) {
+  Page page = this->pager.getPage(pageId);
+
+  switch (page.getPageType()) {
+    case PageType::Leaf: {
+      LeafPage<Layout> leaf(page);
+      vector<pageptr_t> overflowPtrs(end - first, 0);
+      for (size_t i = first; i < end; i++) {
+        if (items[i].second.size() > OVERFLOW_THRESHOLD(Layout::pageSize)) {
+          overflowPtrs[i - first] = writeOverflow(unsafe_buf<byte>::createFromVector(items[i].second));
+        }
+      }
+
+      // items go to the page while they fit
+      size_t applied = first;
+      for (; applied < end; applied++) {
+        auto& [key, value] = items[applied];
+        pageptr_t overflowPtr = overflowPtrs[applied - first];
+        int32_t oldIndex = leaf.searchLeaf(key);
+        pageptr_t oldOverflow = oldIndex != -1 && leaf.isOverflow(oldIndex) ? leaf.getOverflowPtr(oldIndex) : 0;
+        bool fits = overflowPtr != 0 ? leaf.putLeafOverflow(key, overflowPtr) : leaf.putLeaf(key, value);
+        if (!fits) {
+          break;
+        }
+        if (oldOverflow != 0) { // replaced value
+          freeOverflow(oldOverflow);
+        }
+      }
+      if (applied == end) {
+        return {{leaf.getKeyLeaf(0), this->pager.updatePage(pageId, leaf.page), leaf.countLeaf()}};
+      }
+
+      // the rest is merged with items of the page, and they are split between new pages at once
+      struct Item {
+        int32_t oldIndex = -1; // -1 for item of batch
+        size_t batchIndex = 0;
+      };
+      vector<Item> merged;
+      vector<size_t> sizes;
+      pagesize_t oldCount = leaf.countLeaf();
+      pagesize_t oldIndex = 0;
+      size_t batchIndex = applied;
+      while (oldIndex < oldCount || batchIndex < end) {
+        int comp = 1; // > 0 takes item of batch
+        vector<byte> oldKey;
+        if (oldIndex < oldCount) {
+          oldKey = leaf.getKeyLeaf(oldIndex);
+          if (batchIndex < end) {
+            unsafe_buf<byte> oldBuf = unsafe_buf<byte>::createFromVector(oldKey);
+            unsafe_buf<byte> newBuf = unsafe_buf<byte>::createFromVector(items[batchIndex].first);
+            comp = unsafe_buf<byte>::compare(oldBuf, newBuf);
+          }
+          else {
+            comp = -1;
+          }
+        }
+
+        if (comp < 0) {
+          merged.push_back(Item {.oldIndex = (int32_t) oldIndex});
+          sizes.push_back(sizeof(typename Layout::LeafSlot) + oldKey.size() + (leaf.isOverflow(oldIndex) ? sizeof(OverflowPtr) : leaf.getValue(oldIndex).size()));
+          oldIndex++;
+          continue;
+        }
+        if (comp == 0) { // replaced value
+          if (leaf.isOverflow(oldIndex)) {
+            freeOverflow(leaf.getOverflowPtr(oldIndex));
+          }
+          oldIndex++;
+        }
+        auto& [key, value] = items[batchIndex];
+        merged.push_back(Item {.oldIndex = -1, .batchIndex = batchIndex});
+        sizes.push_back(sizeof(typename Layout::LeafSlot) + key.size() + (overflowPtrs[batchIndex - first] != 0 ? sizeof(OverflowPtr) : value.size()));
+        batchIndex++;
+      }
+
+      Page oldPage = leaf.page;
+      LeafPage<Layout> old(oldPage);
+      vector<Page> pages = packPages(sizes, Layout::pageSize - sizeof(typename Layout::LeafHeader),
+        [&]() { return Page::createLeaf(layout, pageSize); },
+        [&](Page& to, size_t i) {
+          LeafPage<Layout> toLeaf(to);
+          if (merged[i].oldIndex != -1) {
+            return toLeaf.copyLeaf(old, merged[i].oldIndex);
+          }
+          auto& [key, value] = items[merged[i].batchIndex];
+          pageptr_t overflowPtr = overflowPtrs[merged[i].batchIndex - first];
+          return overflowPtr != 0 ? toLeaf.putLeafOverflow(key, overflowPtr) : toLeaf.putLeaf(key, value);
+        });
+
+      vector<Child> result;
+      for (size_t i = 0; i < pages.size(); i++) {
+        LeafPage<Layout> to(pages[i]);
+        vector<byte> key = to.getKeyLeaf(0);
+        if (i > 0) {
+          LeafPage<Layout> prev(pages[i - 1]);
+          key = shortestSeparator(prev.getKeyLeaf(prev.countLeaf() - 1), key);
+        }
+        pageptr_t id = i == 0 ? this->pager.updatePage(pageId, pages[i]) : this->pager.addPage(pages[i]);
+        result.push_back(Child {key: move(key), id: id, count: to.countLeaf()});
+      }
+      return result;
+    }
+    case PageType::Internal: {
+      InternalPage<Layout> internal(page);
+      pagesize_t count = internal.countInternal();
+
+      // items of one child go down together
+      struct Group {
+        pagesize_t childIndex;
+        bool isFirstKey; // some key is less than every key of subtree, it becomes the first one
+        vector<Child> pages;
+      };
+      vector<Group> groups;
+      bool grows = false;
+      for (size_t i = first; i < end;) {
+        int32_t childIndex = internal.searchInternal(items[i].first);
+        bool isFirstKey = childIndex < 0;
+        if (isFirstKey) {
+          childIndex = 0;
+        }
+
+        size_t groupEnd = end;
+        if ((pagesize_t) childIndex + 1 < count) {
+          vector<byte> nextKey = internal.getKeyInternal(childIndex + 1);
+          unsafe_buf<byte> nextBuf = unsafe_buf<byte>::createFromVector(nextKey);
+          groupEnd = i + 1;
+          while (groupEnd < end) {
+            unsafe_buf<byte> keyBuf = unsafe_buf<byte>::createFromVector(items[groupEnd].first);
+            if (unsafe_buf<byte>::compare(keyBuf, nextBuf) >= 0) {
+              break;
+            }
+            groupEnd++;
+          }
+        }
+
+        groups.push_back(Group {
+          .childIndex = (pagesize_t) childIndex,
+          .isFirstKey = isFirstKey,
+          .pages = insertBatchRecursive<Layout>(internal.getPageptr(childIndex), items, i, groupEnd),
+        });
+        grows = grows || isFirstKey || groups.back().pages.size() > 1;
+        i = groupEnd;
+      }
+
+      if (!grows) { // only pointers and counts change, or nothing at all when children were changed in place
+        bool changed = false;
+        for (Group& group: groups) {
+          Child& child = group.pages[0];
+          if (child.id != internal.getPageptr(group.childIndex) || child.count != internal.getCount(group.childIndex)) {
+            internal.setGEptr(group.childIndex, child.id);
+            internal.setCount(group.childIndex, child.count);
+            changed = true;
+          }
+        }
+        pageptr_t newId = changed ? this->pager.updatePage(pageId, internal.page) : pageId;
+        return {{internal.getKeyInternal(0), newId, internal.totalCount()}};
+      }
+
+      vector<Child> entries;
+      size_t groupIndex = 0;
+      for (pagesize_t i = 0; i < count; i++) {
+        if (groupIndex == groups.size() || groups[groupIndex].childIndex != i) {
+          entries.push_back(Child {key: internal.getKeyInternal(i), id: internal.getPageptr(i), count: internal.getCount(i)});
+          continue;
+        }
+
+        Group& group = groups[groupIndex];
+        Child& child = group.pages[0];
+        entries.push_back(Child {key: group.isFirstKey ? child.key : internal.getKeyInternal(i), id: child.id, count: child.count});
+        entries.insert(entries.end(), group.pages.begin() + 1, group.pages.end());
+        groupIndex++;
+      }
+      return writeInternal<Layout>(entries, pageId);
+    }
+    default: {
+      assert(false && "insertBatchRecursive() got page of wrong type");
+      return {};
+    }
+  }
+}
+
+// packs entries into internal pages, the first one replaces reuseId (0 means new page)
+template <typename Layout>
+vector<Bptree::Child> Bptree::writeInternal(const vector<Child>& entries, pageptr_t reuseId) {
+  vector<size_t> sizes;
+  for (const Child& entry: entries) {
+    sizes.push_back(sizeof(typename Layout::InternalSlot) + entry.key.size());
+  }
+
+  vector<Page> pages = packPages(sizes, Layout::pageSize - sizeof(typename Layout::InternalHeader),
+    [&]() { return Page::createInternal(layout, pageSize); },
+    [&](Page& to, size_t i) { return InternalPage<Layout>(to).putInternal(entries[i].key, entries[i].id, entries[i].count); });
+
+  vector<Child> result;
+  for (size_t i = 0; i < pages.size(); i++) {
+    InternalPage<Layout> to(pages[i]);
+    pageptr_t id = i == 0 && reuseId != 0 ? this->pager.updatePage(reuseId, pages[i]) : this->pager.addPage(pages[i]);
+    result.push_back(Child {key: to.getKeyInternal(0), id: id, count: to.totalCount()});
+  }
+  return result;
+}
+
+template <typename Layout>
+void Bptree::deleteRecursive(pageptr_t pageId, const std::vector<byte>& key, pageptr_t& newId, bool& removed) {
   Page page = this->pager.getPage(pageId);
 
   switch (page.getPageType()) {
     case PageType::Leaf: {
-      LeafPage leaf(page);
+      LeafPage<Layout> leaf(page);
       int32_t index = leaf.searchLeaf(key);
+      removed = index != -1;
       if (index != -1) {
+        if (leaf.isOverflow(index)) {
+          freeOverflow(leaf.getOverflowPtr(index));
+        }
         leaf.delLeaf(index);
-        this->pager.delPage(pageId);
-        newId = pager.addPage(leaf.page);
+        newId = this->pager.updatePage(pageId, leaf.page);
+      }
+      else {
+        newId = pageId;
       }
       break;
     }
     case PageType::Internal: {
-      InternalPage internal(page);
+      InternalPage<Layout> internal(page);
       int32_t childIndex = internal.searchInternal(key);
+      if (childIndex < 0) { // key is less than every key of subtree, nothing to delete
+        removed = false;
+        newId = pageId;
+        return;
+      }
       pageptr_t childId = internal.getPageptr(childIndex);
 
       pageptr_t childNewId = 0;
-      deleteRecursive(childId, key, childNewId);
+      deleteRecursive<Layout>(childId, key, childNewId, removed);
 
       assert(childIndex >= 0);
+      bool changed = childNewId != childId || (Layout::counted && removed);
       internal.setGEptr(childIndex, childNewId);
+      internal.setCount(childIndex, internal.getCount(childIndex) - removed);
 
-      Page childPage = this->pager.getPage(childNewId);
-      bool haveSiblings = childIndex >= 0 && internal.countInternal() >= 2;
+      changed = mergeChild<Layout>(internal, childIndex) || changed;
 
-      if (childPage.isUndersized() && haveSiblings) {
-        int32_t siblingIndex = 0;
-        if (childIndex == internal.countInternal() - 1) {
-          assert(childIndex != -1);
-          siblingIndex = childIndex - 1;
-        }
-        else {
-          siblingIndex = childIndex + 1;
-        }
+      // child changed in place (or key was not found) and its count is the same, so page stays as it is
+      newId = changed ? this->pager.updatePage(pageId, internal.page) : pageId;
+      break;
+    }
+    default: {
+      assert(false && "deleteRecursive() got page of wrong type");
+      return;
+    }
+  }
+}
 
-        pageptr_t siblingId = internal.getPageptr(siblingIndex);  
-        Page siblingPage = this->pager.getPage(siblingId);
+template <typename Layout>
+void Bptree::removeRangeRecursive(pageptr_t pageId, unsafe_buf<byte> lo, unsafe_buf<byte> hi,
+    const optional<vector<byte>>& upper, pageptr_t& newId, uint64_t& removed) {
+  Page page = this->pager.getPage(pageId);
 
-        if (childPage.byteSize() + siblingPage.byteSize() < PAGE_SIZE) { // merging
-          switch (childPage.getPageType()) {
-            case PageType::Leaf: {
-              LeafPage child(childPage);
-              LeafPage sibling(siblingPage);
+  switch (page.getPageType()) {
+    case PageType::Leaf: {
+      LeafPage<Layout> leaf(page);
+      pagesize_t start = leaf.lowerBoundLeaf(lo);
+      pagesize_t end = leaf.lowerBoundLeaf(hi);
+      if (start >= end) {
+        removed = 0;
+        newId = pageId;
+        return;
+      }
+      removed = end - start;
 
-              for (pagesize_t i = 0; i < sibling.countLeaf(); i++) {
-                unsafe_buf<byte> k = sibling.getKeyLeaf(i);
-                unsafe_buf<byte> v = sibling.getValue(i);
-                child.putLeaf(k, v);
-              }
+      for (pagesize_t i = start; i < end; i++) {
+        if (leaf.isOverflow(i)) {
+          freeOverflow(leaf.getOverflowPtr(i));
+        }
+      }
+      if (end - start == leaf.countLeaf()) {
+        this->pager.delPage(pageId);
+        newId = 0;
+        return;
+      }
+      leaf.delRangeLeaf(start, end);
+      newId = this->pager.updatePage(pageId, leaf.page);
+      break;
+    }
+    case PageType::Internal: {
+      InternalPage<Layout> internal(page);
+      pagesize_t count = internal.countInternal();
 
-              break;
-            }
-            case PageType::Internal: {
-              InternalPage child(childPage);
-              InternalPage sibling(siblingPage);
+      // children [first, last] overlap the range, child i holds keys from key i up to key i + 1
+      int32_t first = max(internal.searchInternal(lo), 0);
+      int32_t last = internal.searchInternal(hi);
+      if (last >= 0) { // hi itself is not removed
+        vector<byte> lastKey = internal.getKeyInternal(last);
+        unsafe_buf<byte> lastBuf = unsafe_buf<byte>::createFromVector(lastKey);
+        if (unsafe_buf<byte>::compare(lastBuf, hi) == 0) {
+          last--;
+        }
+      }
+      if (last < first) {
+        removed = 0;
+        newId = pageId;
+        return;
+      }
 
-              for (pagesize_t i = 0; i < sibling.countInternal(); i++) {
-                unsafe_buf<byte> k = sibling.getKeyInternal(i);
-                pageptr_t p = sibling.getPageptr(i);
-                child.putInternal(k, p);
-              }
+      auto childUpper = [&](pagesize_t i) {
+        return i + 1 < count ? optional<vector<byte>>(internal.getKeyInternal(i + 1)) : upper;
+      };
+      // the whole child is inside the range, nothing of it is kept
+      auto inside = [&](pagesize_t i) {
+        vector<byte> lower = internal.getKeyInternal(i);
+        unsafe_buf<byte> lowerBuf = unsafe_buf<byte>::createFromVector(lower);
+        optional<vector<byte>> childEnd = childUpper(i);
+        if (unsafe_buf<byte>::compare(lo, lowerBuf) > 0 || !childEnd.has_value()) {
+          return false;
+        }
+        unsafe_buf<byte> endBuf = unsafe_buf<byte>::createFromVector(childEnd.value());
+        return unsafe_buf<byte>::compare(endBuf, hi) <= 0;
+      };
+      auto trim = [&](pagesize_t i, uint64_t& childRemoved) {
+        pageptr_t childId = internal.getPageptr(i);
+        if (inside(i)) {
+          childRemoved = internal.getCount(i);
+          freeSubtree<Layout>(childId);
+          return (pageptr_t) 0;
+        }
+        pageptr_t childNewId = 0;
+        removeRangeRecursive<Layout>(childId, lo, hi, childUpper(i), childNewId, childRemoved);
+        return childNewId;
+      };
 
-              break;
-            }
-            default: {
-              assert(false && "deleteRecursive() got page of wrong type");
-            }
-          }
+      pageptr_t firstId = internal.getPageptr(first);
+      pageptr_t lastId = internal.getPageptr(last);
+      uint64_t firstRemoved = 0;
+      uint64_t lastRemoved = 0;
+      pageptr_t firstNewId = trim(first, firstRemoved);
+      pageptr_t lastNewId = last != first ? trim(last, lastRemoved) : firstNewId;
+      removed = firstRemoved + lastRemoved;
+      for (int32_t i = first + 1; i < last; i++) {
+        removed += internal.getCount(i);
+        freeSubtree<Layout>(internal.getPageptr(i));
+      }
+      // boundary children changed in place (and their counts are the same)
+      if (last - first < 2 && firstNewId == firstId && lastNewId == lastId && !(Layout::counted && removed > 0)) {
+        newId = pageId;
+        return;
+      }
+
+      // right to left, so indexes of the rest stay valid
+      if (last != first && lastNewId == 0) {
+        internal.delInternal(last);
+      }
+      else if (last != first) {
+        internal.setGEptr(last, lastNewId);
+        internal.setCount(last, internal.getCount(last) - lastRemoved);
+      }
+      if (last - first >= 2) {
+        internal.delRangeInternal(first + 1, last);
+      }
+      if (firstNewId == 0) {
+        internal.delInternal(first);
+      }
+      else {
+        internal.setGEptr(first, firstNewId);
+        internal.setCount(first, internal.getCount(first) - firstRemoved);
+      }
 
-          vector<byte> mergeKey;
-          mergeKey = internal.getKeyInternal(min(siblingIndex, childIndex)).toVector();
-          
-          internal.delInternal(max(siblingIndex, childIndex));
-          internal.delInternal(min(siblingIndex, childIndex));
+      if (internal.countInternal() == 0) {
+        this->pager.delPage(pageId);
+        newId = 0;
+        return;
+      }
 
-          this->pager.delPage(childNewId);
-          this->pager.delPage(siblingId);
-          pageptr_t childNewIdAfterMerge = this->pager.addPage(childPage);
-          internal.putInternal(mergeKey, childNewIdAfterMerge);
+      // boundary children are neighbours now, either of them may be undersized
+      for (pageptr_t childId: {firstNewId, lastNewId}) {
+        for (pagesize_t i = 0; childId != 0 && i < internal.countInternal(); i++) {
+          if (internal.getPageptr(i) == childId) {
+            mergeChild<Layout>(internal, i);
+            break;
+          }
         }
       }
-      
-      this->pager.delPage(pageId);
-      newId = this->pager.addPage(internal.page);
+      newId = this->pager.updatePage(pageId, internal.page);
       break;
     }
     default: {
-      assert(false && "deleteRecursive() got page of wrong type");
+      assert(false && "removeRangeRecursive() got page of wrong type");
       return;
     }
   }
 }
 
-BptreeIterator::BptreeIterator(Bptree &bptree): bptree(bptree) {
-  pageptr_t pageId = this->bptree.rootId;
-  while (true) {
-    pageStack.emplace(0, pageId);
-    Page page = this->bptree.pager.getPage(pageId);
-    if (page.getPageType() == PageType::Leaf) {
-      break;
+// frees every page of subtree, leaves are read only to find their overflow chains
+template <typename Layout>
+void Bptree::freeSubtree(pageptr_t pageId) {
+  Page page = this->pager.getPage(pageId);
+  if (page.getPageType() == PageType::Leaf) {
+    LeafPage<Layout> leaf(page);
+    for (pagesize_t i = 0; i < leaf.countLeaf(); i++) {
+      if (leaf.isOverflow(i)) {
+        freeOverflow(leaf.getOverflowPtr(i));
+      }
+    }
+  }
+  else {
+    InternalPage<Layout> internal(page);
+    for (pagesize_t i = 0; i < internal.countInternal(); i++) {
+      freeSubtree<Layout>(internal.getPageptr(i));
     }
-    InternalPage internal(page);
-    pageId = internal.getPageptr(0);
   }
+  this->pager.delPage(pageId);
 }
 
-inline bool BptreeIterator::hasNext() const {
-  return !pageStack.empty();
+// merges undersized child with its sibling when both fit in one page, returns false if pages are left as they are
+template <typename Layout>
+bool Bptree::mergeChild(InternalPage<Layout>& internal, pagesize_t childIndex) {
+  pageptr_t childId = internal.getPageptr(childIndex);
+  Page childPage = this->pager.getPage(childId);
+  if (!childPage.isUndersized() || internal.countInternal() < 2) {
+    return false;
+  }
+
+  pagesize_t siblingIndex = childIndex == internal.countInternal() - 1 ? childIndex - 1 : childIndex + 1;
+  pageptr_t siblingId = internal.getPageptr(siblingIndex);
+  Page siblingPage = this->pager.getPage(siblingId);
+
+  // merged page can still overflow when it ends up with shorter prefix, then pages are left as they are
+  bool merged = childPage.byteSize() + siblingPage.byteSize() < Layout::pageSize;
+  if (merged) {
+    switch (childPage.getPageType()) {
+      case PageType::Leaf: {
+        LeafPage<Layout> child(childPage);
+        LeafPage<Layout> sibling(siblingPage);
+
+        for (pagesize_t i = 0; merged && i < sibling.countLeaf(); i++) {
+          merged = child.copyLeaf(sibling, i);
+        }
+
+        break;
+      }
+      case PageType::Internal: {
+        InternalPage<Layout> child(childPage);
+        InternalPage<Layout> sibling(siblingPage);
+
+        for (pagesize_t i = 0; merged && i < sibling.countInternal(); i++) {
+          vector<byte> k = sibling.getKeyInternal(i);
+          pageptr_t p = sibling.getPageptr(i);
+          merged = child.putInternal(k, p, sibling.getCount(i));
+        }
+
+        break;
+      }
+      default: {
+        assert(false && "mergeChild() got page of wrong type");
+      }
+    }
+  }
+  if (!merged) {
+    return false;
+  }
+
+  vector<byte> mergeKey = internal.getKeyInternal(min(siblingIndex, childIndex));
+  uint64_t mergedCount = internal.getCount(childIndex) + internal.getCount(siblingIndex);
+  internal.delInternal(max(siblingIndex, childIndex));
+  internal.delInternal(min(siblingIndex, childIndex));
+
+  this->pager.delPage(siblingId);
+  pageptr_t mergedId = this->pager.updatePage(childId, childPage);
+  internal.putInternal(mergeKey, mergedId, mergedCount);
+  return true;
 }
 
-pair<vector<byte>, vector<byte>> BptreeIterator::next() {
-  auto [currentIndex, currentPageId] = this->pageStack.top();
-  this->pageStack.pop();
+pageptr_t Bptree::writeOverflow(const unsafe_buf<byte>& value) {
+  assert(value.size() <= UINT32_MAX);
 
-  Page page = this->bptree.pager.getPage(currentPageId);
-  LeafPage leaf(page);
+  // written from the tail, so every page knows its successor
+  pageptr_t next = 0;
+  size_t pageCount = (value.size() + MAX_OVERFLOW_DATA(pageSize) - 1) / MAX_OVERFLOW_DATA(pageSize);
+  for (size_t i = pageCount; i > 0; i--) {
+    size_t start = (i - 1) * MAX_OVERFLOW_DATA(pageSize);
+    unsafe_buf<byte> chunk = {
+      ptr: value.ptr + start,
+      len: min(value.size() - start, (size_t) MAX_OVERFLOW_DATA(pageSize)),
+    };
 
-  assert(currentIndex < leaf.countLeaf());
+    Page page = Page::createOverflow(pageSize);
+    OverflowPage overflow(page);
+    overflow.setNext(next);
+    overflow.setTotalSize(value.size());
+    overflow.putData(chunk);
+    next = this->pager.addPage(page);
+  }
+  return next;
+}
 
-  vector<byte> key = leaf.getKeyLeaf(currentIndex).toVector();
-  vector<byte> value = leaf.getValue(currentIndex).toVector();
+vector<byte> Bptree::readOverflow(pageptr_t pageId) const {
+  vector<byte> value;
+  while (pageId != 0) {
+    Page page = this->pager.getPage(pageId);
+    OverflowPage overflow(page);
+    if (value.empty()) {
+      value.reserve(overflow.getTotalSize());
+    }
+    unsafe_buf<byte> data = overflow.getData();
+    value.insert(value.end(), data.ptr, data.ptr + data.len);
+    pageId = overflow.getNext();
+  }
+  return value;
+}
 
-  if (currentIndex + 1 < leaf.countLeaf()) {
-    pageStack.emplace(currentIndex + 1, currentPageId);
+void Bptree::freeOverflow(pageptr_t pageId) {
+  while (pageId != 0) {
+    Page page = this->pager.getPage(pageId);
+    OverflowPage overflow(page);
+    pageptr_t next = overflow.getNext();
+    this->pager.delPage(pageId);
+    pageId = next;
   }
-  else {
-    while (!this->pageStack.empty()) {
-      auto [parentIndex, parentPageId] = this->pageStack.top();
-      this->pageStack.pop();
+}
 
-      Page parentPage = this->bptree.pager.getPage(parentPageId);
-      if (parentPage.getPageType() == PageType::Internal) {
-        InternalPage internal(parentPage);
+BptreeCursor Bptree::scan(const vector<byte>& lowerBound, optional<vector<byte>> upperBound) const {
+  BptreeCursor cursor(*this);
+  if (upperBound.has_value()) {
+    cursor.setUpperBound(upperBound.value());
+  }
+  cursor.seek(lowerBound);
+  return cursor;
+}
 
-        if (parentIndex + 1 < internal.countInternal()) {
-          pageStack.emplace(parentIndex + 1, parentPageId);
-          pageptr_t nextPageId = internal.getPageptr(parentIndex + 1);
+void Bptree::requireCounts() const {
+  if (layout != PageLayout::NativeCounted) {
+    throw runtime_error("tree has no subtree counts, file has to be created with counted layout");
+  }
+}
 
-          while (true) {
-            pageStack.emplace(0, nextPageId);
-            Page page = this->bptree.pager.getPage(nextPageId);
-            if (page.getPageType() == PageType::Leaf) {
-              break;
-            }
-            InternalPage internal(page);
-            nextPageId = internal.getPageptr(0);
-          }
+uint64_t Bptree::count() const {
+  requireCounts();
+  return withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    Page page = this->pager.getPage(this->rootId);
+    if (page.getPageType() == PageType::Leaf) {
+      return (uint64_t) LeafPage<Layout>(page).countLeaf();
+    }
+    return InternalPage<Layout>(page).totalCount();
+  });
+}
+
+uint64_t Bptree::rank(const vector<byte>& key) const {
+  requireCounts();
+  unsafe_buf<byte> keyBuf = unsafe_buf<byte>::createFromVector(key);
+
+  return withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    uint64_t less = 0; // items of subtrees left of the path
+    pageptr_t pageId = this->rootId;
+    while (true) {
+      Page page = this->pager.getPage(pageId);
+      if (page.getPageType() == PageType::Leaf) {
+        return less + LeafPage<Layout>(page).lowerBoundLeaf(keyBuf);
+      }
+
+      InternalPage<Layout> internal(page);
+      int32_t childIndex = internal.searchInternal(keyBuf);
+      if (childIndex < 0) { // key is less than every key of subtree
+        return less;
+      }
+      for (int32_t i = 0; i < childIndex; i++) {
+        less += internal.getCount(i);
+      }
+      pageId = internal.getPageptr(childIndex);
+    }
+  });
+}
+
+uint64_t Bptree::countRange(const vector<byte>& lo, const vector<byte>& hi) const {
+  unsafe_buf<byte> loBuf = unsafe_buf<byte>::createFromVector(lo);
+  unsafe_buf<byte> hiBuf = unsafe_buf<byte>::createFromVector(hi);
+  if (unsafe_buf<byte>::compare(loBuf, hiBuf) >= 0) {
+    requireCounts();
+    return 0;
+  }
+  return rank(hi) - rank(lo);
+}
+
+BptreeCursor Bptree::at(uint64_t index, optional<vector<byte>> upperBound) const {
+  BptreeCursor cursor(*this);
+  if (upperBound.has_value()) {
+    cursor.setUpperBound(upperBound.value());
+  }
+  cursor.seekIndex(index);
+  return cursor;
+}
+
+BptreeCursor::BptreeCursor(const Bptree& bptree): bptree(bptree) {}
+
+// pushes leftmost path of subtree
+void BptreeCursor::descend(pageptr_t pageId) {
+  withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    while (true) {
+      Page page = this->bptree.pager.getPage(pageId);
+      if (page.getPageType() == PageType::Leaf) {
+        path.emplace_back(move(page), 0);
+        return;
+      }
 
+      InternalPage<Layout> internal(page);
+      pageId = internal.getPageptr(0);
+      path.emplace_back(move(page), 0);
+    }
+  });
+}
+
+// moves past leaves with no keys left, path is empty when the tree is over
+void BptreeCursor::skipExhausted() {
+  withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    while (!path.empty()) {
+      LeafPage<Layout> leaf(path.back().first);
+      if (path.back().second < leaf.countLeaf()) {
+        return;
+      }
+
+      path.pop_back();
+      while (!path.empty()) {
+        auto& [parentPage, parentIndex] = path.back();
+        InternalPage<Layout> internal(parentPage);
+        if (parentIndex + 1 < internal.countInternal()) {
+          parentIndex++;
+          descend(internal.getPageptr(parentIndex));
           break;
         }
+        path.pop_back();
       }
     }
+  });
+}
+
+void BptreeCursor::checkUpperBound() {
+  if (path.empty() || !upperBound.has_value()) {
+    return;
   }
 
+  unsafe_buf<byte> current = key();
+  unsafe_buf<byte> bound = unsafe_buf<byte>::createFromVector(upperBound.value());
+  if (unsafe_buf<byte>::compare(current, bound) >= 0) {
+    path.clear();
+  }
+}
+
+void BptreeCursor::seekFirst() {
+  path.clear();
+  descend(this->bptree.rootId);
+  skipExhausted();
+  checkUpperBound();
+}
+
+void BptreeCursor::seek(const vector<byte>& lowerBound) {
+  path.clear();
+  unsafe_buf<byte> bound = unsafe_buf<byte>::createFromVector(lowerBound);
+
+  withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    pageptr_t pageId = this->bptree.rootId;
+    while (true) {
+      Page page = this->bptree.pager.getPage(pageId);
+      if (page.getPageType() == PageType::Leaf) {
+        LeafPage<Layout> leaf(page);
+        pagesize_t index = leaf.lowerBoundLeaf(bound);
+        path.emplace_back(move(page), index);
+        break;
+      }
+
+      InternalPage<Layout> internal(page);
+      int32_t childIndex = max(internal.searchInternal(bound), 0); // bound may be less than every separator
+      pageId = internal.getPageptr(childIndex);
+      path.emplace_back(move(page), childIndex);
+    }
+  });
+
+  skipExhausted();
+  checkUpperBound();
+}
+
+void BptreeCursor::seekIndex(uint64_t index) {
+  this->bptree.requireCounts();
+  path.clear();
+
+  withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    pageptr_t pageId = this->bptree.rootId;
+    while (true) {
+      Page page = this->bptree.pager.getPage(pageId);
+      if (page.getPageType() == PageType::Leaf) {
+        if (index >= LeafPage<Layout>(page).countLeaf()) { // tree has fewer keys
+          path.clear();
+          return;
+        }
+        path.emplace_back(move(page), (pagesize_t) index);
+        return;
+      }
+
+      // children are skipped with all their items
+      InternalPage<Layout> internal(page);
+      pagesize_t childIndex = 0;
+      while (childIndex + 1 < internal.countInternal() && index >= internal.getCount(childIndex)) {
+        index -= internal.getCount(childIndex);
+        childIndex++;
+      }
+      pageId = internal.getPageptr(childIndex);
+      path.emplace_back(move(page), childIndex);
+    }
+  });
+
+  checkUpperBound();
+}
+
+void BptreeCursor::setUpperBound(const vector<byte>& upperBound) {
+  this->upperBound = upperBound;
+  checkUpperBound();
+}
+
+void BptreeCursor::next() {
+  assert(valid());
+  path.back().second++;
+  skipExhausted();
+  checkUpperBound();
+}
+
+unsafe_buf<byte> BptreeCursor::key() {
+  assert(valid());
+  return withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    LeafPage<Layout> leaf(path.back().first);
+    if (leaf.getPrefixLeaf().len == 0) {
+      return leaf.getSuffixLeaf(path.back().second);
+    }
+    keyBuf = leaf.getKeyLeaf(path.back().second); // prefix and suffix are stored apart
+    return unsafe_buf<byte>::createFromVector(keyBuf);
+  });
+}
+
+unsafe_buf<byte> BptreeCursor::value() {
+  assert(valid());
+  return withLayout(this->bptree.layout, this->bptree.pageSize, [&]<typename Layout>(Layout) {
+    LeafPage<Layout> leaf(path.back().first);
+    if (leaf.isOverflow(path.back().second)) {
+      overflowValue = this->bptree.readOverflow(leaf.getOverflowPtr(path.back().second));
+      return unsafe_buf<byte>::createFromVector(overflowValue);
+    }
+    return leaf.getValue(path.back().second);
+  });
+}
+
+BptreeIterator::BptreeIterator(Bptree &bptree): cursor(bptree) {
+  cursor.seekFirst();
+}
+
+inline bool BptreeIterator::hasNext() const {
+  return cursor.valid();
+}
+
+pair<vector<byte>, vector<byte>> BptreeIterator::next() {
+  vector<byte> key = cursor.key().toVector();
+  vector<byte> value = cursor.value().toVector();
+  cursor.next();
+
   return {key, value};
 }
+
+BptreeBuilder::BptreeBuilder(Pager& pager, double fillFactor): tree(pager, 0) {
+  if (!(fillFactor > 0 && fillFactor <= 1)) {
+    throw runtime_error("fill factor has to be in (0, 1]");
+  }
+  fillLimit = fillFactor * tree.pageSize;
+  levels.push_back(Level {
+    .page = Page::createLeaf(tree.layout, tree.pageSize),
+  });
+}
+
+void BptreeBuilder::add(const vector<byte>& key, const vector<byte>& value) {
+  assert(!levels.empty() && "add() after finish()");
+  if (lastKey.has_value()) {
+    unsafe_buf<byte> last = unsafe_buf<byte>::createFromVector(lastKey.value());
+    unsafe_buf<byte> current = unsafe_buf<byte>::createFromVector(key);
+    if (unsafe_buf<byte>::compare(last, current) >= 0) {
+      throw runtime_error("keys have to be added in ascending order");
+    }
+  }
+
+  withLayout(tree.layout, tree.pageSize, [&]<typename Layout>(Layout) {
+    this->addLeaf<Layout>(key, value);
+  });
+  lastKey = key;
+}
+
+Bptree BptreeBuilder::finish() {
+  withLayout(tree.layout, tree.pageSize, [&]<typename Layout>(Layout) {
+    for (size_t level = 0; level < this->levels.size(); level++) {
+      if (level + 1 == this->levels.size()) { // nothing of the top level is written yet, its page is the root
+        this->tree.rootId = this->tree.pager.addPage(this->levels[level].page);
+        break;
+      }
+      this->closePage<Layout>(level);
+    }
+  });
+  levels.clear();
+  tree.maxKey = lastKey; // appends to the built tree go straight to its rightmost leaf
+  return tree;
+}
+
+template <typename Layout>
+void BptreeBuilder::addLeaf(const vector<byte>& key, const vector<byte>& value) {
+  pageptr_t overflowPtr = 0;
+  if (value.size() > OVERFLOW_THRESHOLD(Layout::pageSize)) {
+    overflowPtr = tree.writeOverflow(unsafe_buf<byte>::createFromVector(value));
+  }
+
+  auto put = [&](Page& page) {
+    LeafPage<Layout> leaf(page);
+    if (leaf.countLeaf() > 0 && page.byteSize() >= fillLimit) {
+      return false;
+    }
+    return overflowPtr != 0 ? leaf.putLeafOverflow(key, overflowPtr) : leaf.putLeaf(key, value);
+  };
+
+  if (!put(levels[0].page)) { // next item goes to the new page
+    bool empty = LeafPage<Layout>(levels[0].page).countLeaf() == 0;
+    if (!empty) {
+      closePage<Layout>(0);
+    }
+    if (empty || !put(levels[0].page)) {
+      throw runtime_error("item is too big to be stored in a page");
+    }
+  }
+  levels[0].count++;
+
+  if (LeafPage<Layout>(levels[0].page).countLeaf() == 1) { // parent needs only to tell this leaf from the previous one
+    levels[0].firstKey = levels[0].written > 0 ? shortestSeparator(lastKey.value(), key) : key;
+  }
+}
+
+template <typename Layout>
+void BptreeBuilder::addChild(size_t level, const vector<byte>& key, pageptr_t childId, uint64_t childCount) {
+  if (level == levels.size()) {
+    levels.push_back(Level {
+      .page = Page::createInternal(tree.layout, tree.pageSize),
+    });
+  }
+
+  auto put = [&](Page& page) {
+    InternalPage<Layout> internal(page);
+    if (internal.countInternal() > 0 && page.byteSize() >= fillLimit) {
+      return false;
+    }
+    return internal.putInternal(key, childId, childCount);
+  };
+
+  if (!put(levels[level].page)) { // next item goes to the new page
+    bool empty = InternalPage<Layout>(levels[level].page).countInternal() == 0;
+    if (!empty) {
+      closePage<Layout>(level);
+    }
+    if (empty || !put(levels[level].page)) {
+      throw runtime_error("item is too big to be stored in a page");
+    }
+  }
+  levels[level].count += childCount;
+
+  if (InternalPage<Layout>(levels[level].page).countInternal() == 1) {
+    levels[level].firstKey = key;
+  }
+}
+
+// writes open page of level and passes it to the level above
+template <typename Layout>
+void BptreeBuilder::closePage(size_t level) {
+  Level& closed = levels[level];
+  pageptr_t pageId = tree.pager.addPage(closed.page);
+  vector<byte> key = move(closed.firstKey);
+  uint64_t count = closed.count;
+  closed.written++;
+  closed.count = 0;
+  closed.page = level == 0 ? Page::createLeaf(tree.layout, tree.pageSize) : Page::createInternal(tree.layout, tree.pageSize);
+
+  addChild<Layout>(level + 1, key, pageId, count); // may grow levels, closed is not used after that
+}
@@ -1,20 +1,53 @@
 #pragma once
 
 #include <optional>
-#include <stack>
 #include <functional>
 
 #include "../pager/pager.hpp"
 #include "../page/page.hpp"
 
 using std::optional;
-using std::stack;
+using std::nullopt;
 using std::pair;
 using std::reference_wrapper;
 using std::swap;
 
 class Bptree;
+class BptreeCursor;
 class BptreeIterator;
+class BptreeBuilder;
+
+// forward scan over [lower bound, upper bound)
+// pages of the current root-to-leaf path are kept, so every page is fetched once per scan
+class BptreeCursor {
+ public:
+  BptreeCursor(const Bptree& bptree);
+
+  void seekFirst();
+  void seek(const vector<byte>& lowerBound); // first key >= lowerBound
+  void seekIndex(uint64_t index); // index-th key of the tree (0-based), needs counted layout
+  void setUpperBound(const vector<byte>& upperBound); // exclusive
+
+  bool valid() const { return !path.empty(); }
+  void next();
+
+  // valid until next() or seek(), point straight into the current leaf unless key is prefix compressed
+  // overflow value is read only when asked for
+  unsafe_buf<byte> key();
+  unsafe_buf<byte> value();
+
+ private:
+  const Bptree& bptree;
+
+  vector<pair<Page, pagesize_t>> path; // page and index of child (key in leaf) we are at
+  optional<vector<byte>> upperBound;
+  vector<byte> keyBuf; // current key if leaf is prefix compressed
+  vector<byte> overflowValue; // value of the current item if it's stored in overflow pages
+
+  void descend(pageptr_t pageId);
+  void skipExhausted();
+  void checkUpperBound();
+};
 
 class BptreeIterator {
  public:
@@ -24,9 +57,7 @@ class BptreeIterator {
   pair<vector<byte>, vector<byte>> next();
 
  private:
-  Bptree& bptree;
-
-  stack<pair<pagesize_t, pageptr_t>, vector<pair<pagesize_t, pageptr_t>>> pageStack;
+  BptreeCursor cursor;
 };
 
 class Bptree {
@@ -47,24 +78,115 @@ class Bptree {
 
   pageptr_t getRootId() { return rootId; }
 
+  // key greater than every key of the tree is appended: rightmost path is remembered, so it's not searched,
+  // and after a few appends in a row full rightmost page is not split in halves, new key starts a new page (see appendRightmost())
   void insert(const vector<byte>& key, const vector<byte>& value);
+  // items are sorted and routed down the tree in groups: every page on their paths is written once,
+  // and page that gets too many items is split once into as many pages as needed
+  // later item wins for repeated key
+  void insertBatch(vector<pair<vector<byte>, vector<byte>>> items);
   void remove(const vector<byte>& key);
+  // removes keys lo <= key < hi: subtrees inside the range are freed without looking at their keys,
+  // only pages on the two boundary paths are trimmed and merged with siblings
+  void removeRange(const vector<byte>& lo, const vector<byte>& hi);
   optional<vector<byte>> search(const vector<byte>& key) const;
+  // results are in order of keys, tree is walked once in key order, so every page is read at most once
+  vector<optional<vector<byte>>> multiGet(const vector<vector<byte>>& keys) const;
 
   BptreeIterator iterate() {
     return BptreeIterator(*this);
   }
 
-  friend class BptreeIterator;
+  BptreeCursor scan(const vector<byte>& lowerBound, optional<vector<byte>> upperBound = nullopt) const;
+
+  // order statistics, file has to be of counted layout (PageLayout::NativeCounted), they throw otherwise
+  // one root-to-leaf descent each: internal slots keep item counts of child subtrees
+  uint64_t count() const;
+  uint64_t rank(const vector<byte>& key) const; // number of keys less than key
+  uint64_t countRange(const vector<byte>& lo, const vector<byte>& hi) const; // keys lo <= key < hi
+  // cursor at index-th key (0-based), not valid if tree has fewer keys
+  // OFFSET n from lo is at(rank(lo) + n), uniformly random item is at(random % count())
+  BptreeCursor at(uint64_t index, optional<vector<byte>> upperBound = nullopt) const;
+
+  friend class BptreeCursor;
+  friend class BptreeBuilder;
  private:
   pageptr_t rootId;
+  PageLayout layout; // of the file, read from meta page
+  size_t pageSize; // of the file, read from meta page
 
-  bool isSplit;
+  bool isSplit{};
 
   Pager& pager;
 
-  void insertRecursive(pageptr_t pageId, const vector<byte>& key, const vector<byte>& value,
-    pageptr_t& newId, bool& isSplit, vector<byte>& splitKey, vector<byte>& oldRootKey, pageptr_t& splitId);
-  optional<vector<byte>> searchRecursive(pageptr_t pageId, const std::vector<byte>& key) const;
-  void deleteRecursive(pageptr_t pageId, const std::vector<byte>& key, pageptr_t& newId);
+  optional<vector<byte>> maxKey; // largest key of the tree, if it's known
+  vector<pageptr_t> rightmostPath; // ids from the root to the rightmost leaf, only appends keep it, the rest clear it
+  size_t appendRun = 0; // inserts in a row that went to the end of the tree
+
+  // page as its parent sees it
+  struct Child {
+    vector<byte> key;
+    pageptr_t id;
+    uint64_t count; // items in subtree, used only by counted layout
+  };
+
+  void requireCounts() const;
+
+  // added is set if key is new, newCount and splitCount are item counts of the two halves when page is split
+  // isLast is set if key is greater than every other key of subtree
+  template <typename Layout> void insertRecursive(pageptr_t pageId, const vector<byte>& key, const vector<byte>& value,
+    pageptr_t& newId, bool& isSplit, vector<byte>& splitKey, vector<byte>& oldRootKey, pageptr_t& splitId,
+    bool& added, uint64_t& newCount, uint64_t& splitCount, bool& isLast);
+  // returns false if tree can't take key this way, nothing is changed then
+  template <typename Layout> bool appendRightmost(const vector<byte>& key, const vector<byte>& value);
+  // returns every page subtree is stored in now
+  template <typename Layout> vector<Child> insertBatchRecursive(pageptr_t pageId,
+    const vector<pair<vector<byte>, vector<byte>>>& items, size_t first, size_t end);
+  template <typename Layout> vector<Child> writeInternal(const vector<Child>& entries, pageptr_t reuseId);
+  template <typename Layout> optional<vector<byte>> searchRecursive(pageptr_t pageId, const std::vector<byte>& key) const;
+  // order holds indexes of keys sorted by key, [first, end) of them belong to subtree
+  template <typename Layout> void multiGetRecursive(pageptr_t pageId, const vector<vector<byte>>& keys, const vector<size_t>& order,
+    size_t first, size_t end, vector<optional<vector<byte>>>& results) const;
+  template <typename Layout> void deleteRecursive(pageptr_t pageId, const std::vector<byte>& key, pageptr_t& newId, bool& removed);
+  // upper is exclusive bound of subtree keys (none for the rightmost one), newId is 0 if nothing is left of subtree
+  // removed is the number of items removed, exact only for counted layout
+  template <typename Layout> void removeRangeRecursive(pageptr_t pageId, unsafe_buf<byte> lo, unsafe_buf<byte> hi,
+    const optional<vector<byte>>& upper, pageptr_t& newId, uint64_t& removed);
+  template <typename Layout> void freeSubtree(pageptr_t pageId);
+  template <typename Layout> bool mergeChild(InternalPage<Layout>& internal, pagesize_t childIndex);
+
+  pageptr_t writeOverflow(const unsafe_buf<byte>& value); // returns first page of chain
+  vector<byte> readOverflow(pageptr_t pageId) const;
+  void freeOverflow(pageptr_t pageId);
+};
+
+// builds new tree bottom-up from items in ascending key order: every page is written once, when it's full,
+// nothing is read back, so n items take O(n) page writes instead of a root-to-leaf path per item
+// pages are filled up to fillFactor of page size (the last page of every level may be less full),
+// so that later inserts don't split them right away
+class BptreeBuilder {
+ public:
+  BptreeBuilder(Pager& pager, double fillFactor = 1.0);
+
+  // keys have to be strictly ascending
+  void add(const vector<byte>& key, const vector<byte>& value);
+  // writes pages left open, builder can't be used after that
+  Bptree finish();
+
+ private:
+  struct Level {
+    Page page; // open page, not written yet
+    vector<byte> firstKey{}; // key parent gets for the open page
+    size_t written = 0; // pages of level written so far
+    uint64_t count = 0; // items in subtree of the open page
+  };
+
+  Bptree tree;
+  size_t fillLimit; // bytes, page is closed once it uses at least that much
+  vector<Level> levels; // leaves first, the last one is the root
+  optional<vector<byte>> lastKey;
+
+  template <typename Layout> void addLeaf(const vector<byte>& key, const vector<byte>& value);
+  template <typename Layout> void addChild(size_t level, const vector<byte>& key, pageptr_t childId, uint64_t childCount);
+  template <typename Layout> void closePage(size_t level);
 };
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <stdexcept>
 
 #include "../bptree.hpp"
 #include "../../pager/pager.hpp"
@@ -11,12 +12,14 @@ using std::vector;
 using std::map;
 using std::cout;
 using std::endl;
+using std::runtime_error;
 
 // Mock Pager for Testing
 class MockPager : public Pager {
  public:
   map<pageptr_t, Page> pages;
   pageptr_t nextId = 1;
+  size_t reads = 0;
 
   pageptr_t addPage(const Page& page) override {
     pageptr_t id = nextId++;
@@ -25,12 +28,23 @@ class MockPager : public Pager {
   }
 
   Page getPage(pageptr_t id) override {
+    reads++;
     return pages.at(id);
   }
 
   void delPage(pageptr_t id) override {
     pages.erase(id);
   }
+
+  MetaPage meta;
+
+  void saveMetaPage(const MetaPage& metaPage) override {
+    meta = metaPage;
+  }
+
+  MetaPage getMetaPage() override {
+    return meta;
+  }
 };
 
 #define NUM_SMALL_INSERTS 100
@@ -76,16 +90,16 @@ void testInsertMultipleElements() {
   Bptree tree(pager, 1);
 
   for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
-    auto key = generateBytes(10, byte{i});
-    auto value = generateBytes(20, byte{i + 100});
+    auto key = generateBytes(10, static_cast<byte>(i));
+    auto value = generateBytes(20, static_cast<byte>(i + 100));
     tree.insert(key, value);
   }
 
   for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
-    auto key = generateBytes(10, byte{i});
+    auto key = generateBytes(10, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(20, byte{i + 100}));
+    assert(result.value() == generateBytes(20, static_cast<byte>(i + 100)));
   }
 }
 
@@ -95,16 +109,16 @@ void testTriggerLeafSplit() {
   Bptree tree(pager, 1);
 
   for (int i = 0; i < NUM_LARGE_INSERTS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
-    auto value = generateBytes(LARGE_VALUE_SIZE, byte{i + 100});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    auto value = generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i + 100));
     tree.insert(key, value);
   }
 
   for (int i = 0; i < NUM_LARGE_INSERTS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, byte{i + 100}));
+    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i + 100)));
   }
 
   assert(pager.pages.size() > 1);
@@ -116,16 +130,16 @@ void testTriggerInternalSplit() {
   Bptree tree(pager, 1);
 
   for (int i = 0; i < NUM_LARGE_INSERTS * 5; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE / 2, byte{i});
-    auto value = generateBytes(LARGE_VALUE_SIZE / 2, byte{i + 50});
+    auto key = generateBytes(LARGE_KEY_SIZE / 2, static_cast<byte>(i));
+    auto value = generateBytes(LARGE_VALUE_SIZE / 2, static_cast<byte>(i + 50));
     tree.insert(key, value);
   }
 
   for (int i = 0; i < NUM_LARGE_INSERTS * 5; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE / 2, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE / 2, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(LARGE_VALUE_SIZE / 2, byte{i + 50}));
+    assert(result.value() == generateBytes(LARGE_VALUE_SIZE / 2, static_cast<byte>(i + 50)));
   }
 
   assert(pager.pages.size() >= 10);
@@ -160,21 +174,21 @@ void testLeafMerge() {
   Bptree tree(pager, 1);
 
   for (int i = 0; i < NUM_LARGE_INSERTS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
-    auto value = generateBytes(LARGE_VALUE_SIZE, byte{i + 50});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    auto value = generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i + 50));
     tree.insert(key, value);
   }
 
   for (int i = NUM_LARGE_INSERTS / 2; i < NUM_LARGE_INSERTS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     tree.remove(key);
   }
 
   for (int i = 0; i < NUM_LARGE_INSERTS / 2; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, byte{i + 50}));
+    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i + 50)));
   }
 
   assert(pager.pages.size() <= NUM_LARGE_INSERTS);
@@ -187,28 +201,28 @@ void testStress() {
 
   const int NUM_KEYS = 256;
   for (int i = 0; i < NUM_KEYS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
-    auto value = generateBytes(LARGE_VALUE_SIZE, byte{i+59});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    auto value = generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i+59));
     tree.insert(key, value);
   }
 
   for (int i = 0; i < NUM_KEYS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, byte{i+59}));
+    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i+59)));
   }
 
   for (int i = NUM_KEYS / 2; i < NUM_KEYS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     tree.remove(key);
   }
 
   for (int i = 0; i < NUM_KEYS / 2; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
     auto result = tree.search(key);
     assert(result.has_value());
-    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, byte{i+59}));
+    assert(result.value() == generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i+59)));
   }
 }
 
@@ -219,8 +233,8 @@ void testBptreeIterator() {
 
   vector<pair<vector<byte>, vector<byte>>> keyValues;
   for (int i = 0; i < NUM_LARGE_INSERTS; ++i) {
-    auto key = generateBytes(LARGE_KEY_SIZE, byte{i});
-    auto value = generateBytes(LARGE_VALUE_SIZE, byte{i + 50});
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    auto value = generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i + 50));
     keyValues.emplace_back(key, value);
     tree.insert(key, value);
   }
@@ -238,6 +252,603 @@ void testBptreeIterator() {
   assert(index == keyValues.size());
 }
 
+void testBptreeCursor() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  for (int i = 0; i < NUM_LARGE_INSERTS; ++i) {
+    auto key = generateBytes(LARGE_KEY_SIZE / 8, static_cast<byte>(i));
+    tree.insert(key, generateBytes(LARGE_VALUE_SIZE / 8, static_cast<byte>(i + 50)));
+  }
+
+  // full scan fetches every page once
+  pager.reads = 0;
+  size_t count = 0;
+  BptreeCursor cursor(tree);
+  for (cursor.seekFirst(); cursor.valid(); cursor.next()) {
+    assert(cursor.key().toVector() == generateBytes(LARGE_KEY_SIZE / 8, static_cast<byte>((int) count)));
+    count++;
+  }
+  assert(count == NUM_LARGE_INSERTS);
+  assert(pager.reads == pager.pages.size());
+
+  // [100, 200), bounds don't have to be present in tree
+  auto lower = generateBytes(LARGE_KEY_SIZE / 8, byte{99});
+  lower.back() = byte{255};
+  auto upper = generateBytes(LARGE_KEY_SIZE / 8, byte{200});
+  count = 0;
+  for (BptreeCursor cursor = tree.scan(lower, upper); cursor.valid(); cursor.next()) {
+    assert(cursor.key().toVector() == generateBytes(LARGE_KEY_SIZE / 8, static_cast<byte>(100 + (int) count)));
+    assert(cursor.value().toVector() == generateBytes(LARGE_VALUE_SIZE / 8, static_cast<byte>(150 + (int) count)));
+    count++;
+  }
+  assert(count == 100);
+
+  BptreeCursor empty = tree.scan(upper, lower);
+  assert(!empty.valid());
+}
+
+void testOverflowValues() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    tree.insert(key, generateBytes(20000 + i, static_cast<byte>(i)));
+  }
+  // small keys with large values still fit in few leaves
+  size_t withOverflow = pager.pages.size();
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    auto result = tree.search(key);
+    assert(result.has_value());
+    assert(result.value() == generateBytes(20000 + i, static_cast<byte>(i)));
+  }
+
+  size_t count = 0;
+  BptreeCursor cursor(tree);
+  for (cursor.seekFirst(); cursor.valid(); cursor.next()) {
+    assert(cursor.value().size() == 20000 + count);
+    count++;
+  }
+  assert(count == NUM_SMALL_INSERTS);
+
+  // replacing with inline value frees the chain
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    tree.insert(key, generateBytes(10, static_cast<byte>(i)));
+  }
+  assert(pager.pages.size() < withOverflow / 2);
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    assert(tree.search(key).value() == generateBytes(10, static_cast<byte>(i)));
+  }
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    tree.insert(key, generateBytes(5000, static_cast<byte>(i)));
+  }
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(16, static_cast<byte>(i));
+    tree.remove(key);
+  }
+  assert(pager.pages.size() < 10);
+}
+
+vector<byte> prefixedKey(int tenant, int seq) {
+  vector<byte> key = generateBytes(32, byte{'t'});
+  key[0] = static_cast<byte>(tenant);
+  key.push_back(static_cast<byte>(seq / 256));
+  key.push_back(static_cast<byte>(seq % 256));
+  return key;
+}
+
+void testPrefixCompression() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  const int count = 1000;
+  for (int i = 0; i < count; ++i) {
+    tree.insert(prefixedKey(1, i), generateBytes(8, static_cast<byte>(i)));
+  }
+  // 32-byte shared prefix is stored once per page, so the whole tree is smaller than its keys
+  size_t treeSize = 0;
+  for (auto& [id, page]: pager.pages) {
+    treeSize += page.byteSize();
+  }
+  assert(treeSize < count * prefixedKey(1, 0).size());
+
+  // another tenant shrinks prefix of pages it lands in
+  for (int i = 0; i < 10; ++i) {
+    tree.insert(prefixedKey(2, i), generateBytes(8, static_cast<byte>(i)));
+  }
+
+  for (int i = 0; i < count; i += 2) {
+    tree.remove(prefixedKey(1, i));
+  }
+
+  for (int i = 0; i < count; ++i) {
+    auto result = tree.search(prefixedKey(1, i));
+    assert(result.has_value() == (i % 2 == 1));
+    if (result.has_value()) {
+      assert(result.value() == generateBytes(8, static_cast<byte>(i)));
+    }
+  }
+
+  int seen = 0;
+  BptreeCursor cursor = tree.scan(prefixedKey(1, 0), prefixedKey(2, 0));
+  for (; cursor.valid(); cursor.next()) {
+    assert(cursor.key().toVector() == prefixedKey(1, seen * 2 + 1));
+    seen++;
+  }
+  assert(seen == count / 2);
+}
+
+void testSeparatorTruncation() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  // descending, so every key is less than all keys already in tree
+  const int count = 2000;
+  for (int i = count - 1; i >= 0; --i) {
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    key[0] = static_cast<byte>(i / 256);
+    key[1] = static_cast<byte>(i % 256);
+    tree.insert(key, generateBytes(8, static_cast<byte>(i)));
+  }
+
+  // separators of long keys are cut to a few bytes, only the first key of page stays whole
+  // (whole 512-byte separators would take dozens of internal pages)
+  size_t internalCount = 0;
+  for (auto& [id, page]: pager.pages) {
+    if (page.getPageType() != PageType::Internal) {
+      continue;
+    }
+    internalCount++;
+    InternalPage internal(page);
+    for (pagesize_t i = 1; i < internal.countInternal(); i++) {
+      assert(internal.getKeyInternal(i).size() <= 3);
+    }
+  }
+  assert(internalCount <= 8);
+
+  for (int i = 0; i < count; ++i) {
+    auto key = generateBytes(LARGE_KEY_SIZE, static_cast<byte>(i));
+    key[0] = static_cast<byte>(i / 256);
+    key[1] = static_cast<byte>(i % 256);
+    auto result = tree.search(key);
+    assert(result.has_value());
+    assert(result.value() == generateBytes(8, static_cast<byte>(i)));
+  }
+
+  auto missing = generateBytes(LARGE_KEY_SIZE, byte{0});
+  missing[0] = byte{0};
+  missing[1] = byte{0};
+  missing[2] = byte{0};
+  assert(!tree.search(missing).has_value());
+  tree.remove(missing);
+}
+
+void testShortKeys() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  // every key of 1..6 bytes from {0, 1, 255}, many of them differ only in key head padding
+  vector<vector<byte>> keys;
+  vector<byte> alphabet = {byte{0}, byte{1}, byte{255}};
+  for (size_t len = 1; len <= 6; ++len) {
+    size_t total = 1;
+    for (size_t i = 0; i < len; ++i) {
+      total *= alphabet.size();
+    }
+    for (size_t n = 0; n < total; ++n) {
+      vector<byte> key;
+      for (size_t i = 0, rest = n; i < len; ++i, rest /= alphabet.size()) {
+        key.push_back(alphabet[rest % alphabet.size()]);
+      }
+      keys.push_back(key);
+      tree.insert(key, key);
+    }
+  }
+
+  for (auto& key: keys) {
+    auto result = tree.search(key);
+    assert(result.has_value());
+    assert(result.value() == key);
+  }
+
+  size_t count = 0;
+  vector<byte> prev;
+  BptreeCursor cursor(tree);
+  for (cursor.seekFirst(); cursor.valid(); cursor.next()) {
+    unsafe_buf<byte> key = cursor.key();
+    if (count > 0) {
+      unsafe_buf<byte> prevBuf = unsafe_buf<byte>::createFromVector(prev);
+      assert(unsafe_buf<byte>::compare(prevBuf, key) < 0);
+    }
+    prev = key.toVector();
+    count++;
+  }
+  assert(count == keys.size());
+}
+
+void testFragmentedPages() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  // values shrink in place and grow into new heap space, so pages get holes and are compacted
+  map<vector<byte>, vector<byte>> expected;
+  for (int round = 0; round < 6; ++round) {
+    for (int i = 0; i < 400; ++i) {
+      auto key = prefixedKey(1, i);
+      size_t valueSize = ((i * 7 + round * 13) % 10) * 40;
+      auto value = generateBytes(valueSize, static_cast<byte>(round));
+      tree.insert(key, value);
+      expected[key] = value;
+    }
+    for (int i = round; i < 400; i += 5) {
+      tree.remove(prefixedKey(1, i));
+      expected.erase(prefixedKey(1, i));
+    }
+  }
+  // key without the shared prefix makes every key of its page longer
+  tree.insert(prefixedKey(0, 0), generateBytes(300));
+  expected[prefixedKey(0, 0)] = generateBytes(300);
+
+  for (auto& [id, page]: pager.pages) {
+    assert(page.byteSize() <= DEFAULT_PAGE_SIZE);
+  }
+  for (auto& [key, value]: expected) {
+    auto result = tree.search(key);
+    assert(result.has_value());
+    assert(result.value() == value);
+  }
+  size_t count = 0;
+  BptreeCursor cursor(tree);
+  for (cursor.seekFirst(); cursor.valid(); cursor.next()) {
+    count++;
+  }
+  assert(count == expected.size());
+}
+
+void testFrameReuse() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+
+  for (int i = 0; i < 1000; ++i) {
+    tree.insert(prefixedKey(1, i), generateBytes(40, static_cast<byte>(i)));
+  }
+
+  // tree doesn't grow anymore, so copies of pages live on frames of replaced ones
+  size_t allocated = FramePool<DEFAULT_PAGE_SIZE>::allocatedFrames();
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 1000; ++i) {
+      tree.insert(prefixedKey(1, i), generateBytes(40, static_cast<byte>(round)));
+    }
+  }
+  assert(FramePool<DEFAULT_PAGE_SIZE>::allocatedFrames() == allocated);
+}
+
+void testBulkLoad() {
+  map<vector<byte>, vector<byte>> expected;
+  for (int tenant = 0; tenant < 4; ++tenant) {
+    for (int i = 0; i < 1000; ++i) {
+      expected[prefixedKey(tenant, i)] = generateBytes(i % 250 == 0 ? 10000 : 40, static_cast<byte>(i)); // some go to overflow pages
+    }
+  }
+
+  size_t fullPages = 0;
+  for (double fillFactor: {1.0, 0.6}) {
+    MockPager pager;
+    BptreeBuilder builder(pager, fillFactor);
+    for (auto& [key, value]: expected) {
+      builder.add(key, value);
+    }
+    Bptree tree = builder.finish();
+
+    // every page is written once
+    assert(pager.nextId - 1 == pager.pages.size());
+    assert(pager.reads == 0);
+    if (fillFactor == 1.0) {
+      fullPages = pager.pages.size();
+    }
+    else {
+      assert(pager.pages.size() > fullPages);
+    }
+
+    auto it = expected.begin();
+    for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == expected.end());
+
+    for (auto& [key, value]: expected) {
+      assert(tree.search(key) == value);
+    }
+    assert(!tree.search(prefixedKey(5, 0)).has_value());
+
+    // built tree takes changes as usual
+    tree.insert(prefixedKey(0, 1000), generateBytes(40));
+    tree.remove(prefixedKey(1, 10));
+    assert(tree.search(prefixedKey(0, 1000)) == generateBytes(40));
+    assert(!tree.search(prefixedKey(1, 10)).has_value());
+  }
+
+  MockPager pager;
+  BptreeBuilder empty(pager);
+  Bptree tree = empty.finish();
+  assert(!tree.iterate().hasNext());
+  tree.insert(prefixedKey(0, 0), generateBytes(10));
+  assert(tree.search(prefixedKey(0, 0)).has_value());
+
+  BptreeBuilder unordered(pager);
+  unordered.add(prefixedKey(0, 2), generateBytes(10));
+  bool thrown = false;
+  try {
+    unordered.add(prefixedKey(0, 1), generateBytes(10));
+  }
+  catch (runtime_error&) {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+void testInsertBatch() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+  map<vector<byte>, vector<byte>> expected;
+
+  for (int round = 0; round < 6; ++round) {
+    vector<pair<vector<byte>, vector<byte>>> batch;
+    for (int i = 0; i < 2000; ++i) {
+      int seq = (i * 7919 + round * 131) % 3000; // unsorted, repeated within batch and across rounds
+      auto value = generateBytes(seq % 300 == 0 ? 6000 : 30 + round, static_cast<byte>(i));
+      batch.emplace_back(prefixedKey(seq % 5, seq), value);
+      expected[prefixedKey(seq % 5, seq)] = value;
+    }
+
+    pageptr_t firstWrite = pager.nextId;
+    tree.insertBatch(batch);
+    // no page is written twice: everything written by the batch is still in the tree
+    for (pageptr_t id = firstWrite; id < pager.nextId; ++id) {
+      assert(pager.pages.count(id) == 1);
+    }
+
+    auto it = expected.begin();
+    for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == expected.end());
+  }
+
+  // keys less than every key of the tree and a batch of one
+  tree.insertBatch({{generateBytes(4), generateBytes(10)}, {generateBytes(3), generateBytes(11)}});
+  tree.insertBatch({{prefixedKey(9, 0), generateBytes(12)}});
+  assert(tree.search(generateBytes(4)) == generateBytes(10));
+  assert(tree.search(generateBytes(3)) == generateBytes(11));
+  assert(tree.search(prefixedKey(9, 0)) == generateBytes(12));
+
+  for (auto& [key, value]: expected) {
+    tree.remove(key);
+  }
+  tree.remove(generateBytes(4));
+  tree.remove(generateBytes(3));
+  tree.remove(prefixedKey(9, 0));
+  assert(!tree.iterate().hasNext());
+  assert(pager.pages.size() < 10); // overflow chains of replaced values are freed
+}
+
+void testMultiGet() {
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+  for (int i = 0; i < 3000; i += 2) {
+    tree.insert(prefixedKey(i % 3, i), generateBytes(i % 500 == 0 ? 6000 : 40, static_cast<byte>(i)));
+  }
+
+  vector<vector<byte>> keys;
+  for (int i = 0; i < 3000; i += 3) {
+    keys.push_back(prefixedKey(i % 3, (i * 7) % 3000)); // unsorted, half of them are missing
+  }
+  keys.push_back(keys[5]);
+  keys.push_back(generateBytes(2)); // less than every key
+
+  pager.reads = 0;
+  vector<optional<vector<byte>>> results = tree.multiGet(keys);
+  assert(pager.reads <= pager.pages.size());
+
+  assert(results.size() == keys.size());
+  size_t found = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(results[i] == tree.search(keys[i]));
+    found += results[i].has_value();
+  }
+  assert(found > keys.size() / 4);
+  assert(tree.multiGet({}).empty());
+}
+
+void testRemoveRange() {
+  for (int tenant = 0; tenant < 3; ++tenant) {
+    MockPager pager;
+    initBptree(pager);
+    Bptree tree(pager, 1);
+    map<vector<byte>, vector<byte>> expected;
+    for (int t = 0; t < 3; ++t) {
+      for (int i = 0; i < 1500; ++i) {
+        auto value = generateBytes(i % 100 == 0 ? 6000 : 40, static_cast<byte>(i)); // some go to overflow pages
+        tree.insert(prefixedKey(t, i), value);
+        expected[prefixedKey(t, i)] = value;
+      }
+    }
+    size_t fullSize = pager.pages.size();
+
+    // the whole tenant is purged, neighbours are left untouched
+    pager.reads = 0;
+    tree.removeRange(prefixedKey(tenant, 0), prefixedKey(tenant + 1, 0));
+    for (int i = 0; i < 1500; ++i) {
+      expected.erase(prefixedKey(tenant, i));
+    }
+    assert(pager.reads < fullSize / 2);
+    assert(pager.pages.size() < fullSize * 3 / 4);
+
+    // range inside one leaf, bounds that are not keys, empty range
+    tree.removeRange(prefixedKey((tenant + 1) % 3, 10), prefixedKey((tenant + 1) % 3, 13));
+    vector<byte> between = prefixedKey((tenant + 2) % 3, 700);
+    between.push_back(byte{0}); // proper prefix is greater than the key, so 700 is removed too
+    tree.removeRange(between, prefixedKey((tenant + 2) % 3, 900));
+    tree.removeRange(prefixedKey(0, 5), prefixedKey(0, 5));
+    for (int i = 10; i < 13; ++i) {
+      expected.erase(prefixedKey((tenant + 1) % 3, i));
+    }
+    for (int i = 700; i < 900; ++i) {
+      expected.erase(prefixedKey((tenant + 2) % 3, i));
+    }
+
+    auto it = expected.begin();
+    for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == expected.end());
+
+    // tree takes changes as usual, and everything can be removed at once
+    tree.insert(prefixedKey(tenant, 5), generateBytes(10));
+    assert(tree.search(prefixedKey(tenant, 5)) == generateBytes(10));
+    tree.remove(prefixedKey(tenant, 5));
+    tree.removeRange(vector<byte>(2, byte{0}), prefixedKey(9, 0));
+    assert(!tree.iterate().hasNext());
+    assert(pager.pages.size() == 1);
+  }
+}
+
+void testAppend() {
+  const int count = 6000;
+  MockPager built;
+  BptreeBuilder builder(built);
+  for (int i = 0; i < count; ++i) {
+    builder.add(prefixedKey(1, i), generateBytes(40, static_cast<byte>(i)));
+  }
+  builder.finish();
+
+  // full rightmost page is not split in halves, so ascending inserts pack pages about as tight as bulk load
+  MockPager pager;
+  initBptree(pager);
+  Bptree tree(pager, 1);
+  for (int i = 0; i < count; ++i) {
+    tree.insert(prefixedKey(1, i), generateBytes(40, static_cast<byte>(i)));
+  }
+  assert(pager.pages.size() <= built.pages.size() + built.pages.size() / 20 + 2);
+
+  // keys above the largest one that are not a run of appends split full leaves in halves as usual,
+  // so no leaf is left as full as the ones ascending inserts pack
+  auto fullestLeaf = [](MockPager& pager) {
+    pagesize_t most = 0;
+    for (auto& [id, page]: pager.pages) {
+      if (page.getPageType() == PageType::Leaf && LeafPage(page).countLeaf() > most) {
+        most = LeafPage(page).countLeaf();
+      }
+    }
+    return most;
+  };
+  MockPager zigzagPager;
+  initBptree(zigzagPager);
+  Bptree zigzag(zigzagPager, 1);
+  for (int i = 0; i < 2000; ++i) {
+    zigzag.insert(prefixedKey(1, 3000 + i), generateBytes(40, static_cast<byte>(i)));
+    zigzag.insert(prefixedKey(1, 2999 - i), generateBytes(40, static_cast<byte>(i))); // new smallest key ends the run
+  }
+  assert(fullestLeaf(zigzagPager) < fullestLeaf(pager));
+
+  // pages owned by the writer are updated in place, then append reads only the rightmost leaf
+  struct InPlacePager: MockPager {
+    pageptr_t updatePage(pageptr_t id, const Page& page) override {
+      pages[id] = page;
+      return id;
+    }
+  } inPlace;
+  initBptree(inPlace);
+  Bptree appended(inPlace, 1);
+  appended.insert(prefixedKey(1, 0), generateBytes(40));
+  inPlace.reads = 0;
+  for (int i = 1; i < count; ++i) {
+    appended.insert(prefixedKey(1, i), generateBytes(40, static_cast<byte>(i)));
+  }
+  assert(inPlace.reads < count + count / 10);
+
+  // item that fits no page leaves nothing behind, not even overflow pages of its value
+  size_t pageCount = inPlace.pages.size();
+  bool thrown = false;
+  try {
+    vector<byte> tooBig = prefixedKey(1, count);
+    tooBig.resize(2 * DEFAULT_PAGE_SIZE, byte{1});
+    appended.insert(tooBig, generateBytes(10000));
+  }
+  catch (runtime_error&) {
+    thrown = true;
+  }
+  assert(thrown);
+  assert(inPlace.pages.size() == pageCount);
+
+  // other changes forget the rightmost path, appends go on after them
+  map<vector<byte>, vector<byte>> expected;
+  for (int i = 0; i < count; ++i) {
+    expected[prefixedKey(1, i)] = generateBytes(40, static_cast<byte>(i));
+  }
+  int next = count;
+  auto append = [&](int n) {
+    for (int i = 0; i < n; ++i, ++next) {
+      auto value = generateBytes(next % 500 == 0 ? 5000 : 40, static_cast<byte>(next)); // some go to overflow pages
+      appended.insert(prefixedKey(1, next), value);
+      expected[prefixedKey(1, next)] = value;
+    }
+  };
+  appended.insert(prefixedKey(0, 7), generateBytes(10));
+  expected[prefixedKey(0, 7)] = generateBytes(10);
+  append(300);
+  appended.remove(prefixedKey(1, next - 1));
+  expected.erase(prefixedKey(1, next - 1));
+  append(300);
+  vector<pair<vector<byte>, vector<byte>>> batch;
+  for (int i = 0; i < 200; ++i, ++next) {
+    batch.push_back({prefixedKey(1, next), generateBytes(20)});
+    expected[prefixedKey(1, next)] = generateBytes(20);
+  }
+  appended.insertBatch(batch);
+  append(300);
+  appended.removeRange(prefixedKey(1, next - 1000), prefixedKey(2, 0));
+  for (int i = next - 1000; i < next; ++i) {
+    expected.erase(prefixedKey(1, i));
+  }
+  append(1000);
+  appended.insert(prefixedKey(1, next - 1), generateBytes(30)); // existing max key is replaced, not appended
+  expected[prefixedKey(1, next - 1)] = generateBytes(30);
+  append(10);
+
+  auto it = expected.begin();
+  for (BptreeIterator items = appended.iterate(); items.hasNext(); ++it) {
+    auto [key, value] = items.next();
+    assert(key == it->first);
+    assert(value == it->second);
+  }
+  assert(it == expected.end());
+  for (auto& [key, value]: expected) {
+    assert(appended.search(key) == value);
+  }
+}
 
 int main() {
   RUN_TEST(testInsertSingleElement);
@@ -249,6 +860,18 @@ int main() {
   RUN_TEST(testLeafMerge);
   RUN_TEST(testStress);
   RUN_TEST(testBptreeIterator);
+  RUN_TEST(testBptreeCursor);
+  RUN_TEST(testOverflowValues);
+  RUN_TEST(testPrefixCompression);
+  RUN_TEST(testSeparatorTruncation);
+  RUN_TEST(testShortKeys);
+  RUN_TEST(testFragmentedPages);
+  RUN_TEST(testFrameReuse);
+  RUN_TEST(testBulkLoad);
+  RUN_TEST(testInsertBatch);
+  RUN_TEST(testMultiGet);
+  RUN_TEST(testRemoveRange);
+  RUN_TEST(testAppend);
 
   cout << "All tests passed" << endl;
   return 0;
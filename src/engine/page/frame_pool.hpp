@@ -0,0 +1,117 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <cstddef>
+
+using std::mutex;
+using std::atomic;
+using std::vector;
+using std::byte;
+using std::min;
+
+#define FRAME_CACHE_SIZE (64) // frames kept by one thread, half of them go to shared list on overflow
+#define FRAME_POOL_SIZE (4096) // frames kept in shared list, the rest is returned to the heap
+
+/*
+Pool of page frames: buffers of dropped pages are handed to new ones instead of going through malloc.
+Every thread has its own cache, so taking and returning a frame doesn't lock anything,
+caches exchange frames with the shared list in batches.
+*/
+template <size_t FrameSize> class FramePool {
+ private:
+  struct Shared {
+    mutex lock; // lock protects frames
+    vector<byte*> frames;
+
+    ~Shared() {
+      for (byte* frame: frames) {
+        ::operator delete(frame);
+      }
+    }
+  };
+
+  struct Cache {
+    vector<byte*> frames;
+
+    ~Cache() {
+      spill(*this, 0);
+      cacheDestroyed = true;
+    }
+  };
+
+  static inline atomic<size_t> heapAllocations{};
+  static inline thread_local bool cacheDestroyed{}; // frames freed after thread exit go straight to the heap
+
+  static Shared& shared() {
+    static Shared shared;
+    return shared;
+  }
+
+  static Cache& cache() {
+    thread_local Cache cache;
+    return cache;
+  }
+
+  static void refill(Cache& cache) {
+    Shared& pool = shared();
+    pool.lock.lock();
+    size_t count = min(pool.frames.size(), (size_t) FRAME_CACHE_SIZE / 2);
+    cache.frames.insert(cache.frames.end(), pool.frames.end() - count, pool.frames.end());
+    pool.frames.resize(pool.frames.size() - count);
+    pool.lock.unlock();
+  }
+
+  // leaves at most keep frames in cache
+  static void spill(Cache& cache, size_t keep) {
+    Shared& pool = shared();
+    pool.lock.lock();
+    while (cache.frames.size() > keep) {
+      byte* frame = cache.frames.back();
+      cache.frames.pop_back();
+      if (pool.frames.size() < FRAME_POOL_SIZE) {
+        pool.frames.push_back(frame);
+      }
+      else {
+        ::operator delete(frame);
+      }
+    }
+    pool.lock.unlock();
+  }
+ public:
+  static byte* acquire() {
+    if (!cacheDestroyed) {
+      Cache& local = cache();
+      if (local.frames.empty()) {
+        refill(local);
+      }
+      if (!local.frames.empty()) {
+        byte* frame = local.frames.back();
+        local.frames.pop_back();
+        return frame;
+      }
+    }
+
+    heapAllocations++;
+    return static_cast<byte*>(::operator new(FrameSize));
+  }
+
+  static void release(byte* frame) {
+    if (cacheDestroyed) {
+      ::operator delete(frame);
+      return;
+    }
+
+    Cache& local = cache();
+    local.frames.push_back(frame);
+    if (local.frames.size() > FRAME_CACHE_SIZE) {
+      spill(local, FRAME_CACHE_SIZE / 2);
+    }
+  }
+
+  // frames taken from the heap so far, grows only when pool runs dry
+  static size_t allocatedFrames() { return heapAllocations.load(); }
+};
@@ -47,3 +47,91 @@ inline void MetaPage::setFreeListTail(pageptr_t ptr) {
   MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
   header->freeListTail = ptr;
 }
+
+pagesize_t MetaPage::getByteSize() {
+  if (!hasFreeMap()) {
+    return sizeof(MetaPageData);
+  }
+  return sizeof(MetaPageData) + sizeof(FreeMapDirHeader) + getFreeMapCount() * sizeof(FreeMapDirSlot);
+}
+
+uint8_t MetaPage::getVersion() {
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  return header->version.value() & 0xff;
+}
+
+bool MetaPage::hasFreeMap() {
+  return getVersion() % 2 == 0;
+}
+
+bool MetaPage::isSupported() {
+  return getVersion() >= 1 && getVersion() <= META_VERSION && getLayout() <= PageLayout::NativeCounted && isPageSize(getPageSize());
+}
+
+void MetaPage::setFreeMap(bool freeMap) {
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  uint8_t version = (freeMap ? 2 : 1) + (getLayout() == PageLayout::NativeCounted ? 2 : 0);
+  header->version = (header->version.value() & 0xff00) | version;
+  this->data.resize(getByteSize());
+}
+
+PageLayout MetaPage::getLayout() {
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  return static_cast<PageLayout>((header->version.value() >> 8) & 0xf);
+}
+
+void MetaPage::setLayout(PageLayout layout) {
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  header->version = (header->version.value() & 0xf0ff) | (to_underlying(layout) << 8);
+  setFreeMap(hasFreeMap());
+}
+
+size_t MetaPage::getPageSize() {
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  return (size_t) MIN_PAGE_SIZE << (header->version.value() >> 12);
+}
+
+void MetaPage::setPageSize(size_t pageSize) {
+  assert(isPageSize(pageSize));
+  assert(this->byteSize() >= sizeof(MetaPageData));
+  MetaPageData* header = reinterpret_cast<MetaPageData*>(this->data.data() + 0);
+  uint16_t shift = countr_zero(pageSize / MIN_PAGE_SIZE);
+  header->version = (header->version.value() & 0x0fff) | (shift << 12);
+}
+
+size_t MetaPage::getFreeMapCount() {
+  if (this->byteSize() < sizeof(MetaPageData) + sizeof(FreeMapDirHeader)) { // version 1
+    return 0;
+  }
+  FreeMapDirHeader* dir = reinterpret_cast<FreeMapDirHeader*>(this->data.data() + sizeof(MetaPageData));
+  return dir->count.value();
+}
+
+pageptr_t MetaPage::getFreeMapPage(size_t index) {
+  assert(index < getFreeMapCount());
+  FreeMapDirSlot* slot = reinterpret_cast<FreeMapDirSlot*>(this->data.data() + sizeof(MetaPageData) + sizeof(FreeMapDirHeader) + index * sizeof(FreeMapDirSlot));
+  return slot->ptr.value();
+}
+
+void MetaPage::addFreeMapPage(pageptr_t ptr) {
+  assert(hasFreeMap());
+  size_t count = getFreeMapCount();
+  assert(count < MAX_FREEMAP_COUNT(getPageSize()));
+
+  FreeMapDirSlot newSlot;
+  newSlot.ptr = ptr;
+  this->data.insert(this->data.end(), reinterpret_cast<byte*>(&newSlot), reinterpret_cast<byte*>(&newSlot) + sizeof(FreeMapDirSlot));
+  FreeMapDirHeader* dir = reinterpret_cast<FreeMapDirHeader*>(this->data.data() + sizeof(MetaPageData));
+  dir->count = count + 1;
+}
+
+void MetaPage::clearFreeMap() {
+  this->data.resize(sizeof(MetaPageData) + sizeof(FreeMapDirHeader));
+  FreeMapDirHeader* dir = reinterpret_cast<FreeMapDirHeader*>(this->data.data() + sizeof(MetaPageData));
+  dir->count = 0;
+}
@@ -4,17 +4,62 @@
 
 #include <vector>
 #include <cstddef>
+#include <utility>
+#include <bit>
 #include <stdint.h>
 
 #include <boost/endian/buffers.hpp>
 
 #include "../common.hpp"
+#include "./page.hpp"
 
 using std::vector;
 using std::byte;
+using std::to_underlying;
+using std::countr_zero;
 
 using namespace boost::endian;
 
+/*
+Meta page format:
+
+Uses big-endian
+
++-----------+---------+---------+---------------+---------------+---------------+
+| Signature | Version | Cursize | MetaTableRoot | FreeListHead  | FreeListTail  |
++-----------+---------+---------+---------------+---------------+---------------+
+| 2 bytes   | 2 bytes | 6 bytes | 6 bytes       | 6 bytes       | 6 bytes       |
++-----------+---------+---------+---------------+---------------+---------------+
+
+Version:
++-----------------+--------+-------------------+
+| Page size shift | Layout | Free space format |
++-----------------+--------+-------------------+
+| 4 bits          | 4 bits | 8 bits            |
++-----------------+--------+-------------------+
+Page size is 4K << shift, layout of leaf and internal nodes is PageLayout (0 is big-endian, 1 is native,
+2 is native with subtree item counts in internal slots). Files written before both of them have 0 there:
+4K pages, big-endian layout.
+Meta page takes the whole first page of the file.
+
+Files of version or layout above the known ones are refused on open (see MetaPage::isSupported()).
+
+Version 1 keeps free pages in a chain of Deleted pages (FreeListHead/FreeListTail).
+
+Version 2 keeps them in free map pages (see page.hpp), free list fields are 0 and followed by directory:
++---------------+-------------------------------+
+| FreeMap count | FreeMap ptr (x FreeMap count) |
++---------------+-------------------------------+
+| 2 bytes       | 6 bytes (x FreeMap count)     |
++---------------+-------------------------------+
+
+Versions 3 and 4 are versions 1 and 2 of counted layout, so a build that checks version but doesn't know
+counted layout refuses such file instead of reading counted nodes as plain ones.
+*/
+
+#define META_VERSION (4)
+#define MAX_FREEMAP_COUNT(pageSize) (((pageSize) - sizeof(MetaPageData) - sizeof(FreeMapDirHeader)) / sizeof(FreeMapDirSlot))
+
 namespace {
   struct MetaPageData {
     uint8_t sig[2];
@@ -24,31 +69,47 @@ namespace {
     big_uint48_buf_t freeListHead;
     big_uint48_buf_t freeListTail;
   };
+
+  struct FreeMapDirHeader {
+    big_uint16_buf_t count;
+  };
+
+  struct FreeMapDirSlot {
+    big_uint48_buf_t ptr;
+  };
 };
 
 class MetaPage {
  private: 
   vector<byte> data;
-  pagesize_t getByteSize() { return sizeof(MetaPageData); }
+  pagesize_t getByteSize();
   
   void setFreeListHead(pageptr_t ptr);
   void setFreeListTail(pageptr_t ptr);
   void setCursize(pageptr_t ptr);
+
+  void setFreeMap(bool freeMap); // version 2 or 1, 4 or 3 for counted layout
+  void setLayout(PageLayout layout); // keeps free space format
+  void setPageSize(size_t pageSize);
+  void addFreeMapPage(pageptr_t ptr);
+  void clearFreeMap();
  public:
   friend class TransactionalPager;
+  friend class BufferPoolPager;
 
   MetaPage() {
     this->data = vector<byte>();
     auto metaData = MetaPageData {
       sig: {'d', 'b'},
     };
-    metaData.version = 1;
+    metaData.version = (to_underlying(PageLayout::Native) << 8) | 2;
     metaData.curSize = 0;
     metaData.metaTableRoot = 0;
     metaData.freeListHead = 0;
     metaData.freeListTail = 0;
 
     this->data.insert(this->data.end(), reinterpret_cast<byte*>(&metaData), reinterpret_cast<byte*>(&metaData) + sizeof(MetaPageData));
+    this->data.resize(sizeof(MetaPageData) + sizeof(FreeMapDirHeader)); // empty directory
   }
 
   MetaPage(vector<byte>& data) {
@@ -67,5 +128,13 @@ class MetaPage {
   pageptr_t getFreeListHead();
   pageptr_t getFreeListTail();
 
+  uint8_t getVersion();
+  bool hasFreeMap();
+  bool isSupported(); // version, layout and page size are known to this build
+  PageLayout getLayout();
+  size_t getPageSize();
+  size_t getFreeMapCount();
+  pageptr_t getFreeMapPage(size_t index); // free map node covering pages from index * FREEMAP_BITS
+
   void setMetaTableRoot(pageptr_t ptr);
 };
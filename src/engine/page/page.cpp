@@ -2,69 +2,180 @@
 #include <cassert>
 #include <utility>
 #include <cmath>
+#include <algorithm>
+#include <bit>
 
 #include "page.hpp"
 
 using std::to_underlying;
+using std::copy;
+using std::to_integer;
+using std::countl_zero;
 
-#define assertPageType(pageType) assert(pageType == PageType::Internal || pageType == PageType::Leaf || pageType == PageType::Overflow || pageType == PageType::Deleted)
+#define assertPageType(pageType) assert(pageType == PageType::Internal || pageType == PageType::Leaf || pageType == PageType::Overflow || pageType == PageType::Deleted || pageType == PageType::FreeMap)
 
 #define PAGE_TYPE_BIT_DIST 12
 
-#define offsetZeroInternal(itemCount) (sizeof(InternalHeader) + itemCount * sizeof(InternalSlot))
-#define offsetToAddrInternal(itemCount, offset) (offsetZeroInternal(itemCount) + offset)
+#define slotsEndInternal(itemCount) (sizeof(InternalHeader) + (itemCount) * sizeof(InternalSlot))
+#define slotsEndLeaf(itemCount) (sizeof(LeafHeader) + (itemCount) * sizeof(LeafSlot))
 
-#define offsetZeroLeaf(itemCount) (sizeof(LeafHeader) + itemCount * sizeof(LeafSlot))
-#define offsetToAddrLeaf(itemCount, offset) (offsetZeroLeaf(itemCount) + offset)
+static inline bool hasPrefix(const unsafe_buf<byte>& key, const unsafe_buf<byte>& prefix) {
+  return key.len >= prefix.len && (prefix.len == 0 || memcmp(key.ptr, prefix.ptr, prefix.len) == 0);
+}
+
+static inline size_t commonPrefixSize(const unsafe_buf<byte>& first, const unsafe_buf<byte>& second) {
+  size_t size = 0;
+  while (size < first.len && size < second.len && first.ptr[size] == second.ptr[size]) {
+    size++;
+  }
+  return size;
+}
 
-Page::Page() {
-  this->data = vector<byte>();
+static inline unsafe_buf<byte> stripPrefix(const unsafe_buf<byte>& key, const unsafe_buf<byte>& prefix) {
+  assert(hasPrefix(key, prefix));
+  unsafe_buf<byte> suffix = {
+    ptr: key.ptr + prefix.len,
+    len: key.len - prefix.len,
+  };
+  return suffix;
+}
+
+// big-endian number of the first KEY_HEAD_SIZE bytes, so heads compare like keys
+static inline uint32_t keyHead(const unsafe_buf<byte>& key) {
+  uint32_t head = 0;
+  for (size_t i = 0; i < KEY_HEAD_SIZE; i++) {
+    head = (head << 8) | (i < key.len ? to_integer<uint32_t>(key.ptr[i]) : 0);
+  }
+  return head;
 }
 
+// 0 means heads don't decide and keys have to be compared
+// (padding is not a real byte: shorter key is greater than its extension)
+static inline int compareHeads(uint32_t first, size_t firstLen, uint32_t second, size_t secondLen) {
+  if (first == second) {
+    return 0;
+  }
+  size_t diffByte = countl_zero(first ^ second) / 8;
+  if (diffByte >= min(firstLen, secondLen)) {
+    return 0;
+  }
+  return first < second ? -1 : 1;
+}
+
+template <typename Slot> static inline pagesize_t itemSizeLeaf(const Slot* slot) {
+  pagesize_t ptrSize = (slot->flags.value() & VOVERFLOW_FLAG) ? sizeof(OverflowPtr) : 0;
+  return slot->ksize.value() + ptrSize + slot->vsize.value();
+}
+
+Page::Page() {}
+
 Page::Page(vector<byte>& data) {
-  this->data = data;
+  this->data.assign(data.begin(), data.end());
 }
 
 Page::Page(unsafe_buf<byte>& data) {
-  this->data = vector<byte>();
-  this->data.insert(this->data.end(), data.ptr, data.ptr + data.len);
+  this->data.assign(data.ptr, data.ptr + data.len);
 }
 
-Page Page::createInternal() {
+Page Page::createView(const unsafe_buf<byte>& buf) {
   auto page = Page();
-  page.data.resize(sizeof(InternalHeader));
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(page.data.data() + 0);
-  page.setPageType(PageType::Internal);
+  page.viewPtr = buf.ptr;
+  page.viewLen = buf.len;
+
+  return page;
+}
+
+inline const byte* Page::bytes() const {
+  if (this->viewPtr != nullptr) {
+    return this->viewPtr;
+  }
+  return this->data.data();
+}
+
+inline size_t Page::frameSize() const {
+  if (this->viewPtr != nullptr) {
+    return this->viewLen;
+  }
+  return this->data.size();
+}
+
+void Page::materialize() {
+  if (this->viewPtr == nullptr) {
+    return;
+  }
+
+  this->data.assign(this->viewPtr, this->viewPtr + this->viewLen);
+  this->viewPtr = nullptr;
+  this->viewLen = 0;
+}
+
+template <typename Header> static inline void initNodeHeader(Header* header, size_t pageSize) {
   header->itemCount = 0;
+  header->prefixSize = 0;
+  header->heapStart = pageSize;
+}
+
+Page Page::createInternal(PageLayout layout, size_t pageSize) {
+  auto page = Page();
+  page.data.assign(pageSize, byte{0});
+  page.setPageType(PageType::Internal);
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    initNodeHeader(reinterpret_cast<typename Layout::InternalHeader*>(page.data.data() + 0), pageSize);
+    page.setByteSize(sizeof(typename Layout::InternalHeader));
+  });
 
   return page;
 }
 
-Page Page::createLeaf() {
+Page Page::createLeaf(PageLayout layout, size_t pageSize) {
   auto page = Page();
-  page.data.resize(sizeof(LeafHeader));
-  LeafHeader* header = reinterpret_cast<LeafHeader*>(page.data.data() + 0);
+  page.data.assign(pageSize, byte{0});
   page.setPageType(PageType::Leaf);
-  header->itemCount = 0;
+  withLayout(layout, pageSize, [&]<typename Layout>(Layout) {
+    initNodeHeader(reinterpret_cast<typename Layout::LeafHeader*>(page.data.data() + 0), pageSize);
+    page.setByteSize(sizeof(typename Layout::LeafHeader));
+  });
 
   return page;
 }
 
-Page Page::createDeleted() {
+Page Page::createDeleted(size_t pageSize) {
   auto page = Page();
-  page.data.resize(sizeof(DeletedHeader));
+  page.data.assign(pageSize, byte{0});
   DeletedHeader* header = reinterpret_cast<DeletedHeader*>(page.data.data() + 0);
   page.setPageType(PageType::Deleted);
+  page.setByteSize(sizeof(DeletedHeader));
   header->next = 0;
   header->count = 0;
 
   return page;
 }
 
+Page Page::createOverflow(size_t pageSize) {
+  auto page = Page();
+  page.data.assign(pageSize, byte{0});
+  OverflowHeader* header = reinterpret_cast<OverflowHeader*>(page.data.data() + 0);
+  page.setPageType(PageType::Overflow);
+  page.setByteSize(sizeof(OverflowHeader));
+  header->next = 0;
+  header->totalSize = 0;
+
+  return page;
+}
+
+Page Page::createFreeMap(size_t pageSize) {
+  auto page = Page();
+  page.data.assign(pageSize, byte{0});
+  page.setPageType(PageType::FreeMap);
+  page.setByteSize(pageSize);
+
+  return page;
+}
+
 inline PageType Page::getPageType() {
-  assert(this->byteSize() >= sizeof(Header));
+  assert(this->frameSize() >= sizeof(Header));
 
-  Header* header = reinterpret_cast<Header*>(this->data.data() + 0);
+  const Header* header = reinterpret_cast<const Header*>(this->bytes() + 0);
 
   uint16_t flags = header->flags.value();
   PageType pageType = PageType(flags >> PAGE_TYPE_BIT_DIST);
@@ -75,8 +186,9 @@ inline PageType Page::getPageType() {
 }
 
 inline void Page::setPageType(PageType type) {
+  this->materialize();
   assertPageType(type);
-  assert(this->byteSize() >= sizeof(Header));
+  assert(this->frameSize() >= sizeof(Header));
 
   uint16_t flags = to_underlying<PageType>(type);
   flags = flags << PAGE_TYPE_BIT_DIST;
@@ -85,51 +197,55 @@ inline void Page::setPageType(PageType type) {
   header->flags = flags;
 }
 
-inline pagesize_t Page::getByteSize() {
-  assert(this->byteSize() >= sizeof(Header));
-
-  Header* header = reinterpret_cast<Header*>(this->data.data() + 0);
-  pagesize_t size = header->byteSize.value();
-  return size;
-}
-
-inline void Page::setPageType(pagesize_t size) {
-  assert(this->byteSize() >= sizeof(Header));
+inline void Page::setByteSize(pagesize_t size) {
+  this->materialize();
+  assert(this->frameSize() >= sizeof(Header));
+  assert(size <= this->frameSize());
 
   Header* header = reinterpret_cast<Header*>(this->data.data() + 0);
-  header->byteSize = size;
+  header->byteSize = size; // full 64K page is stored as 0
 }
 
+inline size_t Page::byteSize() const {
+  assert(this->frameSize() >= sizeof(Header));
 
-inline size_t Page::byteSize() {
-  return this->data.size();
-}
-
-inline bool Page::isOversized() {
-  return this->byteSize() > PAGE_SIZE;
+  const Header* header = reinterpret_cast<const Header*>(this->bytes() + 0);
+  size_t size = header->byteSize.value();
+  return size != 0 ? size : MAX_PAGE_SIZE;
 }
 
 inline bool Page::isUndersized() {
-  return this->byteSize() < MERGE_THRESHOLD_PAGE_SIZE;
+  return this->byteSize() < MERGE_THRESHOLD_PAGE_SIZE(this->frameSize());
 }
 
-int32_t InternalPage::leBsearchInternal(InternalSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key) {
+template <typename Layout>
+int32_t InternalPage<Layout>::leBsearchInternal(const InternalSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key) {
+  unsafe_buf<byte> prefix = this->getPrefixInternal();
+  if (!hasPrefix(key, prefix)) { // every key of page compares to arg the same way as prefix
+    unsafe_buf<byte> keyBuf = key;
+    return unsafe_buf<byte>::compare(keyBuf, prefix) < 0 ? -1 : (int32_t) itemCount - 1;
+  }
+
   pagesize_t left = 0;
   pagesize_t right = itemCount;
 
-  unsafe_buf<byte> keyBufArg = key;
+  unsafe_buf<byte> keyBufArg = stripPrefix(key, prefix);
+  uint32_t headArg = keyHead(keyBufArg);
 
   int32_t pos = -1;
   while (left < right) { // less or equal bsearch
     pagesize_t mid = floor(left + ((right - left) >> 1));
     pagesize_t ksizeMid = slots[mid].ksize.value();
-    pagesize_t offsetMid = slots[mid].offset.value();
-    unsafe_buf<byte> keyBufMid = {
-      ptr: this->page.data.data() + offsetToAddrInternal(itemCount, offsetMid),
-      len: ksizeMid,
-    };
 
-    int comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    int comp = compareHeads(headArg, keyBufArg.len, slots[mid].head.value(), ksizeMid);
+    if (comp == 0) {
+      pagesize_t offsetMid = slots[mid].offset.value();
+      unsafe_buf<byte> keyBufMid = {
+        ptr: this->page.bytes() + offsetMid,
+        len: ksizeMid,
+      };
+      comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    }
     if (comp == 0) {
       pos = mid;
       break;
@@ -148,86 +264,153 @@ int32_t InternalPage::leBsearchInternal(InternalSlot* slots, pagesize_t itemCoun
   return pos;
 }
 
-inline pagesize_t InternalPage::countInternal()
+template <typename Layout>
+inline pagesize_t InternalPage<Layout>::countInternal()
 {
   assert(this->page.getPageType() == PageType::Internal);
-  assert(this->page.byteSize() >= sizeof(InternalHeader));
+  assert(this->page.frameSize() == Layout::pageSize);
 
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
-  assert(this->page.byteSize() >= sizeof(InternalHeader) + header->itemCount.value() * sizeof(InternalSlot));
+  const InternalHeader* header = reinterpret_cast<const InternalHeader*>(this->page.bytes() + 0);
+  assert(header->heapStart.value() >= slotsEndInternal(header->itemCount.value()));
   return header->itemCount.value();
 }
 
-inline unsafe_buf<byte> InternalPage::getKeyInternal(pagesize_t index) {
+template <typename Layout>
+inline unsafe_buf<byte> InternalPage<Layout>::getPrefixInternal() {
+  assert(this->page.frameSize() == Layout::pageSize);
+  const InternalHeader* header = reinterpret_cast<const InternalHeader*>(this->page.bytes() + 0);
+
+  unsafe_buf<byte> prefix = {
+    ptr: this->page.bytes() + Layout::pageSize - header->prefixSize.value(),
+    len: header->prefixSize.value(),
+  };
+  return prefix;
+}
+
+template <typename Layout>
+inline vector<byte> InternalPage<Layout>::getKeyInternal(pagesize_t index) {
+  vector<byte> key = this->getPrefixInternal().toVector();
+  unsafe_buf<byte> suffix = this->getSuffixInternal(index);
+  key.insert(key.end(), suffix.ptr, suffix.ptr + suffix.len);
+  return key;
+}
+
+template <typename Layout>
+inline unsafe_buf<byte> InternalPage<Layout>::getSuffixInternal(pagesize_t index) {
   assert(this->countInternal() > index);
 
-  InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
-  
-  assert(this->page.byteSize() >= offsetToAddrInternal(this->countInternal(), slot->offset.value()) + slot->ksize.value());
+  const InternalSlot* slot = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+  assert(slot->offset.value() + slot->ksize.value() <= Layout::pageSize);
 
   unsafe_buf<byte> key = {
-    ptr: &this->page.data[offsetToAddrInternal(this->countInternal(), slot->offset.value())],
+    ptr: this->page.bytes() + slot->offset.value(),
     len: slot->ksize.value(),
   };
 
   return key;
 }
 
-inline pageptr_t InternalPage::getPageptr(pagesize_t index){
+template <typename Layout>
+inline pageptr_t InternalPage<Layout>::getPageptr(pagesize_t index){
   assert(this->countInternal() > index);
-  assert(index >= 0);
-
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data());
 
-  InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
-  assert(this->page.byteSize() >= offsetToAddrInternal(header->itemCount.value(), slot->offset.value()) + slot->ksize.value());
+  const InternalSlot* slot = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
   return slot->gePtr.value();
 }
 
-inline void InternalPage::setKeyInternal(pagesize_t index, const vector<byte>& key, pageptr_t page) {
-  this->setKeyInternal(index, unsafe_buf<byte>::createFromVector(key), page);
+template <typename Layout>
+inline uint64_t InternalPage<Layout>::getCount(pagesize_t index) {
+  assert(this->countInternal() > index);
+
+  if constexpr (Layout::counted) {
+    const InternalSlot* slot = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+    return slot->count.value();
+  }
+  return 0;
 }
 
-inline void InternalPage::setKeyInternal(pagesize_t index, const unsafe_buf<byte>& key, pageptr_t page) {
+template <typename Layout>
+uint64_t InternalPage<Layout>::totalCount() {
+  uint64_t total = 0;
+  if constexpr (Layout::counted) {
+    pagesize_t itemCount = this->countInternal();
+    const InternalSlot* slots = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader));
+    for (pagesize_t i = 0; i < itemCount; i++) {
+      total += slots[i].count.value();
+    }
+  }
+  return total;
+}
+
+template <typename Layout>
+inline bool InternalPage<Layout>::setKeyInternal(pagesize_t index, const vector<byte>& key, pageptr_t page) {
+  return this->setKeyInternal(index, unsafe_buf<byte>::createFromVector(key), page);
+}
+
+template <typename Layout>
+inline bool InternalPage<Layout>::setKeyInternal(pagesize_t index, const unsafe_buf<byte>& key, pageptr_t page) {
+  this->page.materialize();
   assert(this->countInternal() > index);
 
-  InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
-  if (slot->ksize.value() == key.size()) {
-    memcpy(this->page.data.data() + offsetToAddrInternal(this->countInternal(), slot->offset.value()), key.data(), key.size());
+  const InternalSlot* oldSlot = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+  size_t suffixSize = 0;
+  size_t newSize = this->sizeAfterFitInternal(key, suffixSize);
+  size_t grow = this->getPrefixInternal().len - (key.len - suffixSize); // old key is longer after fit too
+  if (newSize - (oldSlot->ksize.value() + grow) + suffixSize > Layout::pageSize) {
+    return false;
   }
-  else {
-    pagesize_t kAddr = offsetToAddrInternal(this->countInternal(), slot->offset.value());
-    this->page.data.erase(this->page.data.begin() + kAddr, this->page.data.begin() + kAddr + slot->ksize.value());
 
-    slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
-    slot->offset = this->page.data.size() - offsetZeroInternal(this->countInternal());
+  this->fitPrefixInternal(key);
+  unsafe_buf<byte> suffix = stripPrefix(key, this->getPrefixInternal());
 
-    this->page.data.insert(this->page.data.end(), key.data(), key.data() + key.size());
-    slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+  InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+  pagesize_t oldSize = slot->ksize.value();
+  pagesize_t offset = slot->offset.value();
+  if (suffix.size() > oldSize) { // old key becomes a hole, compaction drops it
+    slot->ksize = 0;
+    this->page.setByteSize(this->page.byteSize() - oldSize);
+    oldSize = 0;
+    offset = this->allocInternal(suffix.size(), 0);
   }
+  copy(suffix.ptr, suffix.ptr + suffix.len, this->page.data.data() + offset);
+  this->page.setByteSize(this->page.byteSize() - oldSize + suffix.size());
 
+  slot->offset = offset;
+  slot->ksize = suffix.size();
   slot->gePtr = page;
+  slot->head = keyHead(suffix);
+  return true;
 }
 
-inline void InternalPage::setGEptr(pagesize_t index, pageptr_t page) {
+template <typename Layout>
+inline void InternalPage<Layout>::setGEptr(pagesize_t index, pageptr_t page) {
+  this->page.materialize();
   assert(this->countInternal() > index);
 
   InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
   slot->gePtr = page;
 }
 
-inline int32_t InternalPage::searchInternal(const vector<byte> &key) {
+template <typename Layout>
+inline void InternalPage<Layout>::setCount(pagesize_t index, uint64_t count) {
+  if constexpr (Layout::counted) {
+    this->page.materialize();
+    assert(this->countInternal() > index);
+
+    InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
+    slot->count = count;
+  }
+}
+
+template <typename Layout>
+inline int32_t InternalPage<Layout>::searchInternal(const vector<byte> &key) {
   return this->searchInternal(unsafe_buf<byte>::createFromVector(key));
 }
 
-inline int32_t InternalPage::searchInternal(const unsafe_buf<byte> &key) {
-  assert(this->page.getPageType() == PageType::Internal);
-  assert(this->page.byteSize() >= sizeof(InternalHeader));
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
-  pagesize_t itemCount = header->itemCount.value();
-
-  assert(this->page.byteSize() >= sizeof(InternalHeader) + itemCount * sizeof(InternalSlot));
-  InternalSlot* slots = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader));
+template <typename Layout>
+inline int32_t InternalPage<Layout>::searchInternal(const unsafe_buf<byte> &key) {
+  pagesize_t itemCount = this->countInternal();
+  const InternalSlot* slots = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader));
 
   int32_t pos = this->leBsearchInternal(slots, itemCount, key);
 
@@ -235,105 +418,218 @@ inline int32_t InternalPage::searchInternal(const unsafe_buf<byte> &key) {
 }
 
 
-inline void InternalPage::putInternal(const vector<byte>& key, pageptr_t page) {
-  this->putInternal(unsafe_buf<byte>::createFromVector(key), page);
+template <typename Layout>
+inline bool InternalPage<Layout>::putInternal(const vector<byte>& key, pageptr_t page, uint64_t count) {
+  return this->putInternal(unsafe_buf<byte>::createFromVector(key), page, count);
 }
 
-inline void InternalPage::insertInternalSlot(pagesize_t insertIn, const unsafe_buf<byte>& key, pageptr_t page) {
-  assert(this->page.getPageType() == PageType::Internal);
-  assert(this->page.byteSize() >= sizeof(InternalHeader));
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
+// prefix has to be fitted to key already
+template <typename Layout>
+inline void InternalPage<Layout>::insertInternalSlot(pagesize_t insertIn, const unsafe_buf<byte>& key, pageptr_t page, uint64_t count) {
+  this->page.materialize();
+  unsafe_buf<byte> suffix = stripPrefix(key, this->getPrefixInternal());
+  pagesize_t offset = this->allocInternal(suffix.size(), 1);
 
-  assert(this->page.byteSize() >= sizeof(InternalHeader) + header->itemCount.value() * sizeof(InternalSlot));
+  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
   InternalSlot* slots = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader));
+  pagesize_t itemCount = header->itemCount.value();
+  assert(insertIn <= itemCount);
 
-  header->itemCount = header->itemCount.value() + 1;
-
-  InternalSlot newSlot;
-  pagesize_t newSlotOffset = sizeof(InternalHeader) + insertIn * sizeof(InternalSlot);
-  this->page.data.insert(this->page.data.begin() + newSlotOffset, reinterpret_cast<byte*>(&newSlot), reinterpret_cast<byte*>(&newSlot) + sizeof(InternalSlot));
+  memmove(slots + insertIn + 1, slots + insertIn, (itemCount - insertIn) * sizeof(InternalSlot));
+  header->itemCount = itemCount + 1;
 
-  slots = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader));
-  slots[insertIn].ksize = key.size();
+  slots[insertIn].offset = offset;
+  slots[insertIn].ksize = suffix.size();
   slots[insertIn].gePtr = page;
-  slots[insertIn].offset = this->page.data.size() - offsetZeroInternal(this->countInternal());
-  this->page.data.insert(this->page.data.end(), key.data(), key.data() + key.size());
+  if constexpr (Layout::counted) {
+    slots[insertIn].count = count;
+  }
+  slots[insertIn].head = keyHead(suffix);
+  copy(suffix.ptr, suffix.ptr + suffix.len, this->page.data.data() + offset);
+  this->page.setByteSize(this->page.byteSize() + sizeof(InternalSlot) + suffix.size());
 }
 
-inline void InternalPage::putInternal(const unsafe_buf<byte>& key, pageptr_t page) {
-  assert(this->page.getPageType() == PageType::Internal);
-  assert(this->page.byteSize() >= sizeof(InternalHeader));
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
-  pagesize_t itemCount = header->itemCount.value();
+// bytes in use after fitPrefixInternal(key), suffixSize is what key itself would take then
+template <typename Layout>
+size_t InternalPage<Layout>::sizeAfterFitInternal(const unsafe_buf<byte>& key, size_t& suffixSize) {
+  pagesize_t itemCount = this->countInternal();
+  unsafe_buf<byte> prefix = this->getPrefixInternal();
+  size_t common = itemCount == 0 ? key.len : commonPrefixSize(prefix, key);
+  suffixSize = key.len - common;
 
-  assert(this->page.byteSize() >= sizeof(InternalHeader) + itemCount * sizeof(InternalSlot));
-  if (header->itemCount.value() == 0) {
-    this->insertInternalSlot(0, key, page);
+  // every key gets longer by what prefix loses
+  return this->page.byteSize() + (prefix.len - common) * itemCount - prefix.len + common;
+}
+
+// takes size bytes from the heap leaving room for more slots, page is compacted if middle is too small
+// caller checks that page has enough free space in total
+template <typename Layout>
+pagesize_t InternalPage<Layout>::allocInternal(pagesize_t size, pagesize_t slots) {
+  const InternalHeader* header = reinterpret_cast<const InternalHeader*>(this->page.bytes() + 0);
+  size_t slotsEnd = slotsEndInternal(header->itemCount.value() + slots);
+  if (header->heapStart.value() < slotsEnd + size) {
+    this->rebuildInternal(this->getPrefixInternal());
+  }
+
+  InternalHeader* mutHeader = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
+  assert(mutHeader->heapStart.value() >= slotsEnd + size);
+  mutHeader->heapStart = mutHeader->heapStart.value() - size;
+  return mutHeader->heapStart.value();
+}
+
+// shrinks prefix of page, so key can be stored
+template <typename Layout>
+void InternalPage<Layout>::fitPrefixInternal(const unsafe_buf<byte>& key) {
+  if (this->countInternal() == 0) { // the only key is the prefix
+    this->rebuildInternal(key);
     return;
   }
-  InternalSlot* slots = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader));
 
-  int32_t insertIn = this->leBsearchInternal(slots, itemCount, key);
+  unsafe_buf<byte> prefix = this->getPrefixInternal();
+  size_t common = commonPrefixSize(prefix, key);
+  if (common < prefix.len) {
+    unsafe_buf<byte> newPrefix = {
+      ptr: prefix.ptr,
+      len: common,
+    };
+    this->rebuildInternal(newPrefix);
+  }
+}
 
-  insertIn += 1;
+// keys are sorted, so prefix shared by the first and the last key is shared by all of them
+template <typename Layout>
+void InternalPage<Layout>::growPrefixInternal() {
+  pagesize_t itemCount = this->countInternal();
+  if (itemCount == 0) {
+    return;
+  }
 
-  assert(insertIn >= 0);
-  assert(insertIn <= header->itemCount.value());
+  vector<byte> first = this->getKeyInternal(0);
+  vector<byte> last = this->getKeyInternal(itemCount - 1);
+  size_t common = commonPrefixSize(unsafe_buf<byte>::createFromVector(first), unsafe_buf<byte>::createFromVector(last));
+  if (common > this->getPrefixInternal().len) {
+    unsafe_buf<byte> newPrefix = {
+      ptr: first.data(),
+      len: common,
+    };
+    this->rebuildInternal(newPrefix);
+  }
+}
 
-  this->insertInternalSlot(insertIn, key, page);
+// rewrites every key against new prefix, each of them has to start with it
+// heap is written anew from the end of page, so it's compacted as well
+template <typename Layout>
+void InternalPage<Layout>::rebuildInternal(const unsafe_buf<byte>& newPrefix) {
+  this->page.materialize();
+  vector<byte> prefix = newPrefix.toVector();
+  Page oldPage = this->page;
+  InternalPage old(oldPage);
+  pagesize_t itemCount = old.countInternal();
+
+  // header and slots are kept
+  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
+  pagesize_t heapStart = Layout::pageSize - prefix.size();
+  header->prefixSize = prefix.size();
+  copy(prefix.begin(), prefix.end(), this->page.data.data() + heapStart);
+
+  for (pagesize_t i = 0; i < itemCount; i++) {
+    vector<byte> key = old.getKeyInternal(i);
+    assert(hasPrefix(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(prefix)));
+
+    InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + i * sizeof(InternalSlot));
+    unsafe_buf<byte> suffix = stripPrefix(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(prefix));
+    heapStart -= suffix.size();
+    copy(suffix.ptr, suffix.ptr + suffix.len, this->page.data.data() + heapStart);
+    slot->offset = heapStart;
+    slot->ksize = suffix.size();
+    slot->head = keyHead(suffix);
+  }
+
+  assert(heapStart >= slotsEndInternal(itemCount));
+  header->heapStart = heapStart;
+  this->page.setByteSize(slotsEndInternal(itemCount) + Layout::pageSize - heapStart);
 }
 
-inline void InternalPage::delInternal(pagesize_t index) {
-  assert(this->countInternal() > index);
+template <typename Layout>
+inline bool InternalPage<Layout>::putInternal(const unsafe_buf<byte>& key, pageptr_t page, uint64_t count) {
+  this->page.materialize();
+  size_t suffixSize = 0;
+  if (this->sizeAfterFitInternal(key, suffixSize) + sizeof(InternalSlot) + suffixSize > Layout::pageSize) {
+    return false;
+  }
 
-  InternalSlot* slot = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader) + index * sizeof(InternalSlot));
-  pagesize_t delOffset = slot->offset.value();
-  pagesize_t delSize = slot->ksize.value();
-  auto startKey = this->page.data.begin() + offsetToAddrInternal(this->countInternal(), slot->offset.value());
-  auto endKey = startKey + slot->ksize.value();
-  this->page.data.erase(startKey, endKey);
+  this->fitPrefixInternal(key);
+  pagesize_t itemCount = this->countInternal();
+  if (itemCount == 0) {
+    this->insertInternalSlot(0, key, page, count);
+    return true;
+  }
+  const InternalSlot* slots = reinterpret_cast<const InternalSlot*>(this->page.bytes() + sizeof(InternalHeader));
+
+  int32_t pos = this->leBsearchInternal(slots, itemCount, key);
+  assert(pos >= -1);
 
-  auto startSlot = this->page.data.begin() + sizeof(InternalHeader) + index * sizeof(InternalSlot);
-  auto endSlot = this->page.data.begin() + sizeof(InternalHeader) + (index+1) * sizeof(InternalSlot);
-  this->page.data.erase(startSlot, endSlot);
+  pagesize_t insertIn = pos + 1;
+  assert(insertIn <= itemCount);
 
-  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
-  header->itemCount = header->itemCount.value() - 1;
+  this->insertInternalSlot(insertIn, key, page, count);
+  return true;
+}
+
+// key of deleted item is left in the heap as a hole
+template <typename Layout>
+inline void InternalPage<Layout>::delInternal(pagesize_t index) {
+  this->page.materialize();
+  assert(this->countInternal() > index);
 
+  InternalHeader* header = reinterpret_cast<InternalHeader*>(this->page.data.data() + 0);
   InternalSlot* slots = reinterpret_cast<InternalSlot*>(this->page.data.data() + sizeof(InternalHeader));
-  for (pagesize_t i = 0; i < this->countInternal(); i++) {
-    if (slots[i].offset.value() >= delOffset) {
-      slots[i].offset = slots[i].offset.value() - delSize;
-    }
-  }
+  pagesize_t itemCount = header->itemCount.value();
+  pagesize_t delSize = slots[index].ksize.value();
+
+  memmove(slots + index, slots + index + 1, (itemCount - index - 1) * sizeof(InternalSlot));
+  header->itemCount = itemCount - 1;
+  this->page.setByteSize(this->page.byteSize() - sizeof(InternalSlot) - delSize);
 }
 
-void InternalPage::delRangeInternal(pagesize_t start, pagesize_t end) {
+template <typename Layout>
+void InternalPage<Layout>::delRangeInternal(pagesize_t start, pagesize_t end) {
   assert(this->countInternal() >= end);
   assert(end > start);
 
-  for (pagesize_t i = end - 1; i >= start; i--) {
-    this->delInternal(i);
+  for (pagesize_t i = end; i > start; i--) {
+    this->delInternal(i - 1);
   }
+  this->growPrefixInternal();
 }
 
-int32_t LeafPage::exactBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key) {
+template <typename Layout>
+int32_t LeafPage<Layout>::exactBsearchLeaf(const LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key) {
+  unsafe_buf<byte> prefix = this->getPrefixLeaf();
+  if (!hasPrefix(key, prefix)) {
+    return -1;
+  }
+
   int32_t left = 0;
   int32_t right = itemCount - 1;
 
-  unsafe_buf<byte> keyBufArg = key;
+  unsafe_buf<byte> keyBufArg = stripPrefix(key, prefix);
+  uint32_t headArg = keyHead(keyBufArg);
 
   int32_t pos = -1;
   while (left <= right) {
     pagesize_t mid = floor(left + ((right - left) >> 1));
     pagesize_t ksizeMid = slots[mid].ksize.value();
-    pagesize_t offsetMid = slots[mid].offset.value();
-    unsafe_buf<byte> keyBufMid = {
-      ptr: this->page.data.data() + offsetToAddrLeaf(itemCount, offsetMid),
-      len: ksizeMid,
-    };
 
-    int comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    int comp = compareHeads(headArg, keyBufArg.len, slots[mid].head.value(), ksizeMid);
+    if (comp == 0) {
+      pagesize_t offsetMid = slots[mid].offset.value();
+      unsafe_buf<byte> keyBufMid = {
+        ptr: this->page.bytes() + offsetMid,
+        len: ksizeMid,
+      };
+      comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    }
     if (comp < 0) { // arg < mid
       right = mid - 1;
     }
@@ -349,24 +645,35 @@ int32_t LeafPage::exactBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const
   return pos;
 }
 
-int32_t LeafPage::leBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key, bool& exact) {
+template <typename Layout>
+int32_t LeafPage<Layout>::leBsearchLeaf(const LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key, bool& exact) {
   exact = false;
+  unsafe_buf<byte> prefix = this->getPrefixLeaf();
+  if (!hasPrefix(key, prefix)) { // every key of page compares to arg the same way as prefix
+    unsafe_buf<byte> keyBuf = key;
+    return unsafe_buf<byte>::compare(keyBuf, prefix) < 0 ? -1 : (int32_t) itemCount - 1;
+  }
+
   pagesize_t left = 0;
   pagesize_t right = itemCount;
 
-  unsafe_buf<byte> keyBufArg = key;
+  unsafe_buf<byte> keyBufArg = stripPrefix(key, prefix);
+  uint32_t headArg = keyHead(keyBufArg);
 
   int32_t pos = -1;
   while (left < right) { // less or equal bsearch
     pagesize_t mid = floor(left + ((right - left) >> 1));
     pagesize_t ksizeMid = slots[mid].ksize.value();
-    pagesize_t offsetMid = slots[mid].offset.value();
-    unsafe_buf<byte> keyBufMid = {
-      ptr: this->page.data.data() + offsetToAddrLeaf(itemCount, offsetMid),
-      len: ksizeMid,
-    };
 
-    int comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    int comp = compareHeads(headArg, keyBufArg.len, slots[mid].head.value(), ksizeMid);
+    if (comp == 0) {
+      pagesize_t offsetMid = slots[mid].offset.value();
+      unsafe_buf<byte> keyBufMid = {
+        ptr: this->page.bytes() + offsetMid,
+        len: ksizeMid,
+      };
+      comp = unsafe_buf<byte>::compare(keyBufArg, keyBufMid);
+    }
     if (comp == 0) {
       pos = mid;
       exact = true;
@@ -386,168 +693,391 @@ int32_t LeafPage::leBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const uns
   return pos;
 }
 
-inline void LeafPage::putLeaf(const vector<byte> &key, const vector<byte> &value) {
-  this->putLeaf(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(value));
+template <typename Layout>
+inline bool LeafPage<Layout>::putLeaf(const vector<byte> &key, const vector<byte> &value) {
+  return this->putLeaf(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(value));
 }
 
-inline void LeafPage::putLeaf(const unsafe_buf<byte> &key, const unsafe_buf<byte> &value) {
-  assert(this->page.getPageType() == PageType::Leaf);
-  assert(this->page.byteSize() >= sizeof(LeafHeader));
-  LeafHeader* header = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
+template <typename Layout>
+inline bool LeafPage<Layout>::putLeaf(const unsafe_buf<byte> &key, const unsafe_buf<byte> &value) {
+  return this->putLeafItem(key, value, 0, 0);
+}
 
-  assert(this->page.byteSize() >= sizeof(LeafHeader) + header->itemCount.value() * sizeof(LeafSlot));
-  LeafSlot* slots = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader));
+template <typename Layout>
+inline bool LeafPage<Layout>::putLeafOverflow(const vector<byte> &key, pageptr_t overflowPtr) {
+  return this->putLeafOverflow(unsafe_buf<byte>::createFromVector(key), overflowPtr);
+}
+
+template <typename Layout>
+inline bool LeafPage<Layout>::putLeafOverflow(const unsafe_buf<byte> &key, pageptr_t overflowPtr) {
+  unsafe_buf<byte> noValue = {
+    ptr: nullptr,
+    len: 0,
+  };
+  return this->putLeafItem(key, noValue, overflowPtr, VOVERFLOW_FLAG);
+}
+
+template <typename Layout>
+inline bool LeafPage<Layout>::copyLeaf(LeafPage& from, pagesize_t index) {
+  vector<byte> key = from.getKeyLeaf(index);
+  if (from.isOverflow(index)) {
+    return this->putLeafOverflow(key, from.getOverflowPtr(index));
+  }
+  return this->putLeaf(unsafe_buf<byte>::createFromVector(key), from.getValue(index));
+}
+
+template <typename Layout>
+bool LeafPage<Layout>::putLeafItem(const unsafe_buf<byte> &key, const unsafe_buf<byte> &value, pageptr_t overflowPtr, uint8_t flags) {
+  this->page.materialize();
+  pagesize_t itemCount = this->countLeaf();
+  const LeafSlot* constSlots = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader));
 
   bool exact = false;
-  int32_t insertIn = this->leBsearchLeaf(slots, header->itemCount.value(), key, exact);
+  int32_t pos = this->leBsearchLeaf(constSlots, itemCount, key, exact);
   if (exact) {
-    this->setKeyLeaf(insertIn, key, value);
-    return;
+    return this->setLeafItem(pos, key, value, overflowPtr, flags);
   }
-  
-  insertIn += 1;
-  
-  header->itemCount = header->itemCount.value() + 1;
+  assert(pos >= -1);
 
-  LeafSlot newSlot;
-  pagesize_t newSlotOffset = sizeof(LeafHeader) + insertIn * sizeof(LeafSlot);
-  this->page.data.insert(this->page.data.begin() + newSlotOffset, reinterpret_cast<byte*>(&newSlot), reinterpret_cast<byte*>(&newSlot) + sizeof(LeafSlot));
+  size_t suffixSize = 0;
+  size_t tailSize = ((flags & VOVERFLOW_FLAG) ? sizeof(OverflowPtr) : 0) + value.len;
+  if (this->sizeAfterFitLeaf(key, suffixSize) + sizeof(LeafSlot) + suffixSize + tailSize > Layout::pageSize) {
+    return false;
+  }
 
-  slots = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader));
-  slots[insertIn].ksize = key.len;
+  this->fitPrefixLeaf(key); // keeps order of items, so pos stays valid
+  pagesize_t insertIn = pos + 1;
+  unsafe_buf<byte> suffix = stripPrefix(key, this->getPrefixLeaf());
+  pagesize_t offset = this->allocLeaf(suffix.len + tailSize, 1);
+
+  LeafHeader* header = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
+  LeafSlot* slots = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader));
+  assert(insertIn <= itemCount);
+
+  memmove(slots + insertIn + 1, slots + insertIn, (itemCount - insertIn) * sizeof(LeafSlot));
+  header->itemCount = itemCount + 1;
+
+  slots[insertIn].offset = offset;
+  slots[insertIn].ksize = suffix.len;
   slots[insertIn].vsize = value.len;
-  slots[insertIn].flags = 0;
-  slots[insertIn].offset = this->page.data.size() - offsetZeroLeaf(this->countLeaf());
-  this->page.data.insert(this->page.data.end(), key.ptr, key.ptr + key.len);
-  this->page.data.insert(this->page.data.end(), value.ptr, value.ptr + value.len);
+  slots[insertIn].flags = flags;
+  slots[insertIn].head = keyHead(suffix);
+  this->writeLeafItem(offset, suffix, value, overflowPtr, flags);
+  this->page.setByteSize(this->page.byteSize() + sizeof(LeafSlot) + suffix.len + tailSize);
+  return true;
 }
 
-inline pagesize_t LeafPage::countLeaf() {
-  assert(this->page.getPageType() == PageType::Leaf);
-  assert(this->page.byteSize() >= sizeof(LeafHeader));
+// bytes in use after fitPrefixLeaf(key), suffixSize is what key itself would take then
+template <typename Layout>
+size_t LeafPage<Layout>::sizeAfterFitLeaf(const unsafe_buf<byte>& key, size_t& suffixSize) {
+  pagesize_t itemCount = this->countLeaf();
+  unsafe_buf<byte> prefix = this->getPrefixLeaf();
+  size_t common = itemCount == 0 ? key.len : commonPrefixSize(prefix, key);
+  suffixSize = key.len - common;
+
+  // every key gets longer by what prefix loses
+  return this->page.byteSize() + (prefix.len - common) * itemCount - prefix.len + common;
+}
 
+// takes size bytes from the heap leaving room for more slots, page is compacted if middle is too small
+// caller checks that page has enough free space in total
+template <typename Layout>
+pagesize_t LeafPage<Layout>::allocLeaf(pagesize_t size, pagesize_t slots) {
+  const LeafHeader* header = reinterpret_cast<const LeafHeader*>(this->page.bytes() + 0);
+  size_t slotsEnd = slotsEndLeaf(header->itemCount.value() + slots);
+  if (header->heapStart.value() < slotsEnd + size) {
+    this->rebuildLeaf(this->getPrefixLeaf());
+  }
+
+  LeafHeader* mutHeader = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
+  assert(mutHeader->heapStart.value() >= slotsEnd + size);
+  mutHeader->heapStart = mutHeader->heapStart.value() - size;
+  return mutHeader->heapStart.value();
+}
+
+// shrinks prefix of page, so key can be stored
+template <typename Layout>
+void LeafPage<Layout>::fitPrefixLeaf(const unsafe_buf<byte>& key) {
+  if (this->countLeaf() == 0) { // the only key is the prefix
+    this->rebuildLeaf(key);
+    return;
+  }
+
+  unsafe_buf<byte> prefix = this->getPrefixLeaf();
+  size_t common = commonPrefixSize(prefix, key);
+  if (common < prefix.len) {
+    unsafe_buf<byte> newPrefix = {
+      ptr: prefix.ptr,
+      len: common,
+    };
+    this->rebuildLeaf(newPrefix);
+  }
+}
+
+// keys are sorted, so prefix shared by the first and the last key is shared by all of them
+template <typename Layout>
+void LeafPage<Layout>::growPrefixLeaf() {
+  pagesize_t itemCount = this->countLeaf();
+  if (itemCount == 0) {
+    return;
+  }
+
+  vector<byte> first = this->getKeyLeaf(0);
+  vector<byte> last = this->getKeyLeaf(itemCount - 1);
+  size_t common = commonPrefixSize(unsafe_buf<byte>::createFromVector(first), unsafe_buf<byte>::createFromVector(last));
+  if (common > this->getPrefixLeaf().len) {
+    unsafe_buf<byte> newPrefix = {
+      ptr: first.data(),
+      len: common,
+    };
+    this->rebuildLeaf(newPrefix);
+  }
+}
+
+// rewrites every key against new prefix, each of them has to start with it
+// heap is written anew from the end of page, so it's compacted as well
+template <typename Layout>
+void LeafPage<Layout>::rebuildLeaf(const unsafe_buf<byte>& newPrefix) {
+  this->page.materialize();
+  vector<byte> prefix = newPrefix.toVector();
+  Page oldPage = this->page;
+  LeafPage old(oldPage);
+  pagesize_t itemCount = old.countLeaf();
+
+  // header and slots are kept
   LeafHeader* header = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
-  assert(this->page.byteSize() >= sizeof(LeafHeader) + header->itemCount.value() * sizeof(LeafSlot));
+  pagesize_t heapStart = Layout::pageSize - prefix.size();
+  header->prefixSize = prefix.size();
+  copy(prefix.begin(), prefix.end(), this->page.data.data() + heapStart);
+
+  for (pagesize_t i = 0; i < itemCount; i++) {
+    vector<byte> key = old.getKeyLeaf(i);
+    assert(hasPrefix(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(prefix)));
+
+    // overflow ptr and value follow the key unchanged
+    const LeafSlot* oldSlot = reinterpret_cast<const LeafSlot*>(oldPage.bytes() + sizeof(LeafHeader) + i * sizeof(LeafSlot));
+    const byte* tail = oldPage.bytes() + oldSlot->offset.value() + oldSlot->ksize.value();
+    size_t tailSize = itemSizeLeaf(oldSlot) - oldSlot->ksize.value();
+
+    unsafe_buf<byte> suffix = stripPrefix(unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(prefix));
+    heapStart -= suffix.size() + tailSize;
+    byte* to = copy(suffix.ptr, suffix.ptr + suffix.len, this->page.data.data() + heapStart);
+    copy(tail, tail + tailSize, to);
+
+    LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + i * sizeof(LeafSlot));
+    slot->offset = heapStart;
+    slot->ksize = suffix.size();
+    slot->head = keyHead(suffix);
+  }
+
+  assert(heapStart >= slotsEndLeaf(itemCount));
+  header->heapStart = heapStart;
+  this->page.setByteSize(slotsEndLeaf(itemCount) + Layout::pageSize - heapStart);
+}
+
+template <typename Layout>
+void LeafPage<Layout>::writeLeafItem(pagesize_t offset, const unsafe_buf<byte> &key, const unsafe_buf<byte> &value, pageptr_t overflowPtr, uint8_t flags) {
+  byte* to = copy(key.ptr, key.ptr + key.len, this->page.data.data() + offset);
+  if (flags & VOVERFLOW_FLAG) {
+    assert(overflowPtr != 0 && overflowPtr <= UINT32_MAX);
+    OverflowPtr ptr;
+    ptr.ptr = overflowPtr;
+    to = copy(reinterpret_cast<byte*>(&ptr), reinterpret_cast<byte*>(&ptr) + sizeof(OverflowPtr), to);
+  }
+  copy(value.ptr, value.ptr + value.len, to);
+}
+
+template <typename Layout>
+inline pagesize_t LeafPage<Layout>::countLeaf() {
+  assert(this->page.getPageType() == PageType::Leaf);
+  assert(this->page.frameSize() == Layout::pageSize);
+
+  const LeafHeader* header = reinterpret_cast<const LeafHeader*>(this->page.bytes() + 0);
+  assert(header->heapStart.value() >= slotsEndLeaf(header->itemCount.value()));
   return header->itemCount.value();
 }
 
-inline unsafe_buf<byte> LeafPage::getKeyLeaf(pagesize_t index) {
+template <typename Layout>
+inline unsafe_buf<byte> LeafPage<Layout>::getPrefixLeaf() {
+  assert(this->page.frameSize() == Layout::pageSize);
+  const LeafHeader* header = reinterpret_cast<const LeafHeader*>(this->page.bytes() + 0);
+
+  unsafe_buf<byte> prefix = {
+    ptr: this->page.bytes() + Layout::pageSize - header->prefixSize.value(),
+    len: header->prefixSize.value(),
+  };
+  return prefix;
+}
+
+template <typename Layout>
+inline vector<byte> LeafPage<Layout>::getKeyLeaf(pagesize_t index) {
+  vector<byte> key = this->getPrefixLeaf().toVector();
+  unsafe_buf<byte> suffix = this->getSuffixLeaf(index);
+  key.insert(key.end(), suffix.ptr, suffix.ptr + suffix.len);
+  return key;
+}
+
+template <typename Layout>
+inline unsafe_buf<byte> LeafPage<Layout>::getSuffixLeaf(pagesize_t index) {
   assert(this->countLeaf() > index);
 
-  LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
-  
-  assert(this->page.byteSize() >= offsetToAddrLeaf(this->countLeaf(), slot->offset.value()) + slot->ksize.value());
+  const LeafSlot* slot = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  assert(slot->offset.value() + itemSizeLeaf(slot) <= Layout::pageSize);
 
   unsafe_buf<byte> key = {
-    ptr: &this->page.data[offsetToAddrLeaf(this->countLeaf(), slot->offset.value())],
+    ptr: this->page.bytes() + slot->offset.value(),
     len: slot->ksize.value(),
   };
 
   return key;
 }
 
-inline unsafe_buf<byte> LeafPage::getValue(pagesize_t index) {
+template <typename Layout>
+inline unsafe_buf<byte> LeafPage<Layout>::getValue(pagesize_t index) {
   assert(this->countLeaf() > index);
+  assert(!this->isOverflow(index));
 
-  LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
-  
-  assert(this->page.byteSize() >= offsetToAddrLeaf(this->countLeaf(), slot->offset.value()) + slot->ksize.value() + slot->vsize.value());
+  const LeafSlot* slot = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  assert(slot->offset.value() + itemSizeLeaf(slot) <= Layout::pageSize);
 
-  unsafe_buf<byte> key = {
-    ptr: &this->page.data[offsetToAddrLeaf(this->countLeaf(), slot->offset.value()) + slot->ksize.value()],
+  unsafe_buf<byte> value = {
+    ptr: this->page.bytes() + slot->offset.value() + slot->ksize.value(),
     len: slot->vsize.value(),
   };
 
-  return key;
+  return value;
 }
 
-inline void LeafPage::setKeyLeaf(pagesize_t index, const vector<byte>& key, const vector<byte>& value) {
-  this->setKeyLeaf(index, unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(value));
+template <typename Layout>
+inline bool LeafPage<Layout>::isOverflow(pagesize_t index) {
+  assert(this->countLeaf() > index);
+
+  const LeafSlot* slot = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  return slot->flags.value() & VOVERFLOW_FLAG;
 }
 
-inline void LeafPage::setKeyLeaf(pagesize_t index, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value) {
-  assert(this->countLeaf() > index);
+template <typename Layout>
+inline pageptr_t LeafPage<Layout>::getOverflowPtr(pagesize_t index) {
+  assert(this->isOverflow(index));
 
-  LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
-  pagesize_t kvSizeOld = slot->ksize.value() + slot->vsize.value();
-  pagesize_t kvSizeNew = key.size() + value.size();
+  const LeafSlot* slot = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  assert(slot->offset.value() + itemSizeLeaf(slot) <= Layout::pageSize);
 
-  pagesize_t kvAddr = offsetToAddrLeaf(this->countLeaf(), slot->offset.value());  
-  if (kvSizeNew == kvSizeOld) {
-    memcpy(this->page.data.data() + kvAddr, key.data(), key.size());
-    memcpy(&this->page.data[kvAddr + slot->ksize.value()], value.data(), value.size());
+  const OverflowPtr* ptr = reinterpret_cast<const OverflowPtr*>(this->page.bytes() + slot->offset.value() + slot->ksize.value());
+  return ptr->ptr.value();
+}
+
+template <typename Layout>
+inline bool LeafPage<Layout>::setKeyLeaf(pagesize_t index, const vector<byte>& key, const vector<byte>& value) {
+  return this->setKeyLeaf(index, unsafe_buf<byte>::createFromVector(key), unsafe_buf<byte>::createFromVector(value));
+}
+
+template <typename Layout>
+inline bool LeafPage<Layout>::setKeyLeaf(pagesize_t index, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value) {
+  return this->setLeafItem(index, key, value, 0, 0);
+}
+
+template <typename Layout>
+bool LeafPage<Layout>::setLeafItem(pagesize_t index, const unsafe_buf<byte>& fullKey, const unsafe_buf<byte>& value, pageptr_t overflowPtr, uint8_t flags) {
+  this->page.materialize();
+  assert(this->countLeaf() > index);
+
+  const LeafSlot* oldSlot = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  size_t suffixSize = 0;
+  size_t tailSize = ((flags & VOVERFLOW_FLAG) ? sizeof(OverflowPtr) : 0) + value.len;
+  size_t newSize = this->sizeAfterFitLeaf(fullKey, suffixSize);
+  size_t grow = this->getPrefixLeaf().len - (fullKey.len - suffixSize); // old item is longer after fit too
+  if (newSize - (itemSizeLeaf(oldSlot) + grow) + suffixSize + tailSize > Layout::pageSize) {
+    return false;
   }
-  else {
-    this->page.data.erase(this->page.data.begin() + kvAddr, this->page.data.begin() + kvAddr + kvSizeOld);
 
-    slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
-    slot->offset = this->page.data.size();
-    
-    this->page.data.insert(this->page.data.end(), key.data(), key.data() + key.size());
-    this->page.data.insert(this->page.data.end(), value.data(), value.data() + value.size());
+  this->fitPrefixLeaf(fullKey);
+  unsafe_buf<byte> key = stripPrefix(fullKey, this->getPrefixLeaf());
+
+  LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
+  pagesize_t oldSize = itemSizeLeaf(slot);
+  pagesize_t newItemSize = key.size() + tailSize;
+  pagesize_t offset = slot->offset.value();
+  if (newItemSize > oldSize) { // old item becomes a hole, compaction drops it
+    slot->ksize = 0;
+    slot->vsize = 0;
+    slot->flags = 0;
+    this->page.setByteSize(this->page.byteSize() - oldSize);
+    oldSize = 0;
+    offset = this->allocLeaf(newItemSize, 0);
   }
+  this->writeLeafItem(offset, key, value, overflowPtr, flags);
+  this->page.setByteSize(this->page.byteSize() - oldSize + newItemSize);
+
+  slot->offset = offset;
+  slot->ksize = key.size();
+  slot->vsize = value.size();
+  slot->flags = flags;
+  slot->head = keyHead(key);
+  return true;
 }
 
-inline int32_t LeafPage::searchLeaf(const vector<byte> &key) {
+template <typename Layout>
+inline int32_t LeafPage<Layout>::searchLeaf(const vector<byte> &key) {
   return this->searchLeaf(unsafe_buf<byte>::createFromVector(key));
 }
 
-inline int32_t LeafPage::searchLeaf(const unsafe_buf<byte> &key) {
-  assert(this->page.getPageType() == PageType::Leaf);
-  assert(this->page.byteSize() >= sizeof(LeafHeader));
-  LeafHeader* header = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
-  pagesize_t itemCount = header->itemCount.value();
-
-  assert(this->page.byteSize() >= sizeof(LeafHeader) + itemCount * sizeof(LeafSlot));
-  LeafSlot* slots = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader));
+template <typename Layout>
+inline int32_t LeafPage<Layout>::searchLeaf(const unsafe_buf<byte> &key) {
+  pagesize_t itemCount = this->countLeaf();
+  const LeafSlot* slots = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader));
 
   return this->exactBsearchLeaf(slots, itemCount, key);
 }
 
-inline void LeafPage::delLeaf(pagesize_t index) {
-  assert(this->countLeaf() > index);
+template <typename Layout>
+inline pagesize_t LeafPage<Layout>::lowerBoundLeaf(const unsafe_buf<byte> &key) {
+  pagesize_t itemCount = this->countLeaf();
+  const LeafSlot* slots = reinterpret_cast<const LeafSlot*>(this->page.bytes() + sizeof(LeafHeader));
 
-  LeafSlot* slot = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader) + index * sizeof(LeafSlot));
-  pagesize_t delOffset = slot->offset.value();
-  pagesize_t delSize = slot->ksize.value() + slot->vsize.value();
-  auto startKey = this->page.data.begin() + offsetToAddrLeaf(this->countLeaf(), delOffset);
-  auto endKey = startKey + delSize;
-  this->page.data.erase(startKey, endKey);
+  bool exact = false;
+  int32_t pos = this->leBsearchLeaf(slots, itemCount, key, exact);
+  return exact ? pos : pos + 1;
+}
 
-  auto startSlot = this->page.data.begin() + sizeof(LeafHeader) + index * sizeof(LeafSlot);
-  auto endSlot = this->page.data.begin() + sizeof(LeafHeader) + (index+1) * sizeof(LeafSlot);
-  this->page.data.erase(startSlot, endSlot);
+// item is left in the heap as a hole
+template <typename Layout>
+inline void LeafPage<Layout>::delLeaf(pagesize_t index) {
+  this->page.materialize();
+  assert(this->countLeaf() > index);
 
   LeafHeader* header = reinterpret_cast<LeafHeader*>(this->page.data.data() + 0);
-  header->itemCount = header->itemCount.value() - 1;
-
   LeafSlot* slots = reinterpret_cast<LeafSlot*>(this->page.data.data() + sizeof(LeafHeader));
-  for (pagesize_t i = 0; i < this->countLeaf(); i++) {
-    if (slots[i].offset.value() >= delOffset) {
-      slots[i].offset = slots[i].offset.value() - delSize;
-    }
-  }
+  pagesize_t itemCount = header->itemCount.value();
+  pagesize_t delSize = itemSizeLeaf(&slots[index]);
+
+  memmove(slots + index, slots + index + 1, (itemCount - index - 1) * sizeof(LeafSlot));
+  header->itemCount = itemCount - 1;
+  this->page.setByteSize(this->page.byteSize() - sizeof(LeafSlot) - delSize);
 }
 
-inline void LeafPage::delRangeLeaf(pagesize_t start, pagesize_t end) {
+template <typename Layout>
+inline void LeafPage<Layout>::delRangeLeaf(pagesize_t start, pagesize_t end) {
   assert(this->countLeaf() >= end);
   assert(end > start);
 
-  for (pagesize_t i = end - 1; i >= start; i--) {
-    this->delLeaf(i);
+  for (pagesize_t i = end; i > start; i--) {
+    this->delLeaf(i - 1);
   }
+  this->growPrefixLeaf();
 }
 
 pageptr_t DeletedPage::getNext() {
   assert(this->page.getPageType() == PageType::Deleted);
   assert(this->page.byteSize() >= sizeof(DeletedHeader));
 
-  DeletedHeader* header = reinterpret_cast<DeletedHeader*>(this->page.data.data() + 0);
+  const DeletedHeader* header = reinterpret_cast<const DeletedHeader*>(this->page.bytes() + 0);
   pageptr_t next = header->next.value();
   return next;
 }
 
 void DeletedPage::setNext(pageptr_t next) {
+  this->page.materialize();
   assert(this->page.getPageType() == PageType::Deleted);
   assert(this->page.byteSize() >= sizeof(DeletedHeader));
 
@@ -559,7 +1089,7 @@ pagesize_t DeletedPage::getCount(){
   assert(this->page.getPageType() == PageType::Deleted);
   assert(this->page.byteSize() >= sizeof(DeletedHeader));
 
-  DeletedHeader* header = reinterpret_cast<DeletedHeader*>(this->page.data.data() + 0);
+  const DeletedHeader* header = reinterpret_cast<const DeletedHeader*>(this->page.bytes() + 0);
   pagesize_t cnt = header->count.value();
   return cnt;
 }
@@ -568,17 +1098,123 @@ pageptr_t DeletedPage::getPtr(pagesize_t index) {
   assert(this->page.byteSize() >= sizeof(DeletedHeader) + getCount() * sizeof(DeletedSlot));
   assert(index < getCount());
 
-  DeletedSlot* slot = reinterpret_cast<DeletedSlot*>(this->page.data.data() + sizeof(DeletedHeader) + index * sizeof(DeletedSlot));
+  const DeletedSlot* slot = reinterpret_cast<const DeletedSlot*>(this->page.bytes() + sizeof(DeletedHeader) + index * sizeof(DeletedSlot));
   pageptr_t ptr = slot->ptr.value();
   return ptr;
 }
 
-void DeletedPage::putPtr(pagesize_t newPtr) {
+void DeletedPage::putPtr(pageptr_t newPtr) {
+  this->page.materialize();
   assert(this->page.byteSize() >= sizeof(DeletedHeader) + getCount() * sizeof(DeletedSlot));
 
-  DeletedSlot newSlot;
-  newSlot.ptr = newPtr;
-  page.data.insert(page.data.end(), reinterpret_cast<byte*>(&newSlot), reinterpret_cast<byte*>(&newSlot) + sizeof(DeletedSlot));
+  assert(getCount() < MAX_DELETED_COUNT(this->page.frameSize()));
+
+  DeletedSlot* slot = reinterpret_cast<DeletedSlot*>(this->page.data.data() + sizeof(DeletedHeader) + getCount() * sizeof(DeletedSlot));
+  slot->ptr = newPtr;
   DeletedHeader* header = reinterpret_cast<DeletedHeader*>(this->page.data.data() + 0);
   header->count = header->count.value() + 1;
+  this->page.setByteSize(this->page.byteSize() + sizeof(DeletedSlot));
 }
+
+pageptr_t OverflowPage::getNext() {
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() >= sizeof(OverflowHeader));
+
+  const OverflowHeader* header = reinterpret_cast<const OverflowHeader*>(this->page.bytes() + 0);
+  return header->next.value();
+}
+
+void OverflowPage::setNext(pageptr_t next) {
+  this->page.materialize();
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() >= sizeof(OverflowHeader));
+  assert(next <= UINT32_MAX);
+
+  OverflowHeader* header = reinterpret_cast<OverflowHeader*>(this->page.data.data() + 0);
+  header->next = next;
+}
+
+uint32_t OverflowPage::getTotalSize() {
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() >= sizeof(OverflowHeader));
+
+  const OverflowHeader* header = reinterpret_cast<const OverflowHeader*>(this->page.bytes() + 0);
+  return header->totalSize.value();
+}
+
+void OverflowPage::setTotalSize(uint32_t size) {
+  this->page.materialize();
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() >= sizeof(OverflowHeader));
+
+  OverflowHeader* header = reinterpret_cast<OverflowHeader*>(this->page.data.data() + 0);
+  header->totalSize = size;
+}
+
+unsafe_buf<byte> OverflowPage::getData() {
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() >= sizeof(OverflowHeader));
+
+  unsafe_buf<byte> data = {
+    ptr: this->page.bytes() + sizeof(OverflowHeader),
+    len: this->page.byteSize() - sizeof(OverflowHeader),
+  };
+  return data;
+}
+
+void OverflowPage::putData(const unsafe_buf<byte>& data) {
+  this->page.materialize();
+  assert(this->page.getPageType() == PageType::Overflow);
+  assert(this->page.byteSize() + data.size() <= this->page.frameSize());
+
+  copy(data.ptr, data.ptr + data.len, this->page.data.data() + this->page.byteSize());
+  this->page.setByteSize(this->page.byteSize() + data.size());
+}
+
+bool FreeMapPage::isFree(pageptr_t index) {
+  assert(this->page.getPageType() == PageType::FreeMap);
+  assert(this->page.byteSize() == this->page.frameSize());
+  assert(index < FREEMAP_BITS(this->page.frameSize()));
+
+  const uint8_t* bitmap = reinterpret_cast<const uint8_t*>(this->page.bytes() + sizeof(FreeMapHeader));
+  return (bitmap[index / 8] >> (7 - index % 8)) & 1;
+}
+
+void FreeMapPage::setFree(pageptr_t index, bool free) {
+  this->page.materialize();
+  assert(this->page.getPageType() == PageType::FreeMap);
+  assert(this->page.byteSize() == this->page.frameSize());
+  assert(index < FREEMAP_BITS(this->page.frameSize()));
+
+  uint8_t* bitmap = reinterpret_cast<uint8_t*>(this->page.data.data() + sizeof(FreeMapHeader));
+  uint8_t mask = 1 << (7 - index % 8);
+  if (free) {
+    bitmap[index / 8] |= mask;
+  }
+  else {
+    bitmap[index / 8] &= ~mask;
+  }
+}
+
+template class InternalPage<BigEndianLayout>;
+template class InternalPage<NativeLayout<4096>>;
+template class InternalPage<NativeLayout<8192>>;
+template class InternalPage<NativeLayout<16384>>;
+template class InternalPage<NativeLayout<32768>>;
+template class InternalPage<NativeLayout<65536>>;
+template class InternalPage<NativeLayout<4096, true>>;
+template class InternalPage<NativeLayout<8192, true>>;
+template class InternalPage<NativeLayout<16384, true>>;
+template class InternalPage<NativeLayout<32768, true>>;
+template class InternalPage<NativeLayout<65536, true>>;
+template class LeafPage<BigEndianLayout>;
+template class LeafPage<NativeLayout<4096>>;
+template class LeafPage<NativeLayout<8192>>;
+template class LeafPage<NativeLayout<16384>>;
+template class LeafPage<NativeLayout<32768>>;
+template class LeafPage<NativeLayout<65536>>;
+template class LeafPage<NativeLayout<4096, true>>;
+template class LeafPage<NativeLayout<8192, true>>;
+template class LeafPage<NativeLayout<16384, true>>;
+template class LeafPage<NativeLayout<32768, true>>;
+template class LeafPage<NativeLayout<65536, true>>;
@@ -1,7 +1,7 @@
 /*
 Page format:
 
-Uses big-endian
+Uses big-endian, except for leaf and internal nodes of native layout (see below)
 
 Flags:
 +-----------+----------+
@@ -12,19 +12,31 @@ Flags:
 
 
 Leaf node:
-+---------+------------+------------------------+---------------+
-|  Flags  | Item count | Item slot (x item cnt) |     Data      |
-+---------+------------+------------------------+---------------+
-| 2 bytes | 2 bytes    | 7 bytes (x item cnt)   | Variable size |
-|         |            |                        |               |
-+---------+------------+------------------------+---------------+
++---------+---------+------------+-------------+------------+------------------------+------------+-------+--------+
+|  Flags  |  Size   | Item count | Prefix size | Heap start | Item slot (x item cnt) | Free space | Items | Prefix |
++---------+---------+------------+-------------+------------+------------------------+------------+-------+--------+
+| 2 bytes | 2 bytes | 2 bytes    | 2 bytes     | 2 bytes    | 11 bytes (x item cnt)  |            |       |        |
++---------+---------+------------+-------------+------------+------------------------+------------+-------+--------+
+
+Page size is fixed per file: a power of two from 4K to 64K, recorded in meta page.
+Size field is 16 bits, so it's 0 in a full 64K page (page is never empty, there is always a header).
+
+Leaf and internal nodes are slotted pages taking the whole page frame: slots grow from the front,
+items are allocated from the back down to Heap start, free space is in the middle.
+Deleted and shrunk items leave holes, they are compacted only when free space in the middle runs out.
+Size counts bytes in use (header, slots, prefix and live items), slot offsets are positions in the page.
+
+Prefix shared by every key of the page (Prefix size bytes) is kept at the very end of the page,
+items store only the rest of the key, Ksize is the size of this suffix.
 
 Leaf item slot:
-+---------+---------+---------+-----------+
-| Offset  |  Ksize  |  Vsize  |   Flags   |
-+---------+---------+---------+-----------+
-| 2 bytes | 2 bytes | 2 bytes | 1 byte    |
-+---------+---------+---------+-----------+
++---------+---------+---------+-----------+----------+
+| Offset  |  Ksize  |  Vsize  |   Flags   | Key head |
++---------+---------+---------+-----------+----------+
+| 2 bytes | 2 bytes | 2 bytes | 1 byte    | 4 bytes  |
++---------+---------+---------+-----------+----------+
+Key head is the first 4 bytes of the key suffix padded with zeroes, most comparisons
+in binary search are resolved by it without touching the data
 
 KV pair:
 +-------+-------------------------------+-------+
@@ -39,55 +51,170 @@ Slot flags:
 +-----------+----------+
 | 1 bit     | 7 bits   |
 +-----------+----------+
+If Voverflow is set, value is stored in chain of overflow pages starting at overflow ptr, Vsize is 0
 
 
 Internal node:
-+---------+------------+---------+-----------------------+---------------+
-|  Flags  | Item count |  Lptr   | Key slot (x item cnt) |     Keys      |
-+---------+------------+---------+-----------------------+---------------+
-| 2 bytes | 2 bytes    | 6 bytes | 10 bytes (x item cnt) | Variable size |
-|         |            |         |                       |               |
-+---------+------------+---------+-----------------------+---------------+
++---------+---------+------------+-------------+------------+-----------------------+------------+------+--------+
+|  Flags  |  Size   | Item count | Prefix size | Heap start | Key slot (x item cnt) | Free space | Keys | Prefix |
++---------+---------+------------+-------------+------------+-----------------------+------------+------+--------+
+| 2 bytes | 2 bytes | 2 bytes    | 2 bytes     | 2 bytes    | 14 bytes (x item cnt) |            |      |        |
++---------+---------+------------+-------------+------------+-----------------------+------------+------+--------+
+
+Laid out and prefix compressed the same way as leaf node.
 
 
 Internal item slot:
-+---------+---------+---------+
-| Offset  |  Ksize  |  GEptr  |
-+---------+---------+---------+
-| 2 bytes | 2 bytes | 6 bytes |
-+---------+---------+---------+
++---------+---------+---------+----------+
+| Offset  |  Ksize  |  GEptr  | Key head |
++---------+---------+---------+----------+
+| 2 bytes | 2 bytes | 6 bytes | 4 bytes  |
++---------+---------+---------+----------+
+
+
+Native layout (meta page says which layout file uses):
+headers past Flags and Size, and slots of leaf and internal nodes are aligned little-endian fields,
+so binary search reads them without byte swapping.
++-------------+---------------------------------------------------------------+
+| Leaf header | Flags, Size, Item count, Prefix size (2 each), Heap start (4) | 12 bytes
+| Leaf slot   | Key head (4), Offset, Ksize, Vsize (2 each), Flags (1), 1 pad | 12 bytes
+| Int. header | Same as leaf header, 4 reserved                               | 16 bytes
+| Int. slot   | GEptr (8), Key head (4), Offset, Ksize (2 each)               | 16 bytes
++-------------+---------------------------------------------------------------+
+Flags and Size stay big-endian, page type is read before layout is known.
+Big-endian layout exists only for 4K pages, files of other sizes are always native.
+
+Native counted layout is native layout with one more field in internal slot:
++-------------+---------------------------------------------------------------+
+| Int. slot   | GEptr (8), Count (8), Key head (4), Offset, Ksize (2 each)    | 24 bytes
++-------------+---------------------------------------------------------------+
+Count is the number of items in leaves of the child's subtree, so rank of a key
+and key of a rank are found in one descent.
+
+
+Overflow node:
++---------+---------+---------+------------+---------------+
+|  Flags  |  Size   |  Next   | Total size |     Data      |
++---------+---------+---------+------------+---------------+
+| 2 bytes | 2 bytes | 4 bytes | 4 bytes    | Variable size |
++---------+---------+---------+------------+---------------+
+Next is 0 in the last page of chain, total size is the size of the whole value
+
+
+Free map node (whole page):
++---------+---------+------------------------------+
+|  Flags  |  Size   |            Bitmap            |
++---------+---------+------------------------------+
+| 2 bytes | 2 bytes | page size - 4 bytes          |
++---------+---------+------------------------------+
+Bit i (most significant bit first) is set if page (node index * FREEMAP_BITS(page size) + i) is free
 
 
 */
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <cstddef>
 #include <cmath>
+#include <type_traits>
+#include <stdexcept>
 #include <stdint.h>
 
 #include <boost/endian/buffers.hpp>
 
 #include "../common.hpp"
+#include "./frame_pool.hpp"
 
 using std::vector;
 using std::byte;
+using std::integral_constant;
+using std::runtime_error;
 
 using namespace boost::endian;
 
-#define PAGE_SIZE (4096)
-#define MERGE_THRESHOLD_PAGE_SIZE (1024)
-#define MAX_DELETED_COUNT ((PAGE_SIZE - sizeof(DeletedHeader)) / sizeof(DeletedSlot))
+// page size is chosen when database file is created (power of two in this range) and kept in meta page
+#define MIN_PAGE_SIZE (4096)
+#define MAX_PAGE_SIZE (65536)
+#define DEFAULT_PAGE_SIZE (4096)
+#define MERGE_THRESHOLD_PAGE_SIZE(pageSize) ((pageSize) / 4)
+#define OVERFLOW_THRESHOLD(pageSize) ((pageSize) / 4) // larger values are moved to overflow pages
+#define MAX_OVERFLOW_DATA(pageSize) ((pageSize) - sizeof(OverflowHeader))
+#define VOVERFLOW_FLAG (0x80)
+#define KEY_HEAD_SIZE (4)
+#define MAX_DELETED_COUNT(pageSize) (((pageSize) - sizeof(DeletedHeader)) / sizeof(DeletedSlot))
+#define FREEMAP_BITS(pageSize) (((pageSize) - sizeof(FreeMapHeader)) * 8) // pages covered by one free map node
+
+// starts every page, outside of anonymous namespace as layout structs below embed it
+struct Header {
+  big_uint16_buf_t flags;
+  big_uint16_buf_t byteSize;
+};
 
 namespace {
-  struct Header {
-    big_uint16_buf_t flags;
-    big_uint16_buf_t byteSize;
+  struct OverflowPtr {
+    big_uint32_buf_t ptr;
   };
 
+  struct OverflowHeader {
+    Header header;
+    big_uint32_buf_t next;
+    big_uint32_buf_t totalSize;
+  };
+
+  struct DeletedHeader {
+    Header header;
+    big_uint16_buf_t count;
+    big_uint48_buf_t next;
+  };
+
+  struct DeletedSlot {
+    big_uint48_buf_t ptr;
+  };
+
+  struct FreeMapHeader {
+    Header header;
+  };
+};
+
+typedef uint64_t pageptr_t;
+
+enum class PageLayout: uint8_t {
+  BigEndian = 0x0,
+  Native = 0x1,
+  NativeCounted = 0x2,
+};
+
+inline bool isPageSize(size_t size) {
+  return size >= MIN_PAGE_SIZE && size <= MAX_PAGE_SIZE && (size & (size - 1)) == 0;
+}
+
+// calls f with integral_constant of page size, so code gets it as a compile-time constant
+template <typename F> inline auto withPageSize(size_t pageSize, F&& f) {
+  switch (pageSize) {
+    case 8192: return f(integral_constant<size_t, 8192>{});
+    case 16384: return f(integral_constant<size_t, 16384>{});
+    case 32768: return f(integral_constant<size_t, 32768>{});
+    case 65536: return f(integral_constant<size_t, 65536>{});
+    default: {
+      assert(pageSize == 4096);
+      return f(integral_constant<size_t, 4096>{});
+    }
+  }
+}
+
+// formats of leaf and internal nodes, pages of one file use the same layout and size
+// big-endian layout is the one of files written before native layout, they are all 4K
+struct BigEndianLayout {
+  static const PageLayout layout = PageLayout::BigEndian;
+  static const size_t pageSize = MIN_PAGE_SIZE;
+  static const bool counted = false;
+
   struct LeafHeader {
     Header header;
     big_uint16_buf_t itemCount;
+    big_uint16_buf_t prefixSize;
+    big_uint16_buf_t heapStart;
   };
 
   struct LeafSlot {
@@ -95,11 +222,14 @@ namespace {
     big_uint16_buf_t ksize;
     big_uint16_buf_t vsize;
     big_uint8_buf_t flags;
+    big_uint32_buf_t head;
   };
 
   struct InternalHeader {
     Header header;
     big_uint16_buf_t itemCount;
+    big_uint16_buf_t prefixSize;
+    big_uint16_buf_t heapStart;
   };
 
   struct InternalSlot {
@@ -107,22 +237,117 @@ namespace {
     big_uint16_buf_t ksize;
     big_uint48_buf_t gePtr; // greater or equal
     // less-than pointer deleted
+    big_uint32_buf_t head;
   };
+};
 
-  struct DeletedHeader {
+// frames are page aligned in file and at least 16 bytes aligned in memory, so every field is aligned
+// heap start is 32 bits: it equals page size while heap is empty, which doesn't fit in 16 bits for 64K pages
+// Counted is native counted layout: internal slots keep item count of child's subtree
+template <size_t PageSize, bool Counted = false> struct NativeLayout {
+  static_assert(PageSize >= MIN_PAGE_SIZE && PageSize <= MAX_PAGE_SIZE && (PageSize & (PageSize - 1)) == 0);
+
+  static const PageLayout layout = Counted ? PageLayout::NativeCounted : PageLayout::Native;
+  static const size_t pageSize = PageSize;
+  static const bool counted = Counted;
+
+  struct LeafHeader {
     Header header;
-    big_uint16_buf_t count;
-    big_uint48_buf_t next;
+    little_uint16_buf_at itemCount;
+    little_uint16_buf_at prefixSize;
+    little_uint32_buf_at heapStart;
   };
 
-  struct DeletedSlot {
-    big_uint48_buf_t ptr;
+  struct LeafSlot {
+    little_uint32_buf_at head;
+    little_uint16_buf_at offset;
+    little_uint16_buf_at ksize;
+    little_uint16_buf_at vsize;
+    little_uint8_buf_at flags;
   };
+
+  struct InternalHeader {
+    Header header;
+    little_uint16_buf_at itemCount;
+    little_uint16_buf_at prefixSize;
+    little_uint32_buf_at heapStart;
+    little_uint32_buf_at reserved;
+  };
+
+  struct PlainInternalSlot {
+    little_uint64_buf_at gePtr; // greater or equal
+    little_uint32_buf_at head;
+    little_uint16_buf_at offset;
+    little_uint16_buf_at ksize;
+  };
+
+  struct CountedInternalSlot {
+    little_uint64_buf_at gePtr; // greater or equal
+    little_uint64_buf_at count; // items in child's subtree
+    little_uint32_buf_at head;
+    little_uint16_buf_at offset;
+    little_uint16_buf_at ksize;
+  };
+
+  typedef std::conditional_t<Counted, CountedInternalSlot, PlainInternalSlot> InternalSlot;
 };
 
-typedef uint64_t pageptr_t;
+static_assert(sizeof(NativeLayout<MIN_PAGE_SIZE>::LeafHeader) % alignof(NativeLayout<MIN_PAGE_SIZE>::LeafSlot) == 0);
+static_assert(sizeof(NativeLayout<MIN_PAGE_SIZE>::InternalHeader) % alignof(NativeLayout<MIN_PAGE_SIZE>::InternalSlot) == 0);
+static_assert(sizeof(NativeLayout<MIN_PAGE_SIZE, true>::InternalSlot) == 24);
+
+// calls f with empty object of layout type, so page code is picked once per operation, not per access
+// unknown layout (of corrupt or newer file) throws instead of being read as any known one
+template <typename F> inline auto withLayout(PageLayout layout, size_t pageSize, F&& f) {
+  if (layout == PageLayout::Native) {
+    return withPageSize(pageSize, [&](auto size) {
+      return f(NativeLayout<decltype(size)::value>{});
+    });
+  }
+  if (layout == PageLayout::NativeCounted) {
+    return withPageSize(pageSize, [&](auto size) {
+      return f(NativeLayout<decltype(size)::value, true>{});
+    });
+  }
+  if (layout == PageLayout::BigEndian) {
+    assert(pageSize == BigEndianLayout::pageSize);
+    return f(BigEndianLayout{});
+  }
+  throw runtime_error("unknown page layout");
+}
+
+// page sized buffers come from FramePool of their size, anything else from the heap
+template <typename T> struct FrameAllocator {
+  typedef T value_type;
+
+  FrameAllocator() = default;
+  template <typename U> FrameAllocator(const FrameAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (isPageSize(n * sizeof(T))) {
+      return withPageSize(n * sizeof(T), [](auto size) {
+        return reinterpret_cast<T*>(FramePool<size>::acquire());
+      });
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    if (isPageSize(n * sizeof(T))) {
+      withPageSize(n * sizeof(T), [&](auto size) {
+        FramePool<size>::release(reinterpret_cast<byte*>(ptr));
+      });
+      return;
+    }
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  template <typename U> bool operator==(const FrameAllocator<U>&) const { return true; }
+};
+
+typedef vector<byte, FrameAllocator<byte>> frame_t;
 
-typedef uint16_t pagesize_t;
+typedef uint32_t pagesize_t;
 
 enum class PageType: uint8_t {
   // Meta = 0x0,
@@ -130,41 +355,70 @@ enum class PageType: uint8_t {
   Leaf = 0x2,
   Overflow = 0x3,
   Deleted = 0x4,
+  FreeMap = 0x5,
 };
 
+template <typename Layout = NativeLayout<DEFAULT_PAGE_SIZE>> class InternalPage;
+template <typename Layout = NativeLayout<DEFAULT_PAGE_SIZE>> class LeafPage;
+
 class Page {
  protected:
-  vector<byte> data;
+  frame_t data;
+
+  // borrowed page: points into memory owned by the pager (e.g. mmap region),
+  // copied into data on first modification
+  const byte* viewPtr{};
+  size_t viewLen{};
 
-  // for byteSize field (needed for pager)
-  pagesize_t getByteSize();
-  void setPageType(pagesize_t size);
+  // bytes in use, kept up to date by every modification
+  void setByteSize(pagesize_t size);
+
+  size_t frameSize() const; // page size of the file for every page but default constructed one
+  const byte* bytes() const;
  public:
   friend class TransactionalPager;
-  friend class InternalPage;
-  friend class LeafPage;
+  friend class BufferPoolPager;
+  template <typename> friend class InternalPage;
+  template <typename> friend class LeafPage;
   friend class DeletedPage;
+  friend class FreeMapPage;
+  friend class OverflowPage;
 
   Page();
   Page(vector<byte>& data);
   Page(unsafe_buf<byte>& data);
-  static Page createInternal();
-  static Page createLeaf();
-  static Page createDeleted();
+  static Page createInternal(PageLayout layout = PageLayout::Native, size_t pageSize = DEFAULT_PAGE_SIZE);
+  static Page createLeaf(PageLayout layout = PageLayout::Native, size_t pageSize = DEFAULT_PAGE_SIZE);
+  static Page createDeleted(size_t pageSize = DEFAULT_PAGE_SIZE);
+  static Page createOverflow(size_t pageSize = DEFAULT_PAGE_SIZE);
+  static Page createFreeMap(size_t pageSize = DEFAULT_PAGE_SIZE);
+
+  // no copy, buf must outlive the page (and all its copies) until it's modified
+  static Page createView(const unsafe_buf<byte>& buf);
+
+  bool isView() const { return this->viewPtr != nullptr; }
+  void materialize();
 
   PageType getPageType();
   void setPageType(PageType type);
   
-  size_t byteSize();
-  bool isOversized();
+  size_t byteSize() const; // bytes in use, the rest of the frame is free space
   bool isUndersized();
 };
 
-
-class InternalPage {
+// Layout is BigEndianLayout or NativeLayout<page size, counted>, the one of the file page belongs to
+template <typename Layout> class InternalPage {
  private:
-  int32_t leBsearchInternal(InternalSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key);
-  void insertInternalSlot(pagesize_t insertIn, const unsafe_buf<byte>& key, pageptr_t page);
+  typedef typename Layout::InternalHeader InternalHeader;
+  typedef typename Layout::InternalSlot InternalSlot;
+
+  int32_t leBsearchInternal(const InternalSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key);
+  void insertInternalSlot(pagesize_t insertIn, const unsafe_buf<byte>& key, pageptr_t page, uint64_t count);
+  size_t sizeAfterFitInternal(const unsafe_buf<byte>& key, size_t& suffixSize);
+  pagesize_t allocInternal(pagesize_t size, pagesize_t slots);
+  void fitPrefixInternal(const unsafe_buf<byte>& key);
+  void growPrefixInternal();
+  void rebuildInternal(const unsafe_buf<byte>& newPrefix);
  public:
   Page& page;
 
@@ -172,28 +426,47 @@ class InternalPage {
 
   pagesize_t countInternal();
   
+  vector<byte> getKeyInternal(pagesize_t index);
   // returned values are valid only during object's (page) lifetime
-  unsafe_buf<byte> getKeyInternal(pagesize_t index);
+  unsafe_buf<byte> getPrefixInternal();
+  unsafe_buf<byte> getSuffixInternal(pagesize_t index); // key without prefix
   pageptr_t getPageptr(pagesize_t index); // -1 means lPtr
-
-  void setKeyInternal(pagesize_t index, const vector<byte>& key, pageptr_t page);
-  void setKeyInternal(pagesize_t index, const unsafe_buf<byte>& key, pageptr_t page);
+  // items in subtree of child, always 0 unless Layout::counted (setCount does nothing then)
+  uint64_t getCount(pagesize_t index);
+  uint64_t totalCount(); // sum of counts of all children
+
+  // modifications return false and leave page untouched if key doesn't fit
+  // count of the slot is kept
+  bool setKeyInternal(pagesize_t index, const vector<byte>& key, pageptr_t page);
+  bool setKeyInternal(pagesize_t index, const unsafe_buf<byte>& key, pageptr_t page);
   void setGEptr(pagesize_t index, pageptr_t page);
+  void setCount(pagesize_t index, uint64_t count);
 
   int32_t searchInternal(const vector<byte>& key); // -1 means key not found
   int32_t searchInternal(const unsafe_buf<byte>& key); // -1 means key not found
 
-  void putInternal(const vector<byte>& key, pageptr_t page);
-  void putInternal(const unsafe_buf<byte>& key, pageptr_t page);
+  bool putInternal(const vector<byte>& key, pageptr_t page, uint64_t count = 0);
+  bool putInternal(const unsafe_buf<byte>& key, pageptr_t page, uint64_t count = 0);
 
   void delInternal(pagesize_t index);
   void delRangeInternal(pagesize_t start, pagesize_t end); // [start, end)
 };
 
-class LeafPage {
+template <typename Layout> class LeafPage {
  private:
-  int32_t exactBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key);
-  int32_t leBsearchLeaf(LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key, bool& exact);
+  typedef typename Layout::LeafHeader LeafHeader;
+  typedef typename Layout::LeafSlot LeafSlot;
+
+  int32_t exactBsearchLeaf(const LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key);
+  int32_t leBsearchLeaf(const LeafSlot* slots, pagesize_t itemCount, const unsafe_buf<byte>& key, bool& exact);
+  bool putLeafItem(const unsafe_buf<byte>& key, const unsafe_buf<byte>& value, pageptr_t overflowPtr, uint8_t flags);
+  bool setLeafItem(pagesize_t index, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value, pageptr_t overflowPtr, uint8_t flags);
+  void writeLeafItem(pagesize_t offset, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value, pageptr_t overflowPtr, uint8_t flags);
+  size_t sizeAfterFitLeaf(const unsafe_buf<byte>& key, size_t& suffixSize);
+  pagesize_t allocLeaf(pagesize_t size, pagesize_t slots);
+  void fitPrefixLeaf(const unsafe_buf<byte>& key);
+  void growPrefixLeaf();
+  void rebuildLeaf(const unsafe_buf<byte>& newPrefix);
  public:
   Page& page;
 
@@ -201,18 +474,30 @@ class LeafPage {
 
   pagesize_t countLeaf();
 
+  vector<byte> getKeyLeaf(pagesize_t index);
   // returned values are valid only during object's (page) lifetime
-  unsafe_buf<byte> getKeyLeaf(pagesize_t index);
-  unsafe_buf<byte> getValue(pagesize_t index);
+  unsafe_buf<byte> getPrefixLeaf();
+  unsafe_buf<byte> getSuffixLeaf(pagesize_t index); // key without prefix
+  unsafe_buf<byte> getValue(pagesize_t index); // only for values stored inline
+
+  bool isOverflow(pagesize_t index);
+  pageptr_t getOverflowPtr(pagesize_t index);
 
-  void setKeyLeaf(pagesize_t index, const vector<byte>& key, const vector<byte>& value);
-  void setKeyLeaf(pagesize_t index, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value);
+  // modifications return false and leave page untouched if item doesn't fit
+  bool setKeyLeaf(pagesize_t index, const vector<byte>& key, const vector<byte>& value);
+  bool setKeyLeaf(pagesize_t index, const unsafe_buf<byte>& key, const unsafe_buf<byte>& value);
 
   int32_t searchLeaf(const vector<byte>& key); // -1 means key not found
   int32_t searchLeaf(const unsafe_buf<byte>& key); // -1 means key not found
+  pagesize_t lowerBoundLeaf(const unsafe_buf<byte>& key); // first index with key >= arg, countLeaf() if none
 
-  void putLeaf(const vector<byte>& key, const vector<byte>& value);
-  void putLeaf(const unsafe_buf<byte>& key, const unsafe_buf<byte>& value);
+  bool putLeaf(const vector<byte>& key, const vector<byte>& value);
+  bool putLeaf(const unsafe_buf<byte>& key, const unsafe_buf<byte>& value);
+  // leaf keeps only the key and pointer to the first overflow page
+  bool putLeafOverflow(const vector<byte>& key, pageptr_t overflowPtr);
+  bool putLeafOverflow(const unsafe_buf<byte>& key, pageptr_t overflowPtr);
+  // copies item of another leaf with its flags, overflow chain is shared, not copied
+  bool copyLeaf(LeafPage& from, pagesize_t index);
 
   void delLeaf(pagesize_t index);
   void delRangeLeaf(pagesize_t start, pagesize_t end); // [start, end)
@@ -229,5 +514,32 @@ class DeletedPage {
 
   pagesize_t getCount();
   pageptr_t getPtr(pagesize_t index);
-  void putPtr(pagesize_t ptr);
+  void putPtr(pageptr_t ptr);
+};
+
+class OverflowPage {
+ public:
+  Page& page;
+
+  OverflowPage(Page& page): page(page) {};
+
+  pageptr_t getNext();
+  void setNext(pageptr_t next);
+
+  uint32_t getTotalSize();
+  void setTotalSize(uint32_t size);
+
+  unsafe_buf<byte> getData();
+  void putData(const unsafe_buf<byte>& data); // appends, at most MAX_OVERFLOW_DATA(page size) bytes in page
+};
+
+class FreeMapPage {
+ public:
+  Page& page;
+
+  FreeMapPage(Page& page): page(page) {};
+
+  // index is relative to the first page covered by node
+  bool isFree(pageptr_t index);
+  void setFree(pageptr_t index, bool free);
 };
@@ -0,0 +1,514 @@
+#include "./buffer_pool_pager.hpp"
+
+#include <sys/stat.h>
+#include <cstdio>
+
+void BufferPoolPager::readPage(pageptr_t id, byte* to) {
+  size_t read = 0;
+  while (read < pageSize) {
+    ssize_t ret = pread(fd, to + read, pageSize - read, id * pageSize + read);
+    if (ret < 0) {
+      perror("pread");
+      exit(errno);
+    }
+    if (ret == 0) { // past the end of file, page was never written
+      memset(to + read, 0, pageSize - read);
+      break;
+    }
+    read += ret;
+  }
+}
+
+void BufferPoolPager::writePage(pageptr_t id, const byte* from) {
+  size_t written = 0;
+  while (written < pageSize) {
+    ssize_t ret = pwrite(fd, from + written, pageSize - written, id * pageSize + written);
+    if (ret < 0) {
+      perror("pwrite");
+      exit(errno);
+    }
+    written += ret;
+  }
+}
+
+size_t BufferPoolPager::findVictim() {
+  size_t victim = frames.size();
+  for (size_t i = 0; i < frames.size(); i++) {
+    Frame& f = frames[i];
+    if (!f.used) {
+      return i;
+    }
+    if (f.pinCount > 0) {
+      continue;
+    }
+
+    if (victim == frames.size()) {
+      victim = i;
+      continue;
+    }
+
+    // oldest K-th access wins (no K-th access counts as oldest), ties are broken by plain LRU
+    Frame& v = frames[victim];
+    if (f.lastAccess[LRU_K - 1] < v.lastAccess[LRU_K - 1]
+        || (f.lastAccess[LRU_K - 1] == v.lastAccess[LRU_K - 1] && f.lastAccess[0] < v.lastAccess[0])) {
+      victim = i;
+    }
+  }
+
+  if (victim == frames.size()) {
+    throw runtime_error("every frame of buffer pool is pinned");
+  }
+
+  Frame& v = frames[victim];
+  if (v.dirty) {
+    writePage(v.pageId, frameBytes(victim));
+    stats.writebacks++;
+  }
+  pageTable.erase(v.pageId);
+  v.used = false;
+  stats.evictions++;
+  return victim;
+}
+
+size_t BufferPoolPager::fetchFrame(pageptr_t id) {
+  assert(id != 0); // meta page is not cached
+  assert(id < meta.getCursize());
+
+  auto frameIt = pageTable.find(id);
+  size_t frame = 0;
+  if (frameIt != pageTable.end()) {
+    stats.hits++;
+    frame = frameIt->second;
+  }
+  else {
+    stats.misses++;
+    frame = findVictim();
+    readPage(id, frameBytes(frame));
+    frames[frame] = Frame {
+      used: true,
+      pageId: id,
+    };
+    pageTable[id] = frame;
+  }
+
+  frames[frame].pinCount++;
+  touch(frame);
+  return frame;
+}
+
+void BufferPoolPager::unpin(size_t frame) {
+  poolLock.lock();
+  assert(frames[frame].pinCount > 0);
+  frames[frame].pinCount--;
+  poolLock.unlock();
+}
+
+Page BufferPoolPager::PinnedPage::getPage() {
+  unsafe_buf<byte> buf = {
+    ptr: pool->frameBytes(frame),
+    len: pool->pageSize,
+  };
+  return Page::createView(buf);
+}
+
+BufferPoolPager::PinnedPage BufferPoolPager::pin(pageptr_t id) {
+  poolLock.lock();
+  size_t frame = fetchFrame(id);
+  poolLock.unlock();
+  return PinnedPage(this, frame);
+}
+
+Page BufferPoolPager::getPage(pageptr_t id) {
+  poolLock.lock();
+  size_t frame = fetchFrame(id);
+  unsafe_buf<byte> buf = {
+    ptr: frameBytes(frame),
+    len: pageSize,
+  };
+  Page page(buf);
+  frames[frame].pinCount--;
+  poolLock.unlock();
+
+  return page;
+}
+
+pageptr_t BufferPoolPager::addPage(const Page& page) {
+  Page ownPage = page;
+  ownPage.materialize();
+  assert(ownPage.frameSize() == pageSize);
+
+  poolLock.lock();
+  pageptr_t id = 0;
+  if (freeList.empty()) {
+    id = meta.getCursize();
+    meta.setCursize(id + 1);
+  }
+  else {
+    id = freeList.back();
+    freeList.pop_back();
+  }
+
+  size_t frame = findVictim(); // new page, nothing to read
+  memcpy(frameBytes(frame), ownPage.data.data(), pageSize);
+  frames[frame] = Frame {
+    used: true,
+    pageId: id,
+    dirty: true,
+  };
+  pageTable[id] = frame;
+  touch(frame);
+  poolLock.unlock();
+
+  return id;
+}
+
+void BufferPoolPager::delPage(pageptr_t id) {
+  poolLock.lock();
+  auto frameIt = pageTable.find(id);
+  if (frameIt != pageTable.end()) { // contents are garbage now, no write back
+    assert(frames[frameIt->second].pinCount == 0);
+    frames[frameIt->second].used = false;
+    pageTable.erase(frameIt);
+  }
+  freeList.push_back(id);
+  poolLock.unlock();
+}
+
+pageptr_t BufferPoolPager::updatePage(pageptr_t id, const Page& page) {
+  putPage(id, page);
+  return id;
+}
+
+void BufferPoolPager::saveMetaPage(const MetaPage& metaPage) {
+  MetaPage newMeta = metaPage;
+  poolLock.lock();
+  meta.setMetaTableRoot(newMeta.getMetaTableRoot()); // free space fields are owned by pager
+  poolLock.unlock();
+}
+
+MetaPage BufferPoolPager::getMetaPage() {
+  poolLock.lock();
+  MetaPage metaPage = meta;
+  poolLock.unlock();
+  return metaPage;
+}
+
+BufferPoolStats BufferPoolPager::getStats() {
+  poolLock.lock();
+  BufferPoolStats ret = stats;
+  poolLock.unlock();
+  return ret;
+}
+
+void BufferPoolPager::loadFreeList() {
+  pageptr_t listCur = meta.getFreeListHead();
+  vector<byte> buf(pageSize);
+  while (listCur != 0) {
+    listPages.push_back(listCur);
+    readPage(listCur, buf.data());
+    Page deletedPage(buf);
+    DeletedPage deleted(deletedPage);
+    for (pagesize_t i = 0; i < deleted.getCount(); i++) {
+      freeList.push_back(deleted.getPtr(i));
+    }
+    listCur = deleted.getNext();
+  }
+}
+
+// files written by TransactionalPager keep free pages in free map, it's turned back into chain on flush
+void BufferPoolPager::loadFreeMap() {
+  vector<byte> buf(pageSize);
+  for (size_t index = 0; index < meta.getFreeMapCount(); index++) {
+    pageptr_t mapId = meta.getFreeMapPage(index);
+    freeList.push_back(mapId);
+    readPage(mapId, buf.data());
+    Page mapPage(buf);
+    FreeMapPage freeMap(mapPage);
+    pageptr_t first = index * FREEMAP_BITS(pageSize);
+    pageptr_t end = min(first + FREEMAP_BITS(pageSize), meta.getCursize());
+    for (pageptr_t id = first; id < end; id++) {
+      if (freeMap.isFree(id - first)) {
+        freeList.push_back(id);
+      }
+    }
+  }
+
+  meta.clearFreeMap();
+  meta.setFreeMap(false);
+}
+
+// called under poolLock
+void BufferPoolPager::syncFreeList() {
+  freeList.insert(freeList.end(), listPages.begin(), listPages.end());
+  listPages.clear();
+
+  // chain pages are taken from the list itself, so it only gets shorter
+  size_t listCount = (freeList.size() / MAX_DELETED_COUNT(pageSize)) + ((freeList.size() % MAX_DELETED_COUNT(pageSize)) != 0);
+  for (size_t i = 0; i < listCount; i++) {
+    listPages.push_back(freeList.back());
+    freeList.pop_back();
+  }
+
+  for (size_t i = 0; i < listPages.size(); i++) {
+    Page page = Page::createDeleted(pageSize);
+    DeletedPage deleted(page);
+    size_t listEnd = min(freeList.size(), MAX_DELETED_COUNT(pageSize) * (i + 1));
+    for (size_t j = MAX_DELETED_COUNT(pageSize) * i; j < listEnd; j++) {
+      deleted.putPtr(freeList[j]);
+    }
+    deleted.setNext(i + 1 < listPages.size() ? listPages[i + 1] : 0);
+
+    writePage(listPages[i], page.data.data());
+  }
+
+  meta.setFreeListHead(listPages.empty() ? 0 : listPages.front());
+  meta.setFreeListTail(listPages.empty() ? 0 : listPages.back());
+}
+
+void BufferPoolPager::putPage(pageptr_t id, const Page& page) {
+  Page ownPage = page;
+  ownPage.materialize();
+  assert(ownPage.frameSize() == pageSize);
+
+  poolLock.lock();
+  size_t frame = fetchFrame(id);
+  memcpy(frameBytes(frame), ownPage.data.data(), pageSize);
+  frames[frame].dirty = true;
+  frames[frame].pinCount--;
+  poolLock.unlock();
+}
+
+pageptr_t BufferPoolPager::placeNode(pageptr_t reuseId, const Page& page) {
+  if (reuseId == 0) {
+    return addPage(page);
+  }
+  putPage(reuseId, page);
+  return reuseId;
+}
+
+// fills native internal nodes with children in order, returns first key and id of every node
+vector<pair<vector<byte>, pageptr_t>> BufferPoolPager::packInternal(const vector<pair<vector<byte>, pageptr_t>>& children, pageptr_t reuseId) {
+  vector<pair<vector<byte>, pageptr_t>> nodes;
+  Page page = Page::createInternal(PageLayout::Native, pageSize);
+  InternalPage<NativeLayout<MIN_PAGE_SIZE>> internal(page);
+  for (auto& [key, childId]: children) {
+    if (internal.countInternal() > 0 && !internal.putInternal(key, childId)) {
+      nodes.emplace_back(internal.getKeyInternal(0), placeNode(nodes.empty() ? reuseId : 0, page));
+      page = Page::createInternal(PageLayout::Native, pageSize);
+    }
+    if (internal.countInternal() == 0) {
+      bool fits = internal.putInternal(key, childId);
+      assert(fits);
+    }
+  }
+  nodes.emplace_back(internal.getKeyInternal(0), placeNode(nodes.empty() ? reuseId : 0, page));
+  return nodes;
+}
+
+// native nodes holding subtree of big-endian node, the first one keeps node's id
+vector<pair<vector<byte>, pageptr_t>> BufferPoolPager::convertNode(pageptr_t id) {
+  Page oldPage = getPage(id);
+  if (oldPage.getPageType() == PageType::Internal) {
+    InternalPage<BigEndianLayout> old(oldPage);
+    vector<pair<vector<byte>, pageptr_t>> children;
+    for (pagesize_t i = 0; i < old.countInternal(); i++) {
+      vector<pair<vector<byte>, pageptr_t>> converted = convertNode(old.getPageptr(i));
+      converted[0].first = old.getKeyInternal(i); // separator stays, it may be shorter than the first key
+      children.insert(children.end(), converted.begin(), converted.end());
+    }
+    return packInternal(children, id);
+  }
+
+  assert(oldPage.getPageType() == PageType::Leaf);
+  LeafPage<BigEndianLayout> old(oldPage);
+  vector<pair<vector<byte>, pageptr_t>> nodes;
+  Page page = Page::createLeaf(PageLayout::Native, pageSize);
+  LeafPage<NativeLayout<MIN_PAGE_SIZE>> leaf(page);
+  for (pagesize_t i = 0; i < old.countLeaf(); i++) {
+    vector<byte> key = old.getKeyLeaf(i);
+    auto put = [&]() {
+      if (old.isOverflow(i)) {
+        return leaf.putLeafOverflow(key, old.getOverflowPtr(i));
+      }
+      return leaf.putLeaf(unsafe_buf<byte>::createFromVector(key), old.getValue(i));
+    };
+
+    if (!put()) {
+      nodes.emplace_back(leaf.getKeyLeaf(0), placeNode(nodes.empty() ? id : 0, page));
+      page = Page::createLeaf(PageLayout::Native, pageSize);
+      bool fits = put();
+      assert(fits);
+    }
+  }
+  nodes.emplace_back(leaf.countLeaf() > 0 ? leaf.getKeyLeaf(0) : vector<byte>(), placeNode(nodes.empty() ? id : 0, page));
+  return nodes;
+}
+
+void BufferPoolPager::convertToNativeLayout() {
+  if (getMetaPage().getLayout() != PageLayout::BigEndian) {
+    return;
+  }
+
+  // roots are tree nodes no internal node points to
+  poolLock.lock();
+  pageptr_t curSize = meta.getCursize();
+  vector<bool> skip(curSize, false);
+  for (pageptr_t id: freeList) {
+    skip[id] = true;
+  }
+  for (pageptr_t id: listPages) {
+    skip[id] = true;
+  }
+  poolLock.unlock();
+
+  vector<pageptr_t> nodes;
+  for (pageptr_t id = 1; id < curSize; id++) {
+    if (skip[id]) {
+      continue;
+    }
+    Page page = getPage(id);
+    if (page.getPageType() == PageType::Internal) {
+      InternalPage<BigEndianLayout> internal(page);
+      for (pagesize_t i = 0; i < internal.countInternal(); i++) {
+        skip[internal.getPageptr(i)] = true;
+      }
+    }
+    if (page.getPageType() == PageType::Internal || page.getPageType() == PageType::Leaf) {
+      nodes.push_back(id);
+    }
+  }
+
+  for (pageptr_t rootId: nodes) {
+    if (skip[rootId]) {
+      continue;
+    }
+
+    vector<pair<vector<byte>, pageptr_t>> level = convertNode(rootId);
+    if (level.size() > 1) { // root is split, its first node moves out and new root takes its id
+      level[0].second = addPage(getPage(rootId));
+      while (level.size() > 1) {
+        level = packInternal(level, 0);
+      }
+      putPage(rootId, getPage(level[0].second));
+      delPage(level[0].second);
+    }
+  }
+
+  poolLock.lock();
+  meta.setLayout(PageLayout::Native);
+  poolLock.unlock();
+  flush();
+}
+
+void BufferPoolPager::flush() {
+  poolLock.lock();
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (frames[i].used && frames[i].dirty) {
+      writePage(frames[i].pageId, frameBytes(i));
+      frames[i].dirty = false;
+      stats.writebacks++;
+    }
+  }
+
+  syncFreeList();
+
+  MetaPage writePage = meta;
+  writePage.data.resize(pageSize);
+  this->writePage(0, writePage.data.data());
+  fsync(fd);
+  poolLock.unlock();
+}
+
+// commits of TransactionalPager that never reached checkpoint are written to the file, then log is dropped
+void BufferPoolPager::replayLog(const path& dbPath) {
+  path walPath = dbPath.string() + "-wal";
+  if (!std::filesystem::exists(walPath) || std::filesystem::file_size(walPath) == 0) {
+    return;
+  }
+
+  WriteAheadLog wal(walPath, pageSize);
+  wal.recover([this](pageptr_t pageId, const byte* data) {
+    writePage(pageId, data);
+  });
+  fsync(fd);
+  wal.reset();
+}
+
+BufferPoolPager::BufferPoolPager(path path, size_t frameCount, PageLayout layout, size_t newPageSize): frames(frameCount) {
+  assert(frameCount > 0);
+  if (!isPageSize(newPageSize) || (layout == PageLayout::BigEndian && newPageSize != BigEndianLayout::pageSize)) {
+    throw runtime_error("page size has to be a power of two from 4K to 64K, 4K for big-endian layout");
+  }
+  mode_t mode = S_IRWXU | S_IRWXG | S_IRWXO;
+
+  int dirfd = open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY, S_IRWXU);
+  if (dirfd < 0) {
+    perror("bad path");
+    exit(errno);
+  }
+
+  int filefd = openat(dirfd, path.filename().c_str(), O_RDWR | O_CREAT, mode);
+  if (filefd < 0) {
+    perror("bad path");
+    exit(errno);
+  }
+
+  fsync(dirfd);
+  close(dirfd);
+
+  struct stat statbuf;
+  int status = fstat(filefd, &statbuf);
+  if (status < 0) {
+    perror("fstat");
+    exit(errno);
+  }
+
+  fd = filefd;
+  if (statbuf.st_size < MIN_PAGE_SIZE) { // init meta
+    std::filesystem::remove(path.string() + "-wal"); // log left from some older database file
+    pageSize = newPageSize;
+    frameData.resize(frameCount * pageSize);
+    meta.setLayout(layout);
+    meta.setFreeMap(false);
+    meta.setPageSize(pageSize);
+    meta.setCursize(1);
+    MetaPage writePage = meta;
+    writePage.data.resize(pageSize);
+    this->writePage(0, writePage.data.data());
+    fsync(fd);
+  }
+  else {
+    pageSize = MIN_PAGE_SIZE; // enough to read page size from meta page
+    vector<byte> buf(pageSize);
+    readPage(0, buf.data());
+    MetaPage diskMeta(buf);
+    if (!diskMeta.isSupported()) { // checked before page size is trusted, again after log replay
+      close(fd);
+      throw runtime_error("database file is of unknown format version or page layout");
+    }
+    pageSize = diskMeta.getPageSize();
+    replayLog(path);
+    frameData.resize(frameCount * pageSize);
+    buf.resize(pageSize);
+    readPage(0, buf.data());
+    MetaPage page(buf);
+    page.data.resize(page.getByteSize());
+    meta = page;
+    if (!meta.isSupported()) {
+      close(fd);
+      throw runtime_error("database file is of unknown format version or page layout");
+    }
+    meta.setLayout(meta.getLayout()); // counted files of earlier builds get their version on flush
+    if (!meta.hasFreeMap()) {
+      loadFreeList();
+    }
+    else {
+      loadFreeMap();
+    }
+  }
+}
+
+BufferPoolPager::~BufferPoolPager() {
+  flush();
+  close(fd);
+}
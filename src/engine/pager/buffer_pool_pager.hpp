@@ -0,0 +1,151 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <filesystem>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "./pager.hpp"
+#include "./wal.hpp"
+#include "../page/page.hpp"
+#include "../page/meta_page.hpp"
+
+using std::mutex;
+using std::unordered_map;
+using std::deque;
+using std::vector;
+using std::pair;
+using std::runtime_error;
+using std::filesystem::path;
+
+#define LRU_K (2)
+
+struct BufferPoolStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t writebacks;
+};
+
+/*
+Pager with bounded memory: pages live in a fixed number of frames, file is accessed with pread/pwrite.
+Replacement policy is LRU-K (K = 2): victim is the frame whose K-th most recent access is the oldest,
+frames touched only once (e.g. by a scan) go first, so internal nodes stay cached.
+
+Free pages are kept in a chain of Deleted pages (meta version 1, 3 for counted layout), free map
+of version 2 (4) files is read on open and replaced with the chain on flush.
+
+Also converts files of big-endian page layout into native one offline (see convertToNativeLayout()).
+
+Log left by TransactionalPager (<file>-wal) is replayed into the file on open and dropped,
+so pages written here are never overwritten by stale images from it later.
+
+No transactions and no crash consistency: state is written to the file by flush() and destructor,
+use TransactionalPager when durability is needed.
+*/
+class BufferPoolPager: public Pager {
+ private:
+  struct Frame {
+    bool used = false;
+    pageptr_t pageId = 0;
+    size_t pinCount = 0;
+    bool dirty = false;
+    uint64_t lastAccess[LRU_K] = {}; // newest first, 0 means no access
+  };
+
+  int64_t fd{};
+  size_t pageSize{}; // of the file, recorded in meta page when file is created
+
+  vector<byte> frameData; // frames.size() * pageSize, the whole memory budget
+  vector<Frame> frames;
+  unordered_map<pageptr_t, size_t> pageTable; // page id -> frame
+  uint64_t accessClock{};
+  BufferPoolStats stats{};
+
+  MetaPage meta;
+  deque<pageptr_t> freeList;
+  vector<pageptr_t> listPages; // pages of free list chain on disk
+  mutex poolLock; // poolLock protects everything above
+
+  byte* frameBytes(size_t frame) { return frameData.data() + frame * pageSize; }
+
+  void touch(size_t frame) {
+    Frame& f = frames[frame];
+    for (size_t i = LRU_K - 1; i > 0; i--) {
+      f.lastAccess[i] = f.lastAccess[i - 1];
+    }
+    f.lastAccess[0] = ++accessClock;
+  }
+
+  void readPage(pageptr_t id, byte* to);
+  void writePage(pageptr_t id, const byte* from);
+
+  size_t findVictim();
+  size_t fetchFrame(pageptr_t id); // pinned, called under poolLock
+  void unpin(size_t frame);
+
+  void replayLog(const path& dbPath);
+  void loadFreeList();
+  void loadFreeMap();
+  void syncFreeList();
+
+  void putPage(pageptr_t id, const Page& page); // overwrites page in place
+  pageptr_t placeNode(pageptr_t reuseId, const Page& page); // reuseId 0 means new page
+  vector<pair<vector<byte>, pageptr_t>> convertNode(pageptr_t id);
+  vector<pair<vector<byte>, pageptr_t>> packInternal(const vector<pair<vector<byte>, pageptr_t>>& children, pageptr_t reuseId);
+ public:
+  // pins page in its frame, page returned by getPage() points into the frame until unpinned
+  class PinnedPage {
+   private:
+    BufferPoolPager* pool;
+    size_t frame;
+   public:
+    PinnedPage(BufferPoolPager* pool, size_t frame): pool(pool), frame(frame) {}
+
+    PinnedPage(const PinnedPage&) = delete;
+    PinnedPage& operator=(const PinnedPage&) = delete;
+    PinnedPage(PinnedPage&& other): pool(other.pool), frame(other.frame) { other.pool = nullptr; }
+    ~PinnedPage() {
+      if (pool != nullptr) {
+        pool->unpin(frame);
+      }
+    }
+
+    Page getPage();
+  };
+
+  PinnedPage pin(pageptr_t id);
+
+  Page getPage(pageptr_t id) override;
+  pageptr_t addPage(const Page& page) override;
+  void delPage(pageptr_t id) override;
+  pageptr_t updatePage(pageptr_t id, const Page& page) override; // always in place, there are no snapshots
+
+  void saveMetaPage(const MetaPage& metaPage) override;
+  MetaPage getMetaPage() override;
+
+  // writes dirty frames, free list and meta page, then fsync
+  void flush();
+
+  // rewrites every tree of big-endian file in native layout, ids of roots stay the same
+  // (so do ids of most nodes, node is split only when its items don't fit anymore), then flushes
+  void convertToNativeLayout();
+
+  BufferPoolStats getStats();
+  size_t frameCount() { return frames.size(); }
+
+  // layout and page size are used only when file is created, existing file keeps its own
+  BufferPoolPager(path path, size_t frameCount, PageLayout layout = PageLayout::Native, size_t newPageSize = DEFAULT_PAGE_SIZE);
+
+  BufferPoolPager(const BufferPoolPager&) = delete;
+  BufferPoolPager& operator=(const BufferPoolPager&) = delete;
+  ~BufferPoolPager();
+};
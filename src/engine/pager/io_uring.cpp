@@ -0,0 +1,109 @@
+#include "./io_uring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+
+io_uring_sqe* IoUring::getSqe() {
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  unsigned tail = *sqTail + toSubmit;
+  if (tail - head >= *sqMask + 1) {
+    return nullptr;
+  }
+
+  unsigned index = tail & *sqMask;
+  io_uring_sqe* sqe = &sqes[index];
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  sqArray[index] = index;
+  toSubmit++;
+  return sqe;
+}
+
+void IoUring::submit() {
+  if (toSubmit == 0) {
+    return;
+  }
+
+  __atomic_store_n(sqTail, *sqTail + toSubmit, __ATOMIC_RELEASE);
+  unsigned submitting = toSubmit;
+  toSubmit = 0;
+  while (submitting > 0) {
+    int ret = syscall(__NR_io_uring_enter, ringFd, submitting, 0, 0, nullptr, 0);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      perror("io_uring_enter");
+      exit(errno);
+    }
+    submitting -= ret;
+  }
+}
+
+io_uring_cqe IoUring::waitCqe() {
+  while (true) {
+    unsigned head = *cqHead;
+    if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      io_uring_cqe cqe = cqes[head & *cqMask];
+      __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+      return cqe;
+    }
+
+    int ret = syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (ret < 0 && errno != EINTR) {
+      perror("io_uring_enter");
+      exit(errno);
+    }
+  }
+}
+
+IoUring::IoUring(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return;
+  }
+
+  sqRingLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+
+  sqRing = mmap(nullptr, sqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  cqRing = mmap(nullptr, cqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  void* sqesRet = mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesRet == MAP_FAILED) {
+    perror("mmap");
+    exit(errno);
+  }
+
+  uint8_t* sq = reinterpret_cast<uint8_t*>(sqRing);
+  sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sqes = reinterpret_cast<io_uring_sqe*>(sqesRet);
+
+  uint8_t* cq = reinterpret_cast<uint8_t*>(cqRing);
+  cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  ringFd = fd;
+}
+
+IoUring::~IoUring() {
+  if (ringFd < 0) {
+    return;
+  }
+
+  munmap(sqes, sqesLen);
+  munmap(cqRing, cqRingLen);
+  munmap(sqRing, sqRingLen);
+  close(ringFd);
+}
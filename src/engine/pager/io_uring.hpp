@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/io_uring.h>
+
+// minimal io_uring wrapper over raw syscalls (no liburing)
+// submissions have to be serialized by owner, completions may be reaped by one other thread meanwhile
+class IoUring {
+ private:
+  int ringFd{-1};
+
+  void* sqRing{};
+  size_t sqRingLen{};
+  unsigned* sqHead{};
+  unsigned* sqTail{};
+  unsigned* sqMask{};
+  unsigned* sqArray{};
+  io_uring_sqe* sqes{};
+  size_t sqesLen{};
+
+  void* cqRing{};
+  size_t cqRingLen{};
+  unsigned* cqHead{};
+  unsigned* cqTail{};
+  unsigned* cqMask{};
+  io_uring_cqe* cqes{};
+
+  unsigned toSubmit{};
+ public:
+  // false if kernel doesn't support io_uring (or it's forbidden), caller falls back to blocking io
+  bool available() { return ringFd >= 0; }
+
+  // zeroed entry or nullptr if submission queue is full
+  io_uring_sqe* getSqe();
+  // passes every entry taken by getSqe() to kernel
+  void submit();
+
+  // blocks until completion is available
+  io_uring_cqe waitCqe();
+
+  IoUring(unsigned entries);
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+  ~IoUring();
+};
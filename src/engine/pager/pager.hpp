@@ -1,13 +1,30 @@
 #pragma once
 
+#include <functional>
+
 #include "../page/page.hpp"
+#include "../page/meta_page.hpp"
+
+using std::function;
 
 class Pager {
  public:
-  virtual Page getPage(pageptr_t ptr) = 0; // get page by its id
+  virtual Page getPage(pageptr_t ptr) = 0; // get page by its id, may be a view (see Page::createView)
   virtual pageptr_t addPage(const Page& page) = 0; // add new page
   virtual void delPage(pageptr_t ptr) = 0; // delete page by its id
+  // replace page, returns its new id: pages nobody else can see are overwritten in place and keep their id,
+  // the rest is copied on write
+  virtual pageptr_t updatePage(pageptr_t ptr, const Page& page) {
+    delPage(ptr);
+    return addPage(page);
+  }
 
   virtual void saveMetaPage(const MetaPage& metaPage) = 0;
   virtual MetaPage getMetaPage() = 0;
+
+  // update runs against meta page as it is at commit, so writers publish roots without conflicting,
+  // pagers without transactions run it right away
+  virtual void onCommit(function<void(Pager&)> update) {
+    update(*this);
+  }
 };
\ No newline at end of file
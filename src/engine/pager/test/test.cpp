@@ -5,6 +5,7 @@
 
 #include "../../bptree/bptree.hpp"
 #include "../transactional_pager.hpp"
+#include "../buffer_pool_pager.hpp"
 
 using std::byte;
 using std::vector;
@@ -142,6 +143,467 @@ void testLeafMerge() {
   thePager.commit(txidRead);
 }
 
+void testReadViews() {
+  txid_t txidWrite = thePager.startTransaction(true, "test");
+  TransactionalPagerLocal pagerWrite = thePager.getLocal(txidWrite);
+
+  Bptree treeWrite = Bptree::createTree(pagerWrite);
+
+  vector<byte> key = generateBytes(10, byte{'v'});
+  vector<byte> value = generateBytes(20, byte{'w'});
+  treeWrite.insert(key, value);
+  assert(!pagerWrite.getPage(treeWrite.getRootId()).isView()); // pending write is served from memory
+
+  MetaPage meta = pagerWrite.getMetaPage();
+  meta.setMetaTableRoot(treeWrite.getRootId());
+  pagerWrite.saveMetaPage(meta);
+
+  thePager.commit(txidWrite);
+
+  txid_t txidRead = thePager.startTransaction(false, "test");
+  auto pagerRead = thePager.getLocal(txidRead);
+
+  auto treeRead = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+  Page root = pagerRead.getPage(treeRead.getRootId());
+  assert(root.isView());
+
+  LeafPage leaf(root);
+  assert(leaf.countLeaf() == 1);
+  assert(leaf.getKeyLeaf(0) == key);
+  assert(leaf.getValue(0).toVector() == value);
+
+  thePager.commit(txidRead);
+}
+
+void testSnapshotIsolation() {
+  txid_t txidInsert = thePager.startTransaction(true, "test");
+  TransactionalPagerLocal pagerInsert = thePager.getLocal(txidInsert);
+
+  Bptree treeInsert = Bptree::createTree(pagerInsert);
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(10, static_cast<byte>(i));
+    auto value = generateBytes(20, byte{1});
+    treeInsert.insert(key, value);
+  }
+
+  MetaPage meta = pagerInsert.getMetaPage();
+  meta.setMetaTableRoot(treeInsert.getRootId());
+  pagerInsert.saveMetaPage(meta);
+
+  thePager.commit(txidInsert);
+
+  // reader stays open while writers of the same table commit
+  txid_t txidSnapshot = thePager.startTransaction(false, "test");
+  auto pagerSnapshot = thePager.getLocal(txidSnapshot);
+  auto treeSnapshot = Bptree(pagerSnapshot, pagerSnapshot.getMetaPage().getMetaTableRoot());
+
+  for (int round = 2; round <= 3; round++) {
+    txid_t txidUpdate = thePager.startTransaction(true, "test");
+    TransactionalPagerLocal pagerUpdate = thePager.getLocal(txidUpdate);
+
+    auto treeUpdate = Bptree(pagerUpdate, pagerUpdate.getMetaPage().getMetaTableRoot());
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      auto key = generateBytes(10, static_cast<byte>(i));
+      auto value = generateBytes(20, static_cast<byte>(round));
+      treeUpdate.insert(key, value);
+    }
+
+    meta = pagerUpdate.getMetaPage();
+    meta.setMetaTableRoot(treeUpdate.getRootId());
+    pagerUpdate.saveMetaPage(meta);
+
+    thePager.commit(txidUpdate);
+  }
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(10, static_cast<byte>(i));
+    auto result = treeSnapshot.search(key);
+    assert(result.has_value());
+    assert(result.value() == generateBytes(20, byte{1}));
+  }
+
+  thePager.commit(txidSnapshot);
+
+  txid_t txidRead = thePager.startTransaction(false, "test");
+  auto pagerRead = thePager.getLocal(txidRead);
+  auto treeRead = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(10, static_cast<byte>(i));
+    auto result = treeRead.search(key);
+    assert(result.has_value());
+    assert(result.value() == generateBytes(20, byte{3}));
+  }
+
+  thePager.commit(txidRead);
+}
+
+vector<byte> rootToBytes(pageptr_t root) {
+  vector<byte> result(sizeof(pageptr_t));
+  memcpy(result.data(), &root, sizeof(pageptr_t));
+  return result;
+}
+
+pageptr_t bytesToRoot(const vector<byte>& bytes) {
+  pageptr_t root = 0;
+  memcpy(&root, bytes.data(), sizeof(pageptr_t));
+  return root;
+}
+
+void testParallelWriters() {
+  // both transactions are open at once, before writers of different tables waited for each other
+  txid_t txidA = thePager.startTransaction(true, "a");
+  TransactionalPagerLocal pagerA = thePager.getLocal(txidA);
+  txid_t txidB = thePager.startTransaction(true, "b");
+  TransactionalPagerLocal pagerB = thePager.getLocal(txidB);
+
+  Bptree treeA = Bptree::createTree(pagerA);
+  Bptree treeB = Bptree::createTree(pagerB);
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(10, static_cast<byte>(i));
+    treeA.insert(key, generateBytes(20, byte{'a'}));
+    treeB.insert(key, generateBytes(20, byte{'b'}));
+  }
+
+  auto saveRoot = [](vector<byte> name, pageptr_t root) {
+    return [name, root](Pager& pager) {
+      Bptree directory(pager, pager.getMetaPage().getMetaTableRoot());
+      directory.insert(name, rootToBytes(root));
+      MetaPage meta = pager.getMetaPage();
+      meta.setMetaTableRoot(directory.getRootId());
+      pager.saveMetaPage(meta);
+    };
+  };
+  thePager.commit(txidA, saveRoot({byte{'a'}}, treeA.getRootId()));
+  thePager.commit(txidB, saveRoot({byte{'b'}}, treeB.getRootId()));
+
+  txid_t txidRead = thePager.startTransaction(false, "a");
+  auto pagerRead = thePager.getLocal(txidRead);
+  auto directory = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+
+  for (byte name: {byte{'a'}, byte{'b'}}) {
+    auto rootOpt = directory.search({name});
+    assert(rootOpt.has_value());
+    auto treeRead = Bptree(pagerRead, bytesToRoot(rootOpt.value()));
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      auto result = treeRead.search(generateBytes(10, static_cast<byte>(i)));
+      assert(result.has_value());
+      assert(result.value() == generateBytes(20, name));
+    }
+  }
+
+  thePager.commit(txidRead);
+
+  // meta table changed by both transactions directly, second one has to fail
+  txidA = thePager.startTransaction(true, "a");
+  txidB = thePager.startTransaction(true, "b");
+  for (txid_t txid: {txidA, txidB}) {
+    auto pager = thePager.getLocal(txid);
+    MetaPage meta = pager.getMetaPage();
+    meta.setMetaTableRoot(Bptree::createTree(pager).getRootId());
+    pager.saveMetaPage(meta);
+  }
+
+  thePager.commit(txidA);
+  bool conflict = false;
+  try {
+    thePager.commit(txidB);
+  }
+  catch (const runtime_error& e) {
+    conflict = true;
+  }
+  assert(conflict);
+}
+
+void testCommitUpdates() {
+  auto saveRoot = [](vector<byte> name, pageptr_t root) {
+    return [name, root](Pager& pager) {
+      Bptree directory(pager, pager.getMetaPage().getMetaTableRoot());
+      directory.insert(name, rootToBytes(root));
+      MetaPage meta = pager.getMetaPage();
+      meta.setMetaTableRoot(directory.getRootId());
+      pager.saveMetaPage(meta);
+    };
+  };
+
+  // root registered while writing is published by plain commit
+  txid_t txidC = thePager.startTransaction(true, "c");
+  TransactionalPagerLocal pagerC = thePager.getLocal(txidC);
+  Bptree treeC = Bptree::createTree(pagerC);
+  treeC.insert(generateBytes(10), generateBytes(20, byte{'c'}));
+  pagerC.onCommit(saveRoot({byte{'c'}}, treeC.getRootId()));
+  thePager.commit(txidC);
+
+  // meta table changed by transaction directly survives updateMeta of its commit
+  txid_t txidD = thePager.startTransaction(true, "__meta");
+  TransactionalPagerLocal pagerD = thePager.getLocal(txidD);
+  Bptree directoryD(pagerD, pagerD.getMetaPage().getMetaTableRoot());
+  directoryD.insert({byte{'d'}}, rootToBytes(treeC.getRootId()));
+  MetaPage metaD = pagerD.getMetaPage();
+  metaD.setMetaTableRoot(directoryD.getRootId());
+  pagerD.saveMetaPage(metaD);
+  thePager.commit(txidD, saveRoot({byte{'e'}}, treeC.getRootId()));
+
+  txid_t txidRead = thePager.startTransaction(false, "c");
+  auto pagerRead = thePager.getLocal(txidRead);
+  auto directory = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+  for (byte name: {byte{'c'}, byte{'d'}, byte{'e'}}) {
+    auto rootOpt = directory.search({name});
+    assert(rootOpt.has_value());
+    auto treeRead = Bptree(pagerRead, bytesToRoot(rootOpt.value()));
+    assert(treeRead.search(generateBytes(10)).value() == generateBytes(20, byte{'c'}));
+  }
+  thePager.commit(txidRead);
+}
+
+void testMappingGrowth() {
+  txid_t txidRead = thePager.startTransaction(false, "test");
+  auto pagerRead = thePager.getLocal(txidRead);
+  pageptr_t rootId = pagerRead.getMetaPage().getMetaTableRoot();
+  Page rootPage = pagerRead.getPage(rootId);
+  Page rootCopy = rootPage;
+  rootCopy.materialize();
+
+  // forces file to grow several times while view is held
+  txid_t txidInsert = thePager.startTransaction(true, "growth");
+  TransactionalPagerLocal pagerInsert = thePager.getLocal(txidInsert);
+  Bptree treeInsert = Bptree::createTree(pagerInsert);
+  for (int i = 0; i < NUM_LARGE_INSERTS * 100; ++i) {
+    auto key = generateBytes(LARGE_KEY_SIZE);
+    key[0] = static_cast<byte>(i / 256);
+    key[1] = static_cast<byte>(i % 256);
+    treeInsert.insert(key, generateBytes(LARGE_VALUE_SIZE, static_cast<byte>(i)));
+  }
+  thePager.commit(txidInsert);
+
+  assert(rootPage.isView());
+  assert(rootPage.byteSize() == rootCopy.byteSize());
+  assert(rootPage.getPageType() == rootCopy.getPageType());
+
+  thePager.commit(txidRead);
+}
+
+void testWalRecovery() {
+  std::filesystem::remove("./wal_test.db");
+  std::filesystem::remove("./wal_test.db-wal");
+
+  // never destroyed, so no checkpoint happens and committed data lives only in log
+  TransactionalPager* crashedPager = new TransactionalPager("./wal_test.db");
+
+  txid_t txidWrite = crashedPager->startTransaction(true, "test");
+  TransactionalPagerLocal pagerWrite = crashedPager->getLocal(txidWrite);
+
+  Bptree treeWrite = Bptree::createTree(pagerWrite);
+
+  for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+    auto key = generateBytes(10, static_cast<byte>(i));
+    auto value = generateBytes(20, static_cast<byte>(i + 100));
+    treeWrite.insert(key, value);
+  }
+
+  MetaPage meta = pagerWrite.getMetaPage();
+  meta.setMetaTableRoot(treeWrite.getRootId());
+  pagerWrite.saveMetaPage(meta);
+
+  crashedPager->commit(txidWrite);
+
+  {
+    TransactionalPager recoveredPager("./wal_test.db");
+
+    txid_t txidRead = recoveredPager.startTransaction(false, "test");
+    auto pagerRead = recoveredPager.getLocal(txidRead);
+
+    auto treeRead = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      auto key = generateBytes(10, static_cast<byte>(i));
+      auto result = treeRead.search(key);
+      assert(result.has_value());
+      assert(result.value() == generateBytes(20, static_cast<byte>(i + 100)));
+    }
+
+    recoveredPager.commit(txidRead);
+  }
+
+  std::filesystem::remove("./wal_test.db");
+  std::filesystem::remove("./wal_test.db-wal");
+}
+
+void testAsyncCommit() {
+  std::filesystem::remove("./async_test.db");
+  std::filesystem::remove("./async_test.db-wal");
+
+  // never destroyed, so only durable commits survive
+  TransactionalPager* crashedPager = new TransactionalPager("./async_test.db");
+
+  vector<future<void>> durable;
+  for (int round = 0; round < 10; round++) {
+    txid_t txidWrite = crashedPager->startTransaction(true, "test");
+    TransactionalPagerLocal pagerWrite = crashedPager->getLocal(txidWrite);
+
+    pageptr_t rootId = pagerWrite.getMetaPage().getMetaTableRoot();
+    Bptree treeWrite = rootId == 0 ? Bptree::createTree(pagerWrite) : Bptree(pagerWrite, rootId);
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      auto key = generateBytes(10, static_cast<byte>(i));
+      treeWrite.insert(key, generateBytes(20, static_cast<byte>(round)));
+    }
+
+    MetaPage meta = pagerWrite.getMetaPage();
+    meta.setMetaTableRoot(treeWrite.getRootId());
+    pagerWrite.saveMetaPage(meta);
+
+    durable.push_back(crashedPager->commitAsync(txidWrite));
+  }
+
+  // visible before it's durable
+  txid_t txidRead = crashedPager->startTransaction(false, "test");
+  auto pagerRead = crashedPager->getLocal(txidRead);
+  auto treeRead = Bptree(pagerRead, pagerRead.getMetaPage().getMetaTableRoot());
+  assert(treeRead.search(generateBytes(10, byte{0})).value() == generateBytes(20, byte{9}));
+  crashedPager->commit(txidRead);
+
+  for (future<void>& done: durable) {
+    done.get();
+  }
+
+  {
+    TransactionalPager recoveredPager("./async_test.db");
+
+    txid_t txidRecovered = recoveredPager.startTransaction(false, "test");
+    auto pagerRecovered = recoveredPager.getLocal(txidRecovered);
+    auto treeRecovered = Bptree(pagerRecovered, pagerRecovered.getMetaPage().getMetaTableRoot());
+
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      auto result = treeRecovered.search(generateBytes(10, static_cast<byte>(i)));
+      assert(result.has_value());
+      assert(result.value() == generateBytes(20, byte{9}));
+    }
+
+    recoveredPager.commit(txidRecovered);
+  }
+
+  std::filesystem::remove("./async_test.db");
+  std::filesystem::remove("./async_test.db-wal");
+}
+
+void testWalShortWrites() {
+  std::filesystem::remove("./short_write_test.db-wal");
+
+  map<pageptr_t, vector<byte>> expected;
+  {
+    WriteAheadLog wal("./short_write_test.db-wal", DEFAULT_PAGE_SIZE, 1000); // every write is cut short
+    for (int round = 0; round < 10; round++) {
+      vector<vector<byte>> images;
+      vector<pair<pageptr_t, const byte*>> pages;
+      for (int i = 0; i < 3; i++) {
+        pageptr_t pageId = round * 3 + i + 1;
+        images.push_back(vector<byte>(DEFAULT_PAGE_SIZE, static_cast<byte>(pageId)));
+        expected[pageId] = images.back();
+      }
+      for (int i = 0; i < 3; i++) {
+        pages.emplace_back(round * 3 + i + 1, images[i].data());
+      }
+
+      lsn_t lsn = wal.append(pages);
+      if (round % 2 == 0) {
+        wal.flush(lsn);
+      }
+      else {
+        wal.flushAsync(lsn).get();
+      }
+      assert(wal.getFlushedLsn() >= lsn);
+    }
+  }
+
+  // rest of every write is finished by reaper, so each transaction is whole in log
+  map<pageptr_t, vector<byte>> replayed;
+  {
+    WriteAheadLog wal("./short_write_test.db-wal", DEFAULT_PAGE_SIZE);
+    wal.recover([&](pageptr_t pageId, const byte* data) {
+      replayed[pageId] = vector<byte>(data, data + DEFAULT_PAGE_SIZE);
+    });
+  }
+  assert(replayed == expected);
+
+  std::filesystem::remove("./short_write_test.db-wal");
+}
+
+void testBufferPool() {
+  std::filesystem::remove("./buffer_pool_test.db");
+
+  {
+    BufferPoolPager pool("./buffer_pool_test.db", 8);
+    Bptree tree = Bptree::createTree(pool);
+
+    for (int i = 0; i < NUM_LARGE_INSERTS * 20; ++i) {
+      auto key = generateBytes(LARGE_KEY_SIZE / 8, static_cast<byte>(i));
+      key[0] = static_cast<byte>(i / 256);
+      tree.insert(key, generateBytes(LARGE_VALUE_SIZE / 8, static_cast<byte>(i)));
+    }
+
+    MetaPage meta = pool.getMetaPage();
+    meta.setMetaTableRoot(tree.getRootId());
+    pool.saveMetaPage(meta);
+
+    BufferPoolStats stats = pool.getStats();
+    assert(stats.evictions > 0);
+    assert(stats.writebacks > 0);
+    assert(stats.hits > 0);
+  }
+
+  {
+    BufferPoolPager pool("./buffer_pool_test.db", 8);
+    Bptree tree(pool, pool.getMetaPage().getMetaTableRoot());
+
+    for (int i = 0; i < NUM_LARGE_INSERTS * 20; ++i) {
+      auto key = generateBytes(LARGE_KEY_SIZE / 8, static_cast<byte>(i));
+      key[0] = static_cast<byte>(i / 256);
+      auto result = tree.search(key);
+      assert(result.has_value());
+      assert(result.value() == generateBytes(LARGE_VALUE_SIZE / 8, static_cast<byte>(i)));
+    }
+
+    assert(pool.getStats().misses > 0);
+  }
+
+  std::filesystem::remove("./buffer_pool_test.db");
+}
+
+void testBufferPoolScanResistance() {
+  std::filesystem::remove("./buffer_pool_test.db");
+
+  {
+    BufferPoolPager pool("./buffer_pool_test.db", 4);
+
+    vector<pageptr_t> pages;
+    for (int i = 0; i < 8; i++) {
+      pages.push_back(pool.addPage(Page::createLeaf()));
+    }
+
+    // hot page is touched twice, scan touches every other page once
+    pool.getPage(pages[0]);
+    pool.getPage(pages[0]);
+    for (int i = 1; i < 8; i++) {
+      pool.getPage(pages[i]);
+    }
+
+    uint64_t misses = pool.getStats().misses;
+    pool.getPage(pages[0]);
+    assert(pool.getStats().misses == misses);
+
+    // pinned frame is never evicted
+    auto pinned = pool.pin(pages[1]);
+    for (int i = 2; i < 8; i++) {
+      pool.getPage(pages[i]);
+    }
+    assert(pinned.getPage().isView());
+    assert(pinned.getPage().getPageType() == PageType::Leaf);
+  }
+
+  std::filesystem::remove("./buffer_pool_test.db");
+}
+
 // void testBptreeIterator() {
 //   MockPager pager;
 //   initBptree(pager);
@@ -169,10 +631,588 @@ void testLeafMerge() {
 // }
 
 
+// inserts keys in one transaction and removes them in the next one, so every round frees what it wrote
+void churnTree(TransactionalPager& pager, int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    for (bool inserting: {true, false}) {
+      txid_t txid = pager.startTransaction(true, "test");
+      TransactionalPagerLocal local = pager.getLocal(txid);
+
+      MetaPage meta = local.getMetaPage();
+      Bptree tree = meta.getMetaTableRoot() == 0 ? Bptree::createTree(local) : Bptree(local, meta.getMetaTableRoot());
+      for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+        auto key = generateBytes(10, static_cast<byte>(i));
+        key[0] = byte{1};
+        key[1] = static_cast<byte>(i);
+        if (inserting) {
+          tree.insert(key, generateBytes(200, static_cast<byte>(round)));
+        }
+        else {
+          tree.remove(key);
+        }
+      }
+
+      meta.setMetaTableRoot(tree.getRootId());
+      local.saveMetaPage(meta);
+      pager.commit(txid);
+    }
+  }
+}
+
+void testFreeMap() {
+  std::filesystem::remove("./freemap_test.db");
+  std::filesystem::remove("./freemap_test.db-wal");
+
+  pageptr_t grownSize = 0;
+  {
+    TransactionalPager pager("./freemap_test.db");
+    churnTree(pager, 5);
+    grownSize = pager.getLocal(pager.startTransaction(false, "test")).getMetaPage().getCursize();
+  }
+
+  // free pages are found again after reopen, file stops growing
+  for (int reopen = 0; reopen < 3; ++reopen) {
+    TransactionalPager pager("./freemap_test.db");
+    churnTree(pager, 5);
+  }
+
+  // buffer pool reads free map and writes file back with free list chain
+  {
+    BufferPoolPager pool("./freemap_test.db", 8);
+    assert(pool.getMetaPage().getCursize() <= grownSize + 2);
+  }
+
+  // chain is converted to free map again
+  {
+    TransactionalPager pager("./freemap_test.db");
+    churnTree(pager, 5);
+  }
+
+  {
+    TransactionalPager pager("./freemap_test.db");
+    txid_t txid = pager.startTransaction(false, "test");
+    MetaPage meta = pager.getLocal(txid).getMetaPage();
+    assert(meta.hasFreeMap());
+    assert(meta.getFreeMapCount() > 0);
+    assert(meta.getCursize() <= grownSize + 4);
+    pager.commit(txid);
+  }
+
+  std::filesystem::remove("./freemap_test.db");
+  std::filesystem::remove("./freemap_test.db-wal");
+}
+
+void testLayoutConversion() {
+  std::filesystem::remove("./layout_test.db");
+  std::filesystem::remove("./layout_test.db-wal");
+
+  map<vector<byte>, vector<byte>> expected;
+  map<vector<byte>, vector<byte>> fullExpected;
+  pageptr_t fullRootId = 0;
+  auto keyOf = [](int i) {
+    return vector<byte>{static_cast<byte>(i / 256), static_cast<byte>(i % 256), static_cast<byte>(i % 7)};
+  };
+
+  {
+    BufferPoolPager pool("./layout_test.db", 64, PageLayout::BigEndian);
+    Bptree tree = Bptree::createTree(pool);
+    for (int i = 0; i < NUM_SMALL_INSERTS * 30; ++i) {
+      auto value = generateBytes(i % 50 == 0 ? LARGE_VALUE_SIZE * 2 : 4, static_cast<byte>(i)); // some go to overflow pages
+      tree.insert(keyOf(i), value);
+      expected[keyOf(i)] = value;
+    }
+
+    MetaPage meta = pool.getMetaPage();
+    meta.setMetaTableRoot(tree.getRootId());
+    pool.saveMetaPage(meta);
+
+    // full leaf doesn't fit into one page of native layout
+    Page page = Page::createLeaf(PageLayout::BigEndian);
+    LeafPage<BigEndianLayout> leaf(page);
+    for (int i = 0; leaf.putLeaf(vector<byte>{byte{0xff}, static_cast<byte>(i / 256), static_cast<byte>(i % 256)}, generateBytes(4, static_cast<byte>(i))); ++i) {
+      fullExpected[vector<byte>{byte{0xff}, static_cast<byte>(i / 256), static_cast<byte>(i % 256)}] = generateBytes(4, static_cast<byte>(i));
+    }
+    fullRootId = pool.addPage(page);
+  }
+
+  // old files are still read and written as they are
+  {
+    TransactionalPager pager("./layout_test.db");
+    txid_t txid = pager.startTransaction(true, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    MetaPage meta = local.getMetaPage();
+    assert(meta.getLayout() == PageLayout::BigEndian);
+
+    Bptree tree(local, meta.getMetaTableRoot());
+    for (int i = 0; i < NUM_SMALL_INSERTS * 30; i += 3) {
+      tree.remove(keyOf(i));
+      expected.erase(keyOf(i));
+    }
+    meta.setMetaTableRoot(tree.getRootId());
+    local.saveMetaPage(meta);
+    pager.commit(txid);
+  }
+
+  pageptr_t rootId = 0;
+  {
+    BufferPoolPager pool("./layout_test.db", 64);
+    rootId = pool.getMetaPage().getMetaTableRoot();
+    pool.convertToNativeLayout();
+    assert(pool.getMetaPage().getLayout() == PageLayout::Native);
+  }
+
+  {
+    TransactionalPager pager("./layout_test.db");
+    txid_t txid = pager.startTransaction(true, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    MetaPage meta = local.getMetaPage();
+    assert(meta.getLayout() == PageLayout::Native);
+    assert(meta.getMetaTableRoot() == rootId);
+
+    Bptree tree(local, meta.getMetaTableRoot());
+    auto it = expected.begin();
+    for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+      assert(it != expected.end());
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == expected.end());
+
+    tree.insert(keyOf(0), generateBytes(4));
+    assert(tree.search(keyOf(0)) == generateBytes(4));
+
+    assert(local.getPage(fullRootId).getPageType() == PageType::Internal); // root is split, id is kept
+    Bptree fullTree(local, fullRootId);
+    it = fullExpected.begin();
+    for (BptreeIterator items = fullTree.iterate(); items.hasNext(); ++it) {
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == fullExpected.end());
+    pager.commit(txid);
+  }
+
+  // unknown layout value is not read as big-endian
+  bool thrown = false;
+  try {
+    withLayout(static_cast<PageLayout>(0x3), DEFAULT_PAGE_SIZE, [](auto layout) { return layout.pageSize; });
+  }
+  catch (const runtime_error&) {
+    thrown = true;
+  }
+  assert(thrown);
+
+  std::filesystem::remove("./layout_test.db");
+  std::filesystem::remove("./layout_test.db-wal");
+}
+
+void testBufferPoolLogReplay() {
+  std::filesystem::remove("./replay_test.db");
+  std::filesystem::remove("./replay_test.db-wal");
+
+  map<vector<byte>, vector<byte>> expected;
+  auto keyOf = [](int i) {
+    return vector<byte>{static_cast<byte>(i / 256), static_cast<byte>(i % 256)};
+  };
+
+  {
+    BufferPoolPager pool("./replay_test.db", 64, PageLayout::BigEndian);
+    Bptree tree = Bptree::createTree(pool);
+    for (int i = 0; i < NUM_SMALL_INSERTS * 10; ++i) {
+      tree.insert(keyOf(i), generateBytes(20, static_cast<byte>(i)));
+      expected[keyOf(i)] = generateBytes(20, static_cast<byte>(i));
+    }
+    MetaPage meta = pool.getMetaPage();
+    meta.setMetaTableRoot(tree.getRootId());
+    pool.saveMetaPage(meta);
+  }
+
+  // never destroyed, so the commit lives only in log
+  TransactionalPager* crashedPager = new TransactionalPager("./replay_test.db");
+  txid_t txidWrite = crashedPager->startTransaction(true, "test");
+  TransactionalPagerLocal pagerWrite = crashedPager->getLocal(txidWrite);
+  MetaPage meta = pagerWrite.getMetaPage();
+  Bptree treeWrite(pagerWrite, meta.getMetaTableRoot());
+  for (int i = 0; i < NUM_SMALL_INSERTS * 10; i += 3) {
+    treeWrite.remove(keyOf(i));
+    expected.erase(keyOf(i));
+  }
+  meta.setMetaTableRoot(treeWrite.getRootId());
+  pagerWrite.saveMetaPage(meta);
+  crashedPager->commit(txidWrite);
+  assert(std::filesystem::file_size("./replay_test.db-wal") > 0);
+
+  // converter works on committed state, stale big-endian images are not replayed over it later
+  {
+    BufferPoolPager pool("./replay_test.db", 64);
+    assert(std::filesystem::file_size("./replay_test.db-wal") == 0);
+    pool.convertToNativeLayout();
+  }
+
+  {
+    TransactionalPager pager("./replay_test.db");
+    txid_t txid = pager.startTransaction(false, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    assert(local.getMetaPage().getLayout() == PageLayout::Native);
+    Bptree tree(local, local.getMetaPage().getMetaTableRoot());
+    auto it = expected.begin();
+    for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+      assert(it != expected.end());
+      auto [key, value] = items.next();
+      assert(key == it->first);
+      assert(value == it->second);
+    }
+    assert(it == expected.end());
+    pager.commit(txid);
+  }
+
+  std::filesystem::remove("./replay_test.db");
+  std::filesystem::remove("./replay_test.db-wal");
+}
+
+void testPageSizes() {
+  for (size_t pageSize: {(size_t) 16384, (size_t) MAX_PAGE_SIZE}) {
+    std::filesystem::remove("./page_size_test.db");
+    std::filesystem::remove("./page_size_test.db-wal");
+
+    map<vector<byte>, vector<byte>> expected;
+    {
+      TransactionalPager pager("./page_size_test.db", pageSize);
+      txid_t txid = pager.startTransaction(true, "test");
+      TransactionalPagerLocal local = pager.getLocal(txid);
+      Bptree tree = Bptree::createTree(local);
+      for (int i = 0; i < NUM_SMALL_INSERTS * 20; ++i) {
+        auto key = generateBytes(8, static_cast<byte>(i));
+        key[0] = static_cast<byte>(i / 256);
+        key[1] = static_cast<byte>(i % 256);
+        auto value = generateBytes(i % 100 == 0 ? pageSize : 100, static_cast<byte>(i)); // some go to overflow pages
+        tree.insert(key, value);
+        expected[key] = value;
+      }
+
+      assert(Page::createFreeMap(pageSize).byteSize() == pageSize); // 64K doesn't fit in size field, it's kept as 0
+
+      MetaPage meta = local.getMetaPage();
+      meta.setMetaTableRoot(tree.getRootId());
+      local.saveMetaPage(meta);
+      pager.commit(txid);
+    }
+
+    // page size is taken from the file, not from argument
+    {
+      TransactionalPager pager("./page_size_test.db");
+      txid_t txid = pager.startTransaction(true, "test");
+      TransactionalPagerLocal local = pager.getLocal(txid);
+      MetaPage meta = local.getMetaPage();
+      assert(meta.getPageSize() == pageSize);
+
+      Bptree tree(local, meta.getMetaTableRoot());
+      for (auto& [key, value]: expected) {
+        assert(tree.search(key) == value);
+      }
+      for (int i = 0; i < NUM_SMALL_INSERTS * 20; i += 2) {
+        auto key = generateBytes(8, static_cast<byte>(i));
+        key[0] = static_cast<byte>(i / 256);
+        key[1] = static_cast<byte>(i % 256);
+        tree.remove(key);
+        expected.erase(key);
+      }
+      meta.setMetaTableRoot(tree.getRootId());
+      local.saveMetaPage(meta);
+      pager.commit(txid);
+    }
+
+    {
+      BufferPoolPager pool("./page_size_test.db", 8);
+      assert(pool.getMetaPage().getPageSize() == pageSize);
+      Bptree tree(pool, pool.getMetaPage().getMetaTableRoot());
+      auto it = expected.begin();
+      for (BptreeIterator items = tree.iterate(); items.hasNext(); ++it) {
+        assert(it != expected.end());
+        auto [key, value] = items.next();
+        assert(key == it->first);
+        assert(value == it->second);
+      }
+      assert(it == expected.end());
+    }
+  }
+
+  std::filesystem::remove("./page_size_test.db");
+  std::filesystem::remove("./page_size_test.db-wal");
+}
+
+void testInPlaceUpdates() {
+  std::filesystem::remove("./in_place_test.db");
+  std::filesystem::remove("./in_place_test.db-wal");
+
+  TransactionalPager pager("./in_place_test.db");
+  pageptr_t rootId = 0;
+  {
+    txid_t txid = pager.startTransaction(true, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    Bptree tree = Bptree::createTree(local);
+    rootId = tree.getRootId();
+    for (int i = 0; i < NUM_SMALL_INSERTS; ++i) {
+      tree.insert(generateBytes(8, static_cast<byte>(i)), generateBytes(100, static_cast<byte>(i)));
+    }
+    assert(tree.getRootId() != rootId); // split
+    rootId = tree.getRootId();
+    tree.insert(generateBytes(8, byte{1}), generateBytes(10)); // pages of transaction keep their ids
+    tree.remove(generateBytes(8, byte{2}));
+    assert(tree.getRootId() == rootId);
+
+    MetaPage meta = local.getMetaPage();
+    meta.setMetaTableRoot(rootId);
+    local.saveMetaPage(meta);
+    pager.commit(txid);
+  }
+
+  {
+    txid_t txid = pager.startTransaction(true, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    Bptree tree(local, rootId);
+    tree.remove(generateBytes(8, byte{'z'})); // missing key copies nothing
+    assert(tree.getRootId() == rootId);
+
+    tree.insert(generateBytes(8, byte{1}), generateBytes(20)); // committed path is copied once
+    pageptr_t copiedId = tree.getRootId();
+    assert(copiedId != rootId);
+    tree.insert(generateBytes(8, byte{3}), generateBytes(20));
+    tree.remove(generateBytes(8, byte{4}));
+    assert(tree.getRootId() == copiedId);
+
+    assert(tree.search(generateBytes(8, byte{1})) == generateBytes(20));
+    assert(!tree.search(generateBytes(8, byte{2})).has_value());
+    assert(tree.search(generateBytes(8, byte{5})) == generateBytes(100, byte{5}));
+    pager.rollback(txid);
+  }
+
+  // snapshot of committed tree is not disturbed by rolled back writer
+  {
+    txid_t txid = pager.startTransaction(false, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    Bptree tree(local, local.getMetaPage().getMetaTableRoot());
+    assert(tree.search(generateBytes(8, byte{1})) == generateBytes(10));
+    assert(tree.search(generateBytes(8, byte{3})) == generateBytes(100, byte{3}));
+    assert(tree.search(generateBytes(8, byte{4})) == generateBytes(100, byte{4}));
+    pager.commit(txid);
+  }
+
+  std::filesystem::remove("./in_place_test.db");
+  std::filesystem::remove("./in_place_test.db-wal");
+}
+
+// every key is checked against its position in expected: rank, at() and count of the range from the previous key
+void checkOrderStatistics(Bptree& tree, const map<vector<byte>, vector<byte>>& expected) {
+  assert(tree.count() == expected.size());
+  uint64_t index = 0;
+  vector<byte> prevKey;
+  for (auto& [key, value]: expected) {
+    assert(tree.rank(key) == index);
+    BptreeCursor cursor = tree.at(index);
+    assert(cursor.valid());
+    assert(cursor.key().toVector() == key);
+    assert(cursor.value().toVector() == value);
+    if (index > 0) {
+      assert(tree.countRange(prevKey, key) == 1);
+    }
+    prevKey = key;
+    index++;
+  }
+  assert(!tree.at(index).valid());
+}
+
+void testOrderStatistics() {
+  std::filesystem::remove("./counted_test.db");
+  std::filesystem::remove("./counted_test.db-wal");
+  std::filesystem::remove("./counted_pool_test.db");
+
+  // long keys with short separators, so the tree is three levels deep
+  auto keyOf = [](int seq) {
+    vector<byte> key = generateBytes(64, static_cast<byte>(seq));
+    key[0] = static_cast<byte>(seq / 256);
+    key[1] = static_cast<byte>(seq % 256);
+    return key;
+  };
+  map<vector<byte>, vector<byte>> expected;
+
+  {
+    TransactionalPager pager("./counted_test.db", DEFAULT_PAGE_SIZE, PageLayout::NativeCounted);
+    pageptr_t rootId = 0;
+    // pages of the running transaction are changed in place, committed ones are copied
+    for (int round = 0; round < 4; ++round) {
+      txid_t txid = pager.startTransaction(true, "test");
+      TransactionalPagerLocal local = pager.getLocal(txid);
+      Bptree tree = round == 0 ? Bptree::createTree(local) : Bptree(local, rootId);
+      for (int i = round * 1500; i < (round + 1) * 1500; ++i) {
+        int seq = (i * 7919) % 6000; // unsorted
+        auto value = generateBytes(seq % 1000 == 0 ? LARGE_VALUE_SIZE * 4 : 10, static_cast<byte>(i)); // some go to overflow pages
+        tree.insert(keyOf(seq), value);
+        expected[keyOf(seq)] = value;
+      }
+      tree.insert(keyOf(5), generateBytes(20)); // replaced value doesn't change counts
+      expected[keyOf(5)] = generateBytes(20);
+      rootId = tree.getRootId();
+
+      MetaPage meta = local.getMetaPage();
+      meta.setMetaTableRoot(rootId);
+      local.saveMetaPage(meta);
+      pager.commit(txid);
+    }
+
+    txid_t txid = pager.startTransaction(true, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    Bptree tree(local, rootId);
+    checkOrderStatistics(tree, expected);
+
+    // leaves and internal pages are merged, batch and range removal keep counts too
+    for (int seq = 0; seq < 6000; seq += 6) {
+      tree.remove(keyOf(seq));
+      expected.erase(keyOf(seq));
+    }
+    tree.remove(keyOf(9000)); // missing key
+    vector<pair<vector<byte>, vector<byte>>> batch;
+    for (int seq = 6000; seq < 8000; ++seq) {
+      batch.emplace_back(keyOf(seq), generateBytes(10, static_cast<byte>(seq)));
+      expected[keyOf(seq)] = generateBytes(10, static_cast<byte>(seq));
+    }
+    batch.emplace_back(keyOf(1), generateBytes(30)); // existing key
+    expected[keyOf(1)] = generateBytes(30);
+    tree.insertBatch(batch);
+    tree.removeRange(keyOf(1000), keyOf(3500));
+    expected.erase(expected.lower_bound(keyOf(1000)), expected.lower_bound(keyOf(3500)));
+    checkOrderStatistics(tree, expected);
+
+    assert(tree.countRange(keyOf(1000), keyOf(3500)) == 0);
+    assert(tree.countRange(keyOf(3500), keyOf(1000)) == 0);
+    assert(tree.countRange(keyOf(6000), keyOf(8000)) == 2000);
+    // OFFSET from a lower bound, up to an upper bound
+    BptreeCursor cursor = tree.at(tree.rank(keyOf(6000)) + 1990, keyOf(7995));
+    for (int seq = 7990; seq < 7995; ++seq) {
+      assert(cursor.valid() && cursor.key().toVector() == keyOf(seq));
+      cursor.next();
+    }
+    assert(!cursor.valid());
+
+    MetaPage meta = local.getMetaPage();
+    meta.setMetaTableRoot(tree.getRootId());
+    local.saveMetaPage(meta);
+    pager.commit(txid);
+  }
+
+  // layout is kept by the file
+  {
+    TransactionalPager pager("./counted_test.db");
+    txid_t txid = pager.startTransaction(false, "test");
+    TransactionalPagerLocal local = pager.getLocal(txid);
+    Bptree tree(local, local.getMetaPage().getMetaTableRoot());
+    assert(tree.count() == expected.size());
+    pager.commit(txid);
+  }
+
+  // bulk loaded tree has counts as well, and so does the tree everything was removed from
+  {
+    BufferPoolPager pool("./counted_pool_test.db", 64, PageLayout::NativeCounted);
+    BptreeBuilder builder(pool, 0.7);
+    for (auto& [key, value]: expected) {
+      builder.add(key, value);
+    }
+    Bptree tree = builder.finish();
+    checkOrderStatistics(tree, expected);
+
+    tree.removeRange(vector<byte>(2, byte{0}), keyOf(20000)); // proper prefix of a key is greater than the key
+    assert(tree.count() == 0);
+    assert(!tree.at(0).valid());
+  }
+
+  // files of other layouts have no counts
+  txid_t txid = thePager.startTransaction(false, "test");
+  TransactionalPagerLocal local = thePager.getLocal(txid);
+  Bptree plain(local, local.getMetaPage().getMetaTableRoot());
+  bool thrown = false;
+  try {
+    plain.count();
+  }
+  catch (std::runtime_error&) {
+    thrown = true;
+  }
+  assert(thrown);
+  thePager.commit(txid);
+
+  std::filesystem::remove("./counted_test.db");
+  std::filesystem::remove("./counted_test.db-wal");
+  std::filesystem::remove("./counted_pool_test.db");
+}
+
+void testUnknownFormat() {
+  std::filesystem::remove("./format_test.db");
+  std::filesystem::remove("./format_test.db-wal");
+
+  // counted files get versions of their own
+  {
+    TransactionalPager pager("./format_test.db", DEFAULT_PAGE_SIZE, PageLayout::NativeCounted);
+    txid_t txid = pager.startTransaction(false, "test");
+    assert(pager.getLocal(txid).getMetaPage().getVersion() == 4);
+    pager.commit(txid);
+  }
+  {
+    BufferPoolPager pool("./format_test.db", 8);
+    assert(pool.getMetaPage().getVersion() == 3);
+  }
+
+  // version and layout fields are the 3rd and 4th bytes of the file, newer values are refused by both pagers
+  vector<byte> versionField(2);
+  int fd = open("./format_test.db", O_RDWR);
+  assert(pread(fd, versionField.data(), 2, 2) == 2);
+  vector<byte> newerVersion = {versionField[0], static_cast<byte>(META_VERSION + 1)};
+  vector<byte> newerLayout = {versionField[0] | byte{0x0f}, versionField[1]};
+  for (auto& field: {newerVersion, newerLayout}) {
+    assert(pwrite(fd, field.data(), 2, 2) == 2);
+    for (int pager = 0; pager < 2; ++pager) {
+      bool thrown = false;
+      try {
+        if (pager == 0) {
+          TransactionalPager refused("./format_test.db");
+        }
+        else {
+          BufferPoolPager refused("./format_test.db", 8);
+        }
+      }
+      catch (const runtime_error&) {
+        thrown = true;
+      }
+      assert(thrown);
+    }
+  }
+  close(fd);
+
+  std::filesystem::remove("./format_test.db");
+  std::filesystem::remove("./format_test.db-wal");
+}
+
 int main() {
   RUN_TEST(testInsertSingleElement);
   RUN_TEST(testLeafSplit);
   RUN_TEST(testLeafMerge);
+  RUN_TEST(testReadViews);
+  RUN_TEST(testSnapshotIsolation);
+  RUN_TEST(testParallelWriters);
+  RUN_TEST(testCommitUpdates);
+  RUN_TEST(testMappingGrowth);
+  RUN_TEST(testWalRecovery);
+  RUN_TEST(testAsyncCommit);
+  RUN_TEST(testWalShortWrites);
+  RUN_TEST(testFreeMap);
+  RUN_TEST(testInPlaceUpdates);
+  RUN_TEST(testBufferPool);
+  RUN_TEST(testBufferPoolScanResistance);
+  RUN_TEST(testLayoutConversion);
+  RUN_TEST(testBufferPoolLogReplay);
+  RUN_TEST(testPageSizes);
+  RUN_TEST(testOrderStatistics);
+  RUN_TEST(testUnknownFormat);
 
   cout << "All tests passed" << endl;
   return 0;
@@ -5,8 +5,12 @@
 #include <cstdio>
 
 using std::max;
+using std::unique_lock;
 
 #define EXPAND_RATE (100)
+#define MMAP_RESERVE_SIZE ((size_t) 1 << 40) // address space for the file, not backed by memory
+#define WAL_CHECKPOINT_SIZE(pageSize) (1024 * (pageSize))
+#define FREE_SLICE_SIZE (16)
 
 
 pageptr_t TransactionalPagerLocal::addPage(const Page& page) {
@@ -21,6 +25,10 @@ void TransactionalPagerLocal::delPage(pageptr_t id) {
   this->manager.delPage(id, txid);
 }
 
+pageptr_t TransactionalPagerLocal::updatePage(pageptr_t id, const Page& page) {
+  return this->manager.updatePage(id, page, txid);
+}
+
 void TransactionalPagerLocal::saveMetaPage(const MetaPage& metaPage) {
   this->manager.saveMetaPage(metaPage, txid);
 }
@@ -29,6 +37,10 @@ MetaPage TransactionalPagerLocal::getMetaPage() {
   return this->manager.getMetaPage(txid);
 };
 
+void TransactionalPagerLocal::onCommit(function<void(Pager&)> update) {
+  this->manager.onCommit(update, txid);
+}
+
 pageptr_t TransactionalPager::addPage(const Page& page, txid_t txid) {
   txLock.lock();
   if (!txInfo[txid].writeMode) {
@@ -37,28 +49,27 @@ pageptr_t TransactionalPager::addPage(const Page& page, txid_t txid) {
   }
 
   pageptr_t writeTo = findPlace(txid);
-  actions[txid].emplace_front(PageActionType::Write, writeTo, page);
+  if (writeTo == 0) {
+    txLock.unlock();
+    throw runtime_error("database file reached its size limit");
+  }
+  Page ownPage = page;
+  ownPage.materialize();
+  txInfo[txid].dirtyPages.insert_or_assign(writeTo, move(ownPage));
   txLock.unlock();
   return writeTo;
 }
 
 Page TransactionalPager::getPage(pageptr_t id, txid_t txid) {
   Page page;
-  bool foundInMem = false;
   txLock.lock();
-  if (txInfo[txid].writeMode) {
-    for (int i = actions[txid].size() - 1; i >= 0; i--) {
-      PageAction action = actions[txid][i];
-      if (action.type == PageActionType::Write && action.pageId == id) {
-        page = action.page.value();
-        foundInMem = true;
-        break;
-      }
-    }
+  TxInfo& info = txInfo[txid];
+  auto dirtyIt = info.dirtyPages.find(id);
+  if (info.writeMode && dirtyIt != info.dirtyPages.end()) {
+    page = dirtyIt->second;
   }
-
-  if (!foundInMem) {
-    page = loadPage(id);
+  else {
+    page = viewPage(id);
   }
   txLock.unlock();
 
@@ -71,108 +82,223 @@ void TransactionalPager::delPage(pageptr_t id, txid_t txid) {
     txLock.unlock();
     return;
   }
-  actions[txid].emplace_front(PageActionType::Delete, id, nullopt);
+  TxInfo& info = txInfo[txid];
+  if (info.dirtyPages.erase(id) > 0) { // never reached the file, can be reused right away
+    info.freeSlice.push_back(id);
+  }
+  else {
+    info.freedPages.push_back(id);
+  }
   txLock.unlock();
 }
 
+pageptr_t TransactionalPager::updatePage(pageptr_t id, const Page& page, txid_t txid) {
+  Page ownPage = page;
+  ownPage.materialize();
+
+  txLock.lock();
+  TxInfo& info = txInfo[txid];
+  if (!info.writeMode) {
+    txLock.unlock();
+    return 0;
+  }
+
+  auto dirtyIt = info.dirtyPages.find(id);
+  if (dirtyIt != info.dirtyPages.end()) {
+    dirtyIt->second = move(ownPage);
+    txLock.unlock();
+    return id;
+  }
+
+  pageptr_t writeTo = findPlace(txid);
+  if (writeTo == 0) {
+    txLock.unlock();
+    throw runtime_error("database file reached its size limit");
+  }
+  info.freedPages.push_back(id);
+  info.dirtyPages.insert_or_assign(writeTo, move(ownPage));
+  txLock.unlock();
+  return writeTo;
+}
+
+// transactions get pages below the limit, commit adds free map nodes on top of them,
+// so the file never outgrows the reserved address range or the free map directory of meta page
+pageptr_t TransactionalPager::pageLimit() {
+  pageptr_t filePages = min<pageptr_t>(MMAP_RESERVE_SIZE / pageSize, MAX_FREEMAP_COUNT(pageSize) * FREEMAP_BITS(pageSize));
+  return filePages - (filePages + FREEMAP_BITS(pageSize) - 1) / FREEMAP_BITS(pageSize);
+}
+
+// called under txLock
 pageptr_t TransactionalPager::findPlace(txid_t txid) {
+  deque<pageptr_t>& freeSlice = txInfo[txid].freeSlice;
+  if (freeSlice.empty() && freeList.empty()) {
+    scanFreeMap();
+  }
+  while (freeSlice.size() < FREE_SLICE_SIZE && !freeList.empty()) {
+    freeSlice.push_back(freeList.back());
+    freeList.pop_back();
+  }
+
   pageptr_t writeTo = 0;
-  if (newFreeList.empty()) {
-    writeTo = meta.getCursize() + appendNum;
-    appendNum++;
+  if (freeSlice.empty()) {
+    if (appendCursor >= pageLimit()) {
+      return 0;
+    }
+    writeTo = appendCursor;
+    appendCursor++;
   }
   else {
-    writeTo = newFreeList.back();
-    newFreeList.pop_back();
+    writeTo = freeSlice.front();
+    freeSlice.pop_front();
   }
   return writeTo;
 }
 
-void TransactionalPager::allocate(size_t appendNum) {
-  if ((meta.getCursize() + appendNum) * PAGE_SIZE > fileLen) {
-    fileLock.unlock_upgrade_and_lock();
-    // expand file
-    size_t expandLen = max((uint64_t) EXPAND_RATE * PAGE_SIZE, (uint64_t) appendNum * PAGE_SIZE);
-    ftruncate(fd, fileLen + expandLen);
-    fileLen += fileLen + expandLen;
-    munmap(mmapPtr, mmapLen);
-    mmapPtr = reinterpret_cast<byte*>(mmap(nullptr, fileLen, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0));
-    mmapLen = fileLen;
-
-    fileLock.unlock_and_lock_upgrade();
+// called under fileLock upgrade
+void TransactionalPager::allocate(pageptr_t pageCount) {
+  pageptr_t filePages = fileLen / pageSize;
+  if (pageCount > filePages) {
+    // geometric growth keeps number of expansions logarithmic in file size
+    pageptr_t expandPages = max({(pageptr_t) EXPAND_RATE, filePages / 2, pageCount - filePages});
+    growMapping(min(filePages + expandPages, (pageptr_t) (MMAP_RESERVE_SIZE / pageSize)) * pageSize);
   }
 }
 
-void TransactionalPager::syncFreeList() {
-  pageptr_t oldHeadId = meta.getFreeListHead();
-  pageptr_t oldTailId = meta.getFreeListTail();
-  if (oldHeadId != 0 && oldTailId != 0) {
-    pageptr_t oldListCurId = oldHeadId;
-    Page oldListCurPage = loadPage(oldListCurId);
-    while (oldListCurId != oldTailId) {
-      freeList.push_front(oldListCurId);
-      DeletedPage oldListCur(oldListCurPage);
-      oldListCurPage = loadPage(oldListCur.getNext());
+// called under txLock
+Page& TransactionalPager::loadFreeMap(size_t index) {
+  auto mapIt = freeMapPages.find(index);
+  if (mapIt != freeMapPages.end()) {
+    return mapIt->second;
+  }
+
+  // first touch of the node, so none of its free pages is known in memory yet
+  Page& mapPage = freeMapPages[index] = loadPage(meta.getFreeMapPage(index));
+  FreeMapPage freeMap(mapPage);
+  pageptr_t first = index * FREEMAP_BITS(pageSize);
+  pageptr_t end = min(first + FREEMAP_BITS(pageSize), meta.getCursize());
+  for (pageptr_t id = first; id < end; id++) {
+    if (freeMap.isFree(id - first)) {
+      freeList.push_back(id);
     }
   }
+  return mapPage;
+}
 
-  pageptr_t listAppendNum = (freeList.size() / MAX_DELETED_COUNT) + ((freeList.size() % MAX_DELETED_COUNT) != 0);
-  allocate(listAppendNum);
+// called under txLock, loads nodes lazily until some free page is found
+void TransactionalPager::scanFreeMap() {
+  while (freeList.empty() && freeMapScanned < meta.getFreeMapCount()) {
+    loadFreeMap(freeMapScanned);
+    freeMapScanned++;
+  }
+}
 
-  for (pageptr_t i = 0; i < listAppendNum; i++) {
-    Page page = Page::createDeleted();
-    DeletedPage newDeleted(page);
-    size_t curFreeListSize = freeList.size();
-    for (size_t j = 0; j < min((size_t) MAX_DELETED_COUNT, curFreeListSize); j++) {
-      newDeleted.putPtr(freeList[MAX_DELETED_COUNT * i + j]);
-    }
+// called under txLock
+void TransactionalPager::setFree(pageptr_t id, bool free, set<size_t>& touched) {
+  size_t index = id / FREEMAP_BITS(pageSize);
+  Page& mapPage = loadFreeMap(index);
+  FreeMapPage freeMap(mapPage);
+  freeMap.setFree(id % FREEMAP_BITS(pageSize), free);
+  touched.insert(index);
+}
 
-    if (i < listAppendNum - 1) {
-      newDeleted.setNext(meta.getCursize() + i + 1);
-    }
-    else {
-      newDeleted.setNext(0);
-    }
+// updates bits of pages changed by commit, only nodes covering them are touched
+void TransactionalPager::syncFreeMap(MetaPage& newMeta, const deque<pageptr_t>& freed, const vector<pair<pageptr_t, Page>>& writes, vector<pair<pageptr_t, Page>>& mapWrites) {
+  txLock.lock();
+  pageptr_t oldCursize = newMeta.getCursize();
 
-    writePageToMmap(newDeleted.page, meta.getCursize() + i);
+  // new nodes take pages too, capacity is checked before anything is changed
+  size_t mapCount = newMeta.getFreeMapCount();
+  for (pageptr_t pageCount = appendCursor; mapCount * FREEMAP_BITS(pageSize) < pageCount; pageCount++) {
+    mapCount++;
+  }
+  if (mapCount > MAX_FREEMAP_COUNT(pageSize)) {
+    txLock.unlock();
+    throw runtime_error("database file exceeds free map capacity");
   }
 
-  fsync(fd);
+  vector<pageptr_t> mapIds; // new nodes for pages handed out past the last one
+  while (newMeta.getFreeMapCount() * FREEMAP_BITS(pageSize) < appendCursor) {
+    pageptr_t mapId = appendCursor;
+    appendCursor++;
+    freeMapPages[newMeta.getFreeMapCount()] = Page::createFreeMap(pageSize);
+    newMeta.addFreeMapPage(mapId);
+    mapIds.push_back(mapId);
+  }
+  newMeta.setCursize(appendCursor); // covers every page handed out so far
 
-  if (listAppendNum == 0) {
-    meta.setFreeListHead(0);
-    meta.setFreeListTail(0);
+  set<size_t> touched;
+  for (pageptr_t id = oldCursize; id < newMeta.getCursize(); id++) { // free until some transaction commits them
+    setFree(id, true, touched);
   }
-  else {
-    meta.setFreeListHead(meta.getCursize());
-    meta.setFreeListTail(meta.getCursize() + listAppendNum - 1);
+  for (auto& [pageId, page]: writes) {
+    setFree(pageId, false, touched);
+  }
+  for (pageptr_t mapId: mapIds) {
+    setFree(mapId, false, touched);
+  }
+  for (pageptr_t pageId: freed) {
+    setFree(pageId, true, touched);
   }
 
-  meta.setCursize(meta.getCursize() + listAppendNum);
+  for (size_t index: touched) {
+    mapWrites.emplace_back(newMeta.getFreeMapPage(index), freeMapPages[index]);
+    dirtyFreeMap.insert(index);
+  }
+  txLock.unlock();
 }
 
-void TransactionalPager::loadFreeList() {
-  if (meta.getFreeListHead() == 0 || meta.getFreeListTail() == 0) {
-    assert(meta.getFreeListHead() == meta.getFreeListTail());
-    return;
+void TransactionalPager::reclaimFreed() {
+  lsn_t durableLsn = wal.getFlushedLsn();
+  txLock.lock();
+  epoch_t oldestEpoch = oldestSnapshot();
+  while (!pendingFree.empty() && pendingFree.front().lsn <= durableLsn && pendingFree.front().epoch <= oldestEpoch) {
+    freeList.push_front(pendingFree.front().pageId);
+    pendingFree.pop_front();
   }
+  txLock.unlock();
+}
 
-  pageptr_t freeListHead = meta.getFreeListHead();
-  pageptr_t freeListCur = freeListHead;
-  while (freeListCur != 0) {
-    Page deletedPage = loadPage(freeListCur);
+// files of version 1 (3) keep free pages in a chain of Deleted pages, it's replaced with free map once
+void TransactionalPager::convertFreeList() {
+  deque<pageptr_t> freePages;
+  pageptr_t listCur = meta.getFreeListHead();
+  while (listCur != 0) {
+    freePages.push_back(listCur);
+    Page deletedPage = loadPage(listCur);
     DeletedPage deleted(deletedPage);
     for (pagesize_t i = 0; i < deleted.getCount(); i++) {
-      freeList.push_front(deleted.getPtr(i));
-      freeListCur = deleted.getNext();
+      freePages.push_back(deleted.getPtr(i));
     }
+    listCur = deleted.getNext();
   }
+
+  meta.setFreeMap(true);
+  meta.setFreeListHead(0);
+  meta.setFreeListTail(0);
+  appendCursor = meta.getCursize();
+
+  MetaPage newMeta = meta;
+  vector<pair<pageptr_t, Page>> mapWrites;
+  syncFreeMap(newMeta, freePages, {}, mapWrites);
+
+  // free map goes past the old end of file, so old meta page stays valid until it's replaced
+  fileLock.lock_upgrade();
+  allocate(newMeta.getCursize());
+  fileLock.unlock_upgrade();
+  for (auto& [pageId, page]: mapWrites) {
+    writePageToMmap(page, pageId);
+  }
+  fsync(fd);
+
+  meta = newMeta;
+  syncMeta();
+  dirtyFreeMap.clear();
+  freeList.insert(freeList.end(), freePages.begin(), freePages.end());
 }
 
 txid_t TransactionalPager::startTransaction(bool writable, string tableId) {
   txid_t retId = 0;
   txLock.lock();
-  actions[txidSeq] = deque<PageAction>();
   txInfo[txidSeq] = TxInfo {
     writeMode: writable,
     tableId: tableId,
@@ -180,97 +306,184 @@ txid_t TransactionalPager::startTransaction(bool writable, string tableId) {
   retId = txidSeq;
   txidSeq++;
   upgrade_mutex& tableLock = tableLocks[tableId];
-  if (writable) {
-    newMeta = meta;
-    newFreeList = freeList;
-    appendNum = 0;
-  }
   txLock.unlock();
-  if (writable) {
+
+  if (writable) { // writers of one table are serialized, of different tables run in parallel
     tableLock.lock_upgrade();
-    metaLock.lock_upgrade();
-  } 
-  else {
-    tableLock.lock_shared();
-    metaLock.lock_shared();
   }
+
+  // every transaction reads from a snapshot and never waits for writers
+  txLock.lock();
+  TxInfo& info = txInfo[retId];
+  info.epoch = commitEpoch;
+  info.snapshot = meta;
+  info.baseRoot = meta.getMetaTableRoot();
+  activeSnapshots[commitEpoch]++;
+  txLock.unlock();
   
   return retId;
 }
 
 void TransactionalPager::commit(txid_t txid) {
+  commit(txid, nullptr);
+}
+
+void TransactionalPager::commit(txid_t txid, function<void(Pager&)> updateMeta) {
+  lsn_t commitLsn = commitPages(txid, updateMeta);
+  if (commitLsn != 0) {
+    // locks are released already, so writers committing meanwhile share this flush
+    wal.flush(commitLsn);
+  }
+}
+
+future<void> TransactionalPager::commitAsync(txid_t txid, function<void(Pager&)> updateMeta) {
+  lsn_t commitLsn = commitPages(txid, updateMeta);
+  if (commitLsn == 0) {
+    promise<void> done;
+    done.set_value();
+    return done.get_future();
+  }
+  return wal.flushAsync(commitLsn);
+}
+
+// publishes transaction, returns lsn that has to be flushed to make it durable (0 for readers)
+lsn_t TransactionalPager::commitPages(txid_t txid, function<void(Pager&)> updateMeta) {
   txLock.lock();
-  auto actions = this->actions[txid];
-  upgrade_mutex& tableLock = tableLocks[txInfo[txid].tableId];
   bool writeMode = txInfo[txid].writeMode;
   txLock.unlock();
 
-  if (writeMode) {
-    tableLock.unlock_upgrade_and_lock();
-    metaLock.unlock_upgrade_and_lock();
-
-    meta = newMeta;
-    freeList = newFreeList;
-    fileLock.lock_upgrade();
-    allocate(appendNum);
-
-    unordered_map<pageptr_t, PageAction> writeTable;
-    while (!actions.empty()) {
-      PageAction action = move(actions.front());
-      actions.pop_front();
-
-      switch (action.type) {
-        case PageActionType::Write: {
-          // Page page = action.page.value();
-          // writePageToMmap(page, action.pageId);
-          writeTable[action.pageId] = action;
-
-          break;
-        }
-        case PageActionType::Delete: {
-          // freeList.push_front(action.pageId);
-          if (!writeTable.contains(action.pageId) || writeTable[action.pageId].type == PageActionType::Delete) {
-            writeTable[action.pageId] = action;
-          }
-          else {
-            writeTable.erase(action.pageId);
-          }
-
-          break;
-        }
-      }
+  if (!writeMode) {
+    txLock.lock();
+    cleanTransaction(txid);
+    txLock.unlock();
+    return 0;
+  }
+
+  metaLock.lock(); // short critical section, also waits for checkpoint
+
+  txLock.lock();
+  TxInfo& info = txInfo[txid];
+  bool changedRoot = info.snapshot.getMetaTableRoot() != info.baseRoot;
+  if (changedRoot && meta.getMetaTableRoot() != info.baseRoot) { // both changed meta table
+    cleanTransaction(txid);
+    txLock.unlock();
+    metaLock.unlock();
+    throw runtime_error("meta page was changed by concurrent transaction");
+  }
+
+  vector<function<void(Pager&)>> updates = move(info.commitUpdates);
+  if (updateMeta) {
+    updates.push_back(updateMeta);
+  }
+  if (!updates.empty()) { // updates see latest committed meta page with transaction's own root change on top
+    MetaPage rebased = meta;
+    if (changedRoot) {
+      rebased.setMetaTableRoot(info.snapshot.getMetaTableRoot());
     }
-    for (auto item: writeTable) {
-      PageAction action = item.second;
-      switch (action.type) {
-        case PageActionType::Write: {
-          Page page = action.page.value();
-          writePageToMmap(page, action.pageId);
-
-          break;
-        }
-        case PageActionType::Delete: {
-          freeList.push_front(action.pageId);
-
-          break;
-        }
+    info.snapshot = rebased;
+    info.baseRoot = meta.getMetaTableRoot();
+  }
+  txLock.unlock();
+
+  if (!updates.empty()) {
+    TransactionalPagerLocal local = getLocal(txid);
+    try {
+      for (auto& update: updates) {
+        update(local);
       }
     }
+    catch (...) {
+      txLock.lock();
+      cleanTransaction(txid);
+      txLock.unlock();
+      metaLock.unlock();
+      throw;
+    }
+  }
 
-    fsync(fd);
-    meta.setCursize(meta.getCursize() + appendNum);
-    syncFreeList();
-    syncMeta();
+  txLock.lock();
+  changedRoot = info.snapshot.getMetaTableRoot() != info.baseRoot;
 
-    fileLock.unlock_upgrade();
+  unordered_map<pageptr_t, Page> dirtyPages = move(info.dirtyPages);
+  deque<pageptr_t> freedPages = move(info.freedPages);
+  info.dirtyPages.clear();
+  freeList.insert(freeList.end(), info.freeSlice.begin(), info.freeSlice.end());
+  info.freeSlice.clear();
 
-    metaLock.unlock_and_lock_upgrade();
-    tableLock.unlock_and_lock_upgrade();
+  MetaPage newMeta = meta; // free space fields are owned by pager, root by transaction
+  if (changedRoot) {
+    newMeta.setMetaTableRoot(info.snapshot.getMetaTableRoot());
   }
+  txLock.unlock();
 
-  txLock.lock();
+  reclaimFreed();
+
+  vector<pair<pageptr_t, Page>> writes;
+  for (auto& [pageId, page]: dirtyPages) {
+    sealPage(page);
+    writes.emplace_back(pageId, move(page));
+  }
+  vector<pair<pageptr_t, Page>> mapWrites;
+  try {
+    syncFreeMap(newMeta, freedPages, writes, mapWrites);
+  }
+  catch (...) { // nothing is published, pages written by transaction are free again
+    txLock.lock();
+    for (auto& [pageId, page]: writes) {
+      freeList.push_back(pageId);
+    }
+    cleanTransaction(txid);
+    txLock.unlock();
+    metaLock.unlock();
+    throw;
+  }
+  MetaPage metaImage = sealMeta(newMeta);
+
+  fileLock.lock_upgrade();
+  allocate(newMeta.getCursize());
+
+  vector<pair<pageptr_t, const byte*>> logged;
+  for (auto& [pageId, page]: writes) {
+    logged.emplace_back(pageId, page.bytes());
+  }
+  for (auto& [pageId, page]: mapWrites) {
+    logged.emplace_back(pageId, page.bytes());
+  }
+  logged.emplace_back(0, metaImage.data.data());
+  lsn_t commitLsn = wal.append(logged);
+
+  // pages go only to places no snapshot can reach, so readers are not disturbed
+  // meta page and free map are updated in place, so they reach the file only on checkpoint,
+  // until then log is the source of truth
+  for (auto& [pageId, page]: writes) {
+    writePageToMmap(page, pageId);
+  }
+
+  fileLock.unlock_upgrade();
+
+  txLock.lock(); // publish
+  meta = newMeta;
+  commitEpoch++;
+  for (pageptr_t pageId: freedPages) {
+    pendingFree.push_back(FreedPage {
+      lsn: commitLsn,
+      epoch: commitEpoch,
+      pageId: pageId,
+    });
+  }
   cleanTransaction(txid);
   txLock.unlock();
+
+  metaLock.unlock();
+
+  if (wal.size() > WAL_CHECKPOINT_SIZE(pageSize)) {
+    checkpointLock.lock();
+    checkpointRequested = true;
+    checkpointLock.unlock();
+    checkpointWake.notify_one();
+  }
+
+  return commitLsn;
 }
 
 inline void TransactionalPager::rollback(txid_t txid) {
@@ -280,19 +493,121 @@ inline void TransactionalPager::rollback(txid_t txid) {
 }
 
 inline MetaPage TransactionalPager::getMetaPage(txid_t txid) {
-  return meta;
+  txLock.lock();
+  TxInfo& info = txInfo[txid];
+  MetaPage metaPage = info.snapshot;
+  txLock.unlock();
+  return metaPage;
 }
 
 inline void TransactionalPager::saveMetaPage(const MetaPage &metaPage, txid_t txid) {
   txLock.lock();
   if (!txInfo[txid].writeMode) {
+    txLock.unlock();
+    return;
+  }
+  txInfo[txid].snapshot = metaPage;
+  txLock.unlock();
+}
+
+inline void TransactionalPager::onCommit(function<void(Pager&)> update, txid_t txid) {
+  txLock.lock();
+  if (!txInfo[txid].writeMode) {
+    txLock.unlock();
     return;
   }
-  newMeta = metaPage;
+  txInfo[txid].commitUpdates.push_back(move(update));
   txLock.unlock();
 }
 
-TransactionalPager::TransactionalPager(path path) {
+// called under fileLock upgrade, readers keep working: mapped pages never move
+void TransactionalPager::growMapping(size_t newLen) {
+  assert(newLen <= MMAP_RESERVE_SIZE && "pages past pageLimit() are never handed out");
+
+  if (ftruncate(fd, newLen) < 0) {
+    perror("ftruncate");
+    exit(errno);
+  }
+
+  // only the new tail is mapped, over the reserved range
+  void* mmapRet = mmap(mmapPtr + fileLen, newLen - fileLen, PROT_WRITE | PROT_READ, MAP_SHARED | MAP_FIXED, fd, fileLen);
+  if (mmapRet == MAP_FAILED) {
+    perror("mmap");
+    exit(errno);
+  }
+
+  fileLock.unlock_upgrade_and_lock();
+  fileLen = newLen;
+  fileLock.unlock_and_lock_upgrade();
+}
+
+void TransactionalPager::recover() {
+  fileLock.lock_upgrade();
+  wal.recover([this](pageptr_t pageId, const byte* data) {
+    allocate(pageId + 1);
+    memcpy(mmapPtr + pageId * pageSize, data, pageSize);
+  });
+  fileLock.unlock_upgrade();
+
+  fsync(fd);
+  wal.reset();
+}
+
+void TransactionalPager::checkpoint() {
+  fsync(fd); // bulk of logged pages, commits are not blocked yet
+
+  metaLock.lock_shared(); // every appended transaction is applied to the mapping now
+  wal.flushAll();
+  txLock.lock();
+  for (size_t index: dirtyFreeMap) {
+    writePageToMmap(freeMapPages[index], meta.getFreeMapPage(index));
+  }
+  dirtyFreeMap.clear();
+  txLock.unlock();
+  fsync(fd);
+  syncMeta();
+  wal.reset();
+  metaLock.unlock_shared();
+}
+
+void TransactionalPager::checkpointLoop() {
+  unique_lock<mutex> lock(checkpointLock);
+  while (true) {
+    checkpointWake.wait(lock, [this]() { return checkpointRequested || stopping; });
+    if (stopping) {
+      return;
+    }
+
+    checkpointRequested = false;
+    lock.unlock();
+    checkpoint();
+    lock.lock();
+  }
+}
+
+// page size has to be known before log is opened, it's read from meta page on disk (it never changes)
+size_t TransactionalPager::filePageSize(const path& path, size_t newPageSize) {
+  int filefd = open(path.c_str(), O_RDONLY);
+  if (filefd < 0) {
+    return newPageSize;
+  }
+
+  vector<byte> buf(MIN_PAGE_SIZE);
+  ssize_t ret = pread(filefd, buf.data(), MIN_PAGE_SIZE, 0);
+  close(filefd);
+  if (ret < MIN_PAGE_SIZE) { // never initialized
+    return newPageSize;
+  }
+
+  MetaPage page(buf);
+  return page.getPageSize();
+}
+
+TransactionalPager::TransactionalPager(path path, size_t newPageSize, PageLayout newLayout): pageSize(filePageSize(path, newPageSize)), wal(path.string() + "-wal", pageSize) {
+  if (!isPageSize(pageSize) || (newLayout == PageLayout::BigEndian && newPageSize != BigEndianLayout::pageSize)) {
+    throw runtime_error("page size has to be a power of two from 4K to 64K, 4K for big-endian layout");
+  }
+
   mode_t mode = S_IRWXU | S_IRWXG | S_IRWXO;
 
   int dirfd = open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY, S_IRWXU);
@@ -301,8 +616,10 @@ TransactionalPager::TransactionalPager(path path) {
     exit(errno);
   }
 
+  bool created = true;
   int filefd = openat(dirfd, path.filename().c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
   if (filefd < 0) {
+    created = false;
     if (errno == EEXIST) {
       filefd = openat(dirfd, path.filename().c_str(), O_RDWR);
     }
@@ -322,30 +639,62 @@ TransactionalPager::TransactionalPager(path path) {
     exit(errno);
   }
 
+  if ((size_t) statbuf.st_size > MMAP_RESERVE_SIZE) {
+    close(filefd);
+    throw runtime_error("database file exceeds reserved address space");
+  }
+
   fd = filefd;
-  if (statbuf.st_size < PAGE_SIZE) { // init meta
-    ftruncate(filefd, PAGE_SIZE);
+  if (created) {
+    wal.reset(); // log left from some older database file
+  }
+
+  void* reserveRet = mmap(nullptr, MMAP_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserveRet == MAP_FAILED) {
+    perror("mmap");
+    exit(errno);
+  }
+  mmapPtr = reinterpret_cast<byte*>(reserveRet);
+
+  size_t mappedLen = (max((size_t) statbuf.st_size, (size_t) pageSize) + pageSize - 1) / pageSize * pageSize;
+  fileLock.lock_upgrade();
+  growMapping(mappedLen);
+  fileLock.unlock_upgrade();
+
+  if (statbuf.st_size < (off_t) pageSize) { // init meta
+    meta.setLayout(newLayout);
+    meta.setPageSize(pageSize);
     meta.setCursize(1);
-    fileLen = PAGE_SIZE;
-    mmapLen = PAGE_SIZE;
-    void* mmapRet = mmap(nullptr, fileLen, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-    if (mmapRet == MAP_FAILED) {
-      perror("mmap");
-      exit(errno);
-    }
-    mmapPtr = reinterpret_cast<byte*>(mmapRet);
     syncMeta();
   }
   else {
-    fileLen = statbuf.st_size;
-    mmapLen = statbuf.st_size;
-    void* mmapRet = mmap(nullptr, fileLen, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-    if (mmapRet == MAP_FAILED) {
-      perror("mmap");
-      exit(errno);
-    }
-    mmapPtr = reinterpret_cast<byte*>(mmapRet);
+    recover();
     loadMeta();
-    loadFreeList();
+    if (!meta.isSupported()) {
+      munmap(mmapPtr, MMAP_RESERVE_SIZE);
+      close(fd);
+      throw runtime_error("database file is of unknown format version or page layout");
+    }
+    meta.setLayout(meta.getLayout()); // counted files of earlier builds get their version on next commit
+    if (!meta.hasFreeMap()) {
+      convertFreeList();
+    }
   }
+  appendCursor = meta.getCursize();
+
+  checkpointer = thread([this]() { this->checkpointLoop(); });
+}
+
+TransactionalPager::~TransactionalPager() {
+  checkpointLock.lock();
+  stopping = true;
+  checkpointLock.unlock();
+  checkpointWake.notify_all();
+  if (checkpointer.joinable()) {
+    checkpointer.join();
+  }
+
+  checkpoint();
+  munmap(mmapPtr, MMAP_RESERVE_SIZE);
+  close(fd);
 }
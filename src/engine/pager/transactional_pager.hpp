@@ -1,7 +1,13 @@
 #pragma once
 
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <functional>
+#include <stdexcept>
 #include <optional>
 #include <deque>
 #include <utility>
@@ -14,15 +20,23 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
 
 #include <boost/thread/shared_mutex.hpp>
 
 #include "./pager.hpp"
+#include "./wal.hpp"
 #include "../page/page.hpp"
 #include "../page/meta_page.hpp"
 
 using std::mutex;
+using std::condition_variable;
+using std::thread;
 using std::unordered_map;
+using std::map;
+using std::set;
+using std::function;
+using std::runtime_error;
 using std::optional;
 using std::deque;
 using std::nullopt;
@@ -34,17 +48,7 @@ using std::filesystem::path;
 using boost::upgrade_mutex;
 
 typedef uint64_t txid_t;
-
-enum class PageActionType: uint8_t {
-  Write,
-  Delete,
-};
-
-struct PageAction {
-  PageActionType type;
-  pageptr_t pageId;
-  optional<Page> page;
-};
+typedef uint64_t epoch_t; // number of write commits so far
 
 class TransactionalPager;
 
@@ -60,22 +64,34 @@ class TransactionalPagerLocal: public Pager {
   pageptr_t addPage(const Page& page) override;
   Page getPage(pageptr_t id) override;
   void delPage(pageptr_t id) override;
+  pageptr_t updatePage(pageptr_t id, const Page& page) override;
 
   void saveMetaPage(const MetaPage& metaPage) override;
   MetaPage getMetaPage() override;
+  void onCommit(function<void(Pager&)> update) override;
 };
 
-namespace {
+class TransactionalPager {
+ private:
   struct TxInfo {
-    bool writeMode;
-    string tableId;
+    bool writeMode = false;
+    string tableId{};
+    epoch_t epoch = 0; // transaction sees state after this many commits
+    MetaPage snapshot{}; // meta page as of epoch, writers keep their changes here
+    pageptr_t baseRoot = 0; // meta table root as of epoch, to detect conflicting writers
+    unordered_map<pageptr_t, Page> dirtyPages{}; // latest version of every page written by transaction
+    deque<pageptr_t> freedPages{}; // committed pages deleted by transaction
+    deque<pageptr_t> freeSlice{}; // pages reserved by transaction but not used yet
+    vector<function<void(Pager&)>> commitUpdates{}; // run inside commit, before updateMeta passed to it
   };
-};
 
-class TransactionalPager {
- private:
-  byte* mmapPtr{};
-  size_t mmapLen{};
+  struct FreedPage {
+    lsn_t lsn; // reusable once log is durable up to lsn
+    epoch_t epoch; // ... and every snapshot is at least this new
+    pageptr_t pageId;
+  };
+
+  byte* mmapPtr{}; // start of reserved address range, file is mapped at its beginning and never moves
   int64_t fd{};
   size_t fileLen{};
   upgrade_mutex fileLock; // fileLock protects only info about mapping, not the mapping itself
@@ -83,64 +99,94 @@ class TransactionalPager {
   unordered_map<string, upgrade_mutex> tableLocks;
   txid_t txidSeq{};
   unordered_map<txid_t, TxInfo> txInfo; 
-  unordered_map<txid_t, deque<PageAction>> actions;
-  deque<pageptr_t> newFreeList;
-  pageptr_t appendNum{};
-  MetaPage newMeta;
-  mutex txLock; // txLock protects info about transactions
-
-  MetaPage meta;
-  deque<pageptr_t> freeList;
-  upgrade_mutex metaLock; // metaLock protects info about meta page and meta page itself
+  map<epoch_t, size_t> activeSnapshots; // epoch -> number of transactions
+  epoch_t commitEpoch{};
+  mutex txLock; // txLock protects info about transactions and free space
+
+  MetaPage meta; // latest committed, written under txLock
+  deque<pageptr_t> freeList; // not reserved by any transaction
+  unordered_map<size_t, Page> freeMapPages; // free map nodes loaded so far, state of latest commit
+  set<size_t> dirtyFreeMap; // nodes changed since checkpoint, they reach the file only on checkpoint
+  size_t freeMapScanned{}; // nodes before it are loaded, free pages from them are in memory
+  deque<FreedPage> pendingFree; // freed pages still reachable from a snapshot or from durable state
+  pageptr_t appendCursor{}; // first page never handed out, >= meta cursize
+  upgrade_mutex metaLock; // metaLock serializes commits and checkpoints, taken only at commit
+
+  size_t pageSize; // of the file, recorded in meta page when file is created
+  WriteAheadLog wal;
+  thread checkpointer;
+  bool checkpointRequested{};
+  bool stopping{};
+  mutex checkpointLock; // checkpointLock protects checkpointer state
+  condition_variable checkpointWake;
+
+  // brings page to its on-disk form, frame is written as is
+  void sealPage(Page& page) {
+    page.materialize();
+    assert(page.frameSize() == pageSize);
+  }
 
-  void writePageToMmap(Page& page, pageptr_t writeTo) {
+  void writePageToMmap(const Page& page, pageptr_t writeTo) {
     if (writeTo == 0) {
       return;
     }
 
-    page.setPageType(page.byteSize());
-    page.data.resize(PAGE_SIZE);
+    assert(page.frameSize() == pageSize);
 
     fileLock.lock_shared();
-    memcpy(mmapPtr + writeTo * PAGE_SIZE, page.data.data(), PAGE_SIZE);
+    memcpy(mmapPtr + writeTo * pageSize, page.bytes(), pageSize);
     fileLock.unlock_shared();
   }
 
   void cleanTransaction(txid_t txid) {
-    actions.erase(txid);
-    upgrade_mutex& tableLock = tableLocks[txInfo[txid].tableId];
-    if (txInfo[txid].writeMode) { 
-      newMeta = MetaPage();
-      newFreeList = deque<pageptr_t>{};
-      appendNum = 0;
-
-      tableLock.unlock_upgrade();
-      metaLock.unlock_upgrade();
+    TxInfo& info = txInfo[txid];
+    if (info.writeMode) { 
+      // reservations of rolled back transaction are not referenced from anywhere
+      freeList.insert(freeList.end(), info.freeSlice.begin(), info.freeSlice.end());
+      for (auto& [pageId, page]: info.dirtyPages) {
+        freeList.push_back(pageId);
+      }
+
+      tableLocks[info.tableId].unlock_upgrade();
     }
-    else {
-      tableLock.unlock_shared();
-      metaLock.unlock_shared();
+
+    auto snapshotIt = activeSnapshots.find(info.epoch);
+    if (--snapshotIt->second == 0) {
+      activeSnapshots.erase(snapshotIt);
     }
     txInfo.erase(txid);
   }
 
+  // oldest epoch some transaction may still read
+  epoch_t oldestSnapshot() {
+    if (activeSnapshots.empty()) {
+      return commitEpoch;
+    }
+    return activeSnapshots.begin()->first;
+  }
+
+  MetaPage sealMeta(const MetaPage& metaPage) {
+    MetaPage writePage = metaPage;
+    writePage.data.resize(pageSize);
+    return writePage;
+  }
+
   void syncMeta() {
-    MetaPage writePage = meta;
-    writePage.data.resize(PAGE_SIZE);
+    MetaPage writePage = sealMeta(meta);
     
     fileLock.lock_shared();
-    memcpy(mmapPtr, writePage.data.data(), PAGE_SIZE);
+    memcpy(mmapPtr, writePage.data.data(), pageSize);
     fsync(fd);
     fileLock.unlock_shared();
   }
 
   void loadMeta() {
-    assert(fileLen >= PAGE_SIZE);
+    assert(fileLen >= pageSize);
     metaLock.lock_shared();
     fileLock.lock_shared();
     unsafe_buf<byte> buf = {
       ptr: mmapPtr,
-      len: PAGE_SIZE,
+      len: pageSize,
     };
 
     MetaPage page(buf);
@@ -153,47 +199,87 @@ class TransactionalPager {
 
   Page loadPage(pageptr_t id) {
     fileLock.lock_shared();
-    assert(id * PAGE_SIZE < fileLen);
-    assert(fileLen % PAGE_SIZE == 0);
+    assert(id * pageSize < fileLen);
+    assert(fileLen % pageSize == 0);
 
     unsafe_buf<byte> buf = {
-      ptr: mmapPtr + (id * PAGE_SIZE),
-      len: PAGE_SIZE,
+      ptr: mmapPtr + (id * pageSize),
+      len: pageSize,
     };
 
     Page page(buf);
     fileLock.unlock_shared();
-    pagesize_t dataSize = page.getByteSize();
-    page.data.resize(dataSize);
     return page;
   }
 
-  void syncFreeList();
-  void loadFreeList();
+  // no copy, page points straight into the mapping
+  // valid until the transaction ends: mapping only grows in place, and page itself
+  // is not reused while some snapshot can reach it
+  Page viewPage(pageptr_t id) {
+    fileLock.lock_shared();
+    assert(id * pageSize < fileLen);
+    assert(fileLen % pageSize == 0);
+
+    unsafe_buf<byte> buf = {
+      ptr: mmapPtr + (id * pageSize),
+      len: pageSize,
+    };
+
+    Page page = Page::createView(buf);
+    fileLock.unlock_shared();
+    return page;
+  }
+
+  static size_t filePageSize(const path& path, size_t newPageSize);
+
+  Page& loadFreeMap(size_t index);
+  void scanFreeMap();
+  void setFree(pageptr_t id, bool free, set<size_t>& touched);
+  void syncFreeMap(MetaPage& newMeta, const deque<pageptr_t>& freed, const vector<pair<pageptr_t, Page>>& writes, vector<pair<pageptr_t, Page>>& mapWrites);
+  void convertFreeList();
+  void reclaimFreed();
+
+  void growMapping(size_t newLen);
+  void recover();
+  void checkpoint();
+  void checkpointLoop();
+
+  lsn_t commitPages(txid_t txid, function<void(Pager&)> updateMeta);
 
-  pageptr_t findPlace(txid_t txid);
-  void allocate(size_t appendNum);
+  pageptr_t pageLimit();
+  pageptr_t findPlace(txid_t txid); // 0 if file is full
+  void allocate(pageptr_t pageCount);
  public:
   friend class TransactionalPagerLocal;
 
   pageptr_t addPage(const Page& page, txid_t txid);
   Page getPage(pageptr_t id, txid_t txid) ;
   void delPage(pageptr_t id, txid_t txid);
+  // pages written by transaction are not visible to anyone else yet, only the first change of committed page copies it
+  pageptr_t updatePage(pageptr_t id, const Page& page, txid_t txid);
 
   txid_t startTransaction(bool writable, string tableId);
   inline TransactionalPagerLocal getLocal(txid_t txid) { return TransactionalPagerLocal(*this, txid); }
 
   void commit(txid_t txid);
+  // updateMeta runs inside commit critical section against latest committed meta page,
+  // writers of different tables publish their roots this way without conflicting
+  void commit(txid_t txid, function<void(Pager&)> updateMeta);
+  // returns as soon as transaction is visible to others, future is ready once it's durable
+  future<void> commitAsync(txid_t txid, function<void(Pager&)> updateMeta = nullptr);
   inline void rollback(txid_t txid);
   
   void saveMetaPage(const MetaPage& metaPage, txid_t txid);
   MetaPage getMetaPage(txid_t txid) ;
+  // update is run by commit like its updateMeta, read-only transactions ignore it
+  void onCommit(function<void(Pager&)> update, txid_t txid);
 
-  TransactionalPager(path path);
+  // page size and layout are used only when file is created, existing file keeps its own
+  TransactionalPager(path path, size_t newPageSize = DEFAULT_PAGE_SIZE, PageLayout newLayout = PageLayout::Native);
 
   TransactionalPager(const TransactionalPager&) = delete;
   TransactionalPager& operator=(const TransactionalPager&) = delete;
   TransactionalPager(TransactionalPager&&) = default;
   TransactionalPager& operator=(TransactionalPager&&) = default;
-  ~TransactionalPager() = default;
+  ~TransactionalPager();
 };
@@ -0,0 +1,321 @@
+#include "./wal.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdio>
+
+#include <boost/crc.hpp>
+
+using std::unique_lock;
+using std::max;
+using std::min;
+using std::move;
+
+using boost::crc_32_type;
+
+#define WAL_RING_ENTRIES (64)
+#define FSYNC_TAG (1)
+#define STOP_TAG (2)
+
+void WriteAheadLog::writeAt(const byte* buf, size_t len, size_t offset) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = pwrite(fd, buf + written, len - written, offset + written);
+    if (ret < 0) {
+      perror("wal write");
+      exit(errno);
+    }
+    written += ret;
+  }
+}
+
+lsn_t WriteAheadLog::append(const vector<pair<pageptr_t, const byte*>>& pages) {
+  vector<byte> buf((sizeof(WalRecordHeader) + pageSize) * pages.size() + sizeof(WalRecordHeader));
+
+  crc_32_type crc;
+  size_t bufPos = 0;
+  for (auto [pageId, pageData]: pages) {
+    WalRecordHeader* header = reinterpret_cast<WalRecordHeader*>(buf.data() + bufPos);
+    header->type = std::to_underlying(WalRecordType::Page);
+    header->pageptr = pageId;
+    header->checksum = 0;
+    memcpy(buf.data() + bufPos + sizeof(WalRecordHeader), pageData, pageSize);
+
+    crc.process_bytes(buf.data() + bufPos, sizeof(WalRecordHeader) + pageSize);
+    bufPos += sizeof(WalRecordHeader) + pageSize;
+  }
+
+  WalRecordHeader* commitHeader = reinterpret_cast<WalRecordHeader*>(buf.data() + bufPos);
+  commitHeader->type = std::to_underlying(WalRecordType::Commit);
+  commitHeader->pageptr = pages.size();
+  commitHeader->checksum = crc.checksum();
+
+  appendLock.lock();
+  lsn_t writeFrom = appendedLsn.load();
+  lsn_t lsn = writeFrom + buf.size();
+  if (ring.available()) { // completion is handled by reaper, fsync after it makes it durable
+    WalWrite* write = new WalWrite {
+      buf: move(buf),
+      offset: writeFrom - baseLsn,
+    };
+
+    ringLock.lock();
+    io_uring_sqe* sqe = ring.getSqe();
+    while (sqe == nullptr) {
+      ring.submit();
+      sqe = ring.getSqe();
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(write->buf.data());
+    sqe->len = writeLimit != 0 ? min(write->buf.size(), writeLimit) : write->buf.size();
+    sqe->off = write->offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(write);
+    ring.submit();
+    ringLock.unlock();
+  }
+  else {
+    writeAt(buf.data(), buf.size(), writeFrom - baseLsn);
+  }
+  appendedLsn.store(lsn);
+  appendLock.unlock();
+
+  return lsn;
+}
+
+void WriteAheadLog::flush(lsn_t lsn) {
+  unique_lock<mutex> lock(flushLock);
+  while (flushedLsn < lsn) {
+    if (flushing) { // flush in progress may cover our lsn
+      flushDone.wait(lock);
+      continue;
+    }
+
+    if (ring.available()) {
+      submitFsync();
+      continue;
+    }
+
+    flushing = true;
+    lsn_t target = appendedLsn.load();
+    lock.unlock();
+    fdatasync(fd);
+    lock.lock();
+    flushing = false;
+    flushedLsn = max(flushedLsn, target);
+    flushDone.notify_all();
+  }
+}
+
+future<void> WriteAheadLog::flushAsync(lsn_t lsn) {
+  promise<void> done;
+  future<void> ret = done.get_future();
+  if (!ring.available()) {
+    flush(lsn);
+    done.set_value();
+    return ret;
+  }
+
+  unique_lock<mutex> lock(flushLock);
+  if (flushedLsn >= lsn) {
+    done.set_value();
+    return ret;
+  }
+
+  waiters[lsn].push_back(move(done));
+  if (!flushing) {
+    submitFsync();
+  }
+  return ret;
+}
+
+void WriteAheadLog::submitFsync() {
+  flushing = true;
+  // every write up to target is already in the ring, drain makes fsync start after all of them complete
+  flushTarget = appendedLsn.load();
+
+  ringLock.lock();
+  io_uring_sqe* sqe = ring.getSqe();
+  while (sqe == nullptr) {
+    ring.submit();
+    sqe = ring.getSqe();
+  }
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->flags = IOSQE_IO_DRAIN;
+  sqe->user_data = FSYNC_TAG;
+  ring.submit();
+  ringLock.unlock();
+}
+
+void WriteAheadLog::completeWaiters() {
+  while (!waiters.empty() && waiters.begin()->first <= flushedLsn) {
+    for (promise<void>& waiter: waiters.begin()->second) {
+      waiter.set_value();
+    }
+    waiters.erase(waiters.begin());
+  }
+}
+
+void WriteAheadLog::reapLoop() {
+  while (true) {
+    io_uring_cqe cqe = ring.waitCqe();
+    if (cqe.user_data == STOP_TAG) {
+      return;
+    }
+
+    if (cqe.res < 0) {
+      errno = -cqe.res;
+      perror(cqe.user_data == FSYNC_TAG ? "wal fsync" : "wal write");
+      exit(errno);
+    }
+
+    if (cqe.user_data == FSYNC_TAG) {
+      unique_lock<mutex> lock(flushLock);
+      flushing = false;
+      flushedLsn = max(flushedLsn, flushTarget);
+      completeWaiters();
+      if (!waiters.empty()) { // appended while fsync was running
+        submitFsync();
+      }
+      flushDone.notify_all();
+      continue;
+    }
+
+    WalWrite* write = reinterpret_cast<WalWrite*>(cqe.user_data);
+    if ((size_t) cqe.res < write->buf.size()) { // short write, rest is finished synchronously
+      writeAt(write->buf.data() + cqe.res, write->buf.size() - cqe.res, write->offset + cqe.res);
+      // drained fsync waits only for this completion, so it may have synced the log without the rest,
+      // the rest is synced here, before completion of that fsync is reaped and raises flushedLsn
+      fdatasync(fd);
+    }
+    delete write;
+  }
+}
+
+lsn_t WriteAheadLog::getFlushedLsn() {
+  unique_lock<mutex> lock(flushLock);
+  return flushedLsn;
+}
+
+void WriteAheadLog::recover(function<void(pageptr_t, const byte*)> apply) {
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) < 0) {
+    perror("fstat");
+    exit(errno);
+  }
+
+  vector<byte> buf(statbuf.st_size);
+  size_t read = 0;
+  while (read < buf.size()) {
+    ssize_t ret = pread(fd, buf.data() + read, buf.size() - read, read);
+    if (ret <= 0) {
+      break;
+    }
+    read += ret;
+  }
+  buf.resize(read);
+
+  size_t txStart = 0;
+  size_t bufPos = 0;
+  crc_32_type crc;
+  pageptr_t pageCount = 0;
+  while (bufPos + sizeof(WalRecordHeader) <= buf.size()) {
+    WalRecordHeader* header = reinterpret_cast<WalRecordHeader*>(buf.data() + bufPos);
+    WalRecordType type = WalRecordType(header->type.value());
+
+    if (type == WalRecordType::Page) {
+      if (bufPos + sizeof(WalRecordHeader) + pageSize > buf.size()) {
+        break;
+      }
+      crc.process_bytes(buf.data() + bufPos, sizeof(WalRecordHeader) + pageSize);
+      pageCount++;
+      bufPos += sizeof(WalRecordHeader) + pageSize;
+    }
+    else if (type == WalRecordType::Commit) {
+      if (header->pageptr.value() != pageCount || header->checksum.value() != crc.checksum()) {
+        break;
+      }
+
+      for (size_t pos = txStart; pos < bufPos; pos += sizeof(WalRecordHeader) + pageSize) {
+        WalRecordHeader* pageHeader = reinterpret_cast<WalRecordHeader*>(buf.data() + pos);
+        apply(pageHeader->pageptr.value(), buf.data() + pos + sizeof(WalRecordHeader));
+      }
+
+      bufPos += sizeof(WalRecordHeader);
+      txStart = bufPos;
+      crc.reset();
+      pageCount = 0;
+    }
+    else { // garbage after torn write
+      break;
+    }
+  }
+}
+
+void WriteAheadLog::reset() {
+  appendLock.lock();
+  flushLock.lock();
+  ftruncate(fd, 0);
+  fdatasync(fd);
+  baseLsn = appendedLsn.load();
+  flushedLsn = max(flushedLsn, baseLsn);
+  flushLock.unlock();
+  appendLock.unlock();
+}
+
+WriteAheadLog::WriteAheadLog(path path, size_t pageSize, size_t writeLimit): pageSize(pageSize), writeLimit(writeLimit), ring(WAL_RING_ENTRIES) {
+  mode_t mode = S_IRWXU | S_IRWXG | S_IRWXO;
+
+  int dirfd = open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY, S_IRWXU);
+  if (dirfd < 0) {
+    perror("bad path");
+    exit(errno);
+  }
+
+  int filefd = openat(dirfd, path.filename().c_str(), O_RDWR | O_CREAT, mode);
+  if (filefd < 0) {
+    perror("bad path");
+    exit(errno);
+  }
+
+  fsync(dirfd);
+  close(dirfd);
+
+  struct stat statbuf;
+  int status = fstat(filefd, &statbuf);
+  if (status < 0) {
+    perror("fstat");
+    exit(errno);
+  }
+
+  fd = filefd;
+  appendedLsn.store(statbuf.st_size);
+  flushedLsn = statbuf.st_size;
+
+  if (ring.available()) {
+    reaper = thread([this]() { this->reapLoop(); });
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (ring.available()) {
+    flushAll();
+
+    ringLock.lock();
+    io_uring_sqe* sqe = ring.getSqe();
+    while (sqe == nullptr) {
+      ring.submit();
+      sqe = ring.getSqe();
+    }
+    sqe->opcode = IORING_OP_NOP;
+    sqe->flags = IOSQE_IO_DRAIN;
+    sqe->user_data = STOP_TAG;
+    ring.submit();
+    ringLock.unlock();
+    reaper.join();
+  }
+  close(fd);
+}
@@ -0,0 +1,138 @@
+/*
+WAL format:
+
+Uses big-endian
+
+Log is a sequence of transactions, each one is a run of page records closed by a commit record.
+Transaction without valid commit record (torn write) is ignored on recovery.
+
+Record header:
++---------+---------+----------+
+|  Type   | Pageptr | Checksum |
++---------+---------+----------+
+| 1 byte  | 6 bytes | 4 bytes  |
++---------+---------+----------+
+
+Page record:
++---------------+------------+
+| Record header | Page image |
++---------------+------------+
+| 11 bytes      | Page size  |
++---------------+------------+
+
+Commit record:
++---------------+
+| Record header |
++---------------+
+| 11 bytes      |
++---------------+
+Pageptr holds count of page records in transaction, checksum is crc32 of all of them
+
+*/
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <thread>
+#include <map>
+#include <filesystem>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/endian/buffers.hpp>
+
+#include "../page/page.hpp"
+#include "./io_uring.hpp"
+
+using std::mutex;
+using std::condition_variable;
+using std::atomic;
+using std::function;
+using std::future;
+using std::promise;
+using std::thread;
+using std::map;
+using std::vector;
+using std::pair;
+using std::filesystem::path;
+
+using namespace boost::endian;
+
+typedef uint64_t lsn_t; // position in log, grows monotonically (not reset by checkpoints)
+
+enum class WalRecordType: uint8_t {
+  Page = 0x1,
+  Commit = 0x2,
+};
+
+namespace {
+  struct WalRecordHeader {
+    big_uint8_buf_t type;
+    big_uint48_buf_t pageptr;
+    big_uint32_buf_t checksum;
+  };
+
+  // write in flight, buffer has to live until completion
+  struct WalWrite {
+    vector<byte> buf;
+    size_t offset;
+  };
+};
+
+class WriteAheadLog {
+ private:
+  int64_t fd{};
+  size_t pageSize{}; // of database file, every page record has it
+  size_t writeLimit{}; // io_uring writes are cut to this many bytes, 0 means no limit
+
+  lsn_t baseLsn{}; // lsn of the first byte of the file
+  atomic<lsn_t> appendedLsn{};
+  mutex appendLock; // appendLock protects file tail
+
+  lsn_t flushedLsn{};
+  bool flushing{};
+  lsn_t flushTarget{}; // lsn covered by fsync in flight
+  map<lsn_t, vector<promise<void>>> waiters; // async commits waiting for durability
+  mutex flushLock; // flushLock protects flush state
+  condition_variable flushDone;
+
+  // with io_uring writes and fsyncs are submitted without waiting and completed by reaper thread,
+  // otherwise io is blocking
+  IoUring ring;
+  mutex ringLock; // ringLock protects submission queue
+  thread reaper;
+
+  void writeAt(const byte* buf, size_t len, size_t offset);
+  void submitFsync(); // called under flushLock
+  void completeWaiters(); // called under flushLock
+  void reapLoop();
+ public:
+  // pages are full page images, returns lsn that has to be flushed for transaction to be durable
+  lsn_t append(const vector<pair<pageptr_t, const byte*>>& pages);
+
+  // group commit: one fdatasync covers every transaction appended before it started
+  void flush(lsn_t lsn);
+  void flushAll() { flush(appendedLsn.load()); }
+  // ready once log is durable up to lsn, doesn't block
+  future<void> flushAsync(lsn_t lsn);
+  lsn_t getFlushedLsn();
+
+  size_t size() { return appendedLsn.load() - baseLsn; }
+
+  // replays pages of every committed transaction in log order
+  void recover(function<void(pageptr_t, const byte*)> apply);
+
+  // drops log contents, every logged page has to be durable in main file already
+  void reset();
+
+  // writeLimit cuts every io_uring write short, so tests can make the reaper finish writes itself
+  WriteAheadLog(path path, size_t pageSize, size_t writeLimit = 0);
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  ~WriteAheadLog();
+};
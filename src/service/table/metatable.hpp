@@ -15,9 +15,13 @@ using nlohmann::json;
 class Metatable {
  private:
   Pager& pager;
-  Bptree bptree;
+
+  // root is read every time, table roots published at commit may have moved it (see Pager::onCommit)
+  Bptree tree() const {
+    return Bptree(pager, pager.getMetaPage().getMetaTableRoot());
+  }
  public:
-  Metatable(Pager& pager): pager(pager), bptree(Bptree(pager, pager.getMetaPage().getMetaTableRoot())) {}
+  Metatable(Pager& pager): pager(pager) {}
 
   void insert(string id, TableMetadata value) {
     json ser = value;
@@ -25,6 +29,7 @@ class Metatable {
     json serId = id;
     vector<byte> keyArr = json::to_cbor(serId);
 
+    Bptree bptree = tree();
     bptree.insert(keyArr, valueArr);
     MetaPage meta = pager.getMetaPage();
     meta.setMetaTableRoot(bptree.getRootId());
@@ -35,6 +40,7 @@ class Metatable {
     json serId = id;
     vector<byte> keyArr = json::to_cbor(serId);
 
+    Bptree bptree = tree();
     bptree.remove(keyArr);
     MetaPage meta = pager.getMetaPage();
     meta.setMetaTableRoot(bptree.getRootId());
@@ -45,7 +51,7 @@ class Metatable {
     json serId = id;
     vector<byte> keyArr = json::to_cbor(serId);
 
-    auto valArrOpt = bptree.search(keyArr);
+    auto valArrOpt = tree().search(keyArr);
     if (valArrOpt.has_value()) {
       json serMeta = json::from_cbor(valArrOpt.value());
       TableMetadata metaData = serMeta.template get<TableMetadata>();
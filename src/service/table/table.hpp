@@ -9,9 +9,18 @@ class Table {
   Metatable& metatable;
   string tableId;
   Bptree bptree;
+  pageptr_t publishedRoot;
+
+  // every changed root goes to metatable at commit, plain commit(txid) doesn't lose it
+  void publishRoot() {
+    if (bptree.getRootId() != publishedRoot) {
+      publishedRoot = bptree.getRootId();
+      pager.onCommit(saveRoot());
+    }
+  }
  public:
   Table(Pager& pager, Metatable& metatable, string tableId, pageptr_t rootId): 
-    pager(pager), metatable(metatable), tableId(tableId), bptree(Bptree(pager, rootId)) {}
+    pager(pager), metatable(metatable), tableId(tableId), bptree(Bptree(pager, rootId)), publishedRoot(rootId) {}
 
   static Table createNewTable(Pager& pager, Metatable& metatable, string tableId, vector<Field> fields) {
     auto bptree = Bptree::createTree(pager);
@@ -28,12 +37,56 @@ class Table {
 
   void insert(vector<byte> key, vector<byte> value) {
     bptree.insert(key, value);
-    metatable.setTableRoot(tableId, bptree.getRootId());
+    publishRoot();
+  }
+
+  // rows of one request go in together, pages on their paths are written once
+  void insertBatch(vector<pair<vector<byte>, vector<byte>>> rows) {
+    bptree.insertBatch(move(rows));
+    publishRoot();
   }
 
   void remove(vector<byte> key) {
     bptree.remove(key);
-    metatable.setTableRoot(tableId, bptree.getRootId());
+    publishRoot();
+  }
+
+  // rows with lowerBound <= key < upperBound, e.g. of one tenant or of expired time window
+  void removeRange(const vector<byte>& lowerBound, const vector<byte>& upperBound) {
+    bptree.removeRange(lowerBound, upperBound);
+    publishRoot();
+  }
+
+  // publishes current root against metatable of the moment it runs, insert() and others register it by themselves
+  function<void(Pager&)> saveRoot() {
+    return [tableId = this->tableId, rootId = bptree.getRootId()](Pager& pager) {
+      Metatable metatable(pager);
+      metatable.setTableRoot(tableId, rootId);
+    };
+  }
+
+  // rows with lowerBound <= key < upperBound, cursor reads every page of the range once
+  BptreeCursor scan(const vector<byte>& lowerBound, optional<vector<byte>> upperBound = nullopt) const {
+    return bptree.scan(lowerBound, upperBound);
+  }
+
+  // row counts and OFFSET pagination without scanning, need file of counted layout (see Bptree::count())
+  uint64_t count() const {
+    return bptree.count();
+  }
+
+  uint64_t countRange(const vector<byte>& lowerBound, const vector<byte>& upperBound) const {
+    return bptree.countRange(lowerBound, upperBound);
+  }
+
+  // like scan(), but skips the first offset rows of the range
+  BptreeCursor scanAt(const vector<byte>& lowerBound, uint64_t offset, optional<vector<byte>> upperBound = nullopt) const {
+    return bptree.at(bptree.rank(lowerBound) + offset, upperBound);
+  }
+
+  // results are in order of keys, e.g. for IN-list lookup
+  vector<optional<vector<byte>>> multiGet(const vector<vector<byte>>& keys) const {
+    return bptree.multiGet(keys);
   }
 
   optional<vector<byte>> search(vector<byte> key) const {
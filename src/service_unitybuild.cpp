@@ -1,5 +1,7 @@
 #include "./engine/page/page.cpp"
 #include "./engine/page/meta_page.cpp"
 #include "./engine/bptree/bptree.cpp"
+#include "./engine/pager/io_uring.cpp"
+#include "./engine/pager/wal.cpp"
 #include "./engine/pager/transactional_pager.cpp"
 #include "./service/main.cpp"
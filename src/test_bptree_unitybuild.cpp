@@ -0,0 +1,4 @@
+#include "./engine/page/page.cpp"
+#include "./engine/page/meta_page.cpp"
+#include "./engine/bptree/bptree.cpp"
+#include "./engine/bptree/test/test.cpp"
@@ -1,5 +1,8 @@
 #include "./engine/page/page.cpp"
 #include "./engine/page/meta_page.cpp"
 #include "./engine/bptree/bptree.cpp"
+#include "./engine/pager/io_uring.cpp"
+#include "./engine/pager/wal.cpp"
 #include "./engine/pager/transactional_pager.cpp"
+#include "./engine/pager/buffer_pool_pager.cpp"
 #include "./engine/pager/test/test.cpp"